@@ -0,0 +1,754 @@
+#include<chrono>
+#include<cstdio>
+#include<cstdlib>
+#include<cstring>
+#include<string>
+#include<vector>
+#include<set>
+#include<mutex>
+#include<condition_variable>
+#include<atomic>
+#include<thread>
+#include<algorithm>
+#include<functional>
+/*
+线程池性能测试
+新版线程池: g++ -std=c++17 -O2 -pthread bench_threadpool.cpp -o bench_threadpool
+旧版线程池: g++ -std=c++17 -O2 -pthread -DBENCH_LEGACY_POOL bench_threadpool.cpp threadpool.cpp -o bench_threadpool_legacy
+运行参数:
+    --format=text|csv|json  输出格式,默认text
+    --out=FILE              csv/json写入文件,默认stdout(线程池自身的日志也打印到stdout)
+    --threads=N             线程数量,默认max(4, 硬件线程数)
+    --quick                 减少任务数量,用于快速回归
+    --long                  额外测试cached模式线程空闲回收,需要等待CACHED_IDLE_WAIT_SEC秒
+*/
+#ifdef BENCH_LEGACY_POOL
+#include"threadpool.h"
+#define BENCH_VARIANT "threadpool.h"
+#define THREAD_MAX_FREE_TIME 60 // 与threadpool.cpp中的定义一致
+#define CACHE_LINE_SIZE 64      // 与threadpool_finall.h中的定义一致
+#define CACHED_IDLE_WAIT_SEC(threads) (THREAD_MAX_FREE_TIME + 3)
+#else
+#include"threadpool_finall.h"
+#define BENCH_VARIANT "threadpool_finall.h"
+// 控制器每CACHED_SHRINK_TICKS个周期回收一个线程
+#define CACHED_IDLE_WAIT_SEC(threads) ((threads) * CACHED_SHRINK_TICKS * CACHED_CONTROL_INTERVAL / 1000 + 2)
+#endif
+
+// 统计全局堆分配次数
+// 替换全部普通和数组形式的new/delete,它们成对使用malloc/free;对齐形式的new/delete保持默认实现,同样成对
+static std::atomic<long> g_allocCount(0);
+static void* countedAlloc(size_t size)
+{
+    g_allocCount.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+void* operator new(size_t size) { return countedAlloc(size); }
+void* operator new[](size_t size) { return countedAlloc(size); }
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, size_t) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete[](void* p, size_t) noexcept { std::free(p); }
+
+using Clock = std::chrono::steady_clock;
+
+static double secondsSince(Clock::time_point begin)
+{
+    return std::chrono::duration<double>(Clock::now() - begin).count();
+}
+static int64_t nowNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count();
+}
+
+int add(int a, int b)
+{
+    return a + b;
+}
+
+// 计数器归零时唤醒等待线程,用来等待一批任务结束,两种线程池通用
+class Latch
+{
+public:
+    explicit Latch(long count = 0) : count_(count) {}
+    void reset(long count) { count_ = count; }
+    void add(long count) { count_ += count; }
+    void countDown()
+    {
+        if (--count_ == 0)
+        {
+            std::unique_lock<std::mutex> lock(mtx_);
+            cond_.notify_all();
+        }
+    }
+    void wait()
+    {
+        std::unique_lock<std::mutex> lock(mtx_);
+        cond_.wait(lock, [&]() -> bool { return count_ == 0; });
+    }
+private:
+    std::atomic_long count_;
+    std::mutex mtx_;
+    std::condition_variable cond_;
+};
+
+///////////////////////   两种线程池的适配层   ///////////////////////////////
+#ifdef BENCH_LEGACY_POOL
+static const std::vector<std::pair<PoolMode, const char*>> g_modes = {
+    { PoolMode::MODE_FIXED, "fixed" },
+    { PoolMode::MODE_CACHED, "cached" },
+};
+// 旧版线程池通过继承TypedTask提交任务,返回值保存在任务对象中,TypedResult可以直接移动保存
+class BenchPool
+{
+public:
+    BenchPool(PoolMode mode, int threads, int maxThreads = 0)
+    {
+        pool_.setMode(mode);
+        if (maxThreads > 0)
+            pool_.setMaxThreadSisze_(maxThreads);
+        pool_.settaskQueMaxSize_(1 << 16);
+        pool_.start(threads);
+    }
+    ~BenchPool() { drain(); }
+    void post(std::function<void()> func)
+    {
+        TypedResult<void> result = pool_.submitTask(std::make_shared<FuncTask>(std::move(func)));
+        std::unique_lock<std::mutex> lock(mtx_);
+        results_.push_back(std::move(result));
+    }
+    // 等待所有任务执行完成
+    void drain()
+    {
+        std::vector<TypedResult<void>> results;
+        {
+            std::unique_lock<std::mutex> lock(mtx_);
+            results.swap(results_);
+        }
+        for (auto& r : results)
+            r.get();
+    }
+private:
+    class FuncTask : public TypedTask<void>
+    {
+    public:
+        explicit FuncTask(std::function<void()> func) : func_(std::move(func)) {}
+        void run() override { func_(); }
+    private:
+        std::function<void()> func_;
+    };
+    ThreadPool pool_;
+    std::mutex mtx_;
+    std::vector<TypedResult<void>> results_;
+};
+#else
+static const std::vector<std::pair<PoolMode, const char*>> g_modes = {
+    { PoolMode::MODE_FIXED, "fixed" },
+    { PoolMode::MODE_CACHED, "cached" },
+    { PoolMode::MODE_WORK_STEALING, "work-stealing" },
+};
+class BenchPool
+{
+public:
+    BenchPool(PoolMode mode, int threads, int maxThreads = 0)
+    {
+        pool_.setMode(mode);
+        if (maxThreads > 0)
+            pool_.setMaxThreadSisze_(maxThreads);
+        pool_.settaskQueMaxSize_(1 << 16);
+        pool_.setQueueFullPolicy(QueueFullPolicy::BLOCK);
+        pool_.start(threads);
+    }
+    template<typename Func>
+    void post(Func&& func)
+    {
+        pool_.submitTask(std::forward<Func>(func));
+    }
+    void drain() {}
+    ThreadPool& pool() { return pool_; }
+private:
+    ThreadPool pool_;
+};
+#endif
+
+///////////////////////   结果输出   ///////////////////////////////
+struct BenchRecord
+{
+    std::string bench;
+    std::string mode;
+    int threads = 0;
+    int producers = 0;
+    long ops = 0;
+    double seconds = 0;
+    double allocsPerOp = -1;
+    // 延迟分位数 单位:微秒 小于0表示没有统计
+    double p50Us = -1;
+    double p99Us = -1;
+    double p999Us = -1;
+    double maxUs = -1;
+    std::string note;
+};
+
+enum class OutputFormat { TEXT, CSV, JSON };
+
+struct BenchConfig
+{
+    OutputFormat format = OutputFormat::TEXT;
+    int threads = std::max(4, (int)std::thread::hardware_concurrency());
+    bool quick = false;
+    bool longRun = false;
+    std::string out;
+    long scale(long n) const { return quick ? std::max(1L, n / 10) : n; }
+};
+
+static std::vector<BenchRecord> g_records;
+
+static void printText(const BenchRecord& r)
+{
+    fprintf(stderr, "%-18s %-13s thr=%-3d prod=%-3d %12.0f ops/s", r.bench.c_str(), r.mode.c_str(),
+        r.threads, r.producers, r.seconds > 0 ? r.ops / r.seconds : 0);
+    if (r.allocsPerOp >= 0)
+        fprintf(stderr, "  %6.2f allocs/op", r.allocsPerOp);
+    if (r.p50Us >= 0)
+        fprintf(stderr, "  p50=%.1fus p99=%.1fus p999=%.1fus max=%.1fus", r.p50Us, r.p99Us, r.p999Us, r.maxUs);
+    if (!r.note.empty())
+        fprintf(stderr, "  %s", r.note.c_str());
+    fprintf(stderr, "\n");
+}
+
+// text格式边测边打印,csv/json在全部测试结束后输出到stdout
+static void report(const BenchConfig& cfg, BenchRecord r)
+{
+    if (cfg.format == OutputFormat::TEXT)
+        printText(r);
+    g_records.push_back(std::move(r));
+}
+
+static void printCsv(FILE* fp)
+{
+    fprintf(fp, "variant,bench,mode,threads,producers,ops,seconds,ops_per_sec,allocs_per_op,p50_us,p99_us,p999_us,max_us,note\n");
+    for (const BenchRecord& r : g_records)
+    {
+        fprintf(fp, "%s,%s,%s,%d,%d,%ld,%.6f,%.0f,%.3f,%.2f,%.2f,%.2f,%.2f,%s\n", BENCH_VARIANT, r.bench.c_str(), r.mode.c_str(),
+            r.threads, r.producers, r.ops, r.seconds, r.seconds > 0 ? r.ops / r.seconds : 0, r.allocsPerOp,
+            r.p50Us, r.p99Us, r.p999Us, r.maxUs, r.note.c_str());
+    }
+}
+
+static void printJson(FILE* fp)
+{
+    fprintf(fp, "[\n");
+    for (size_t i = 0; i < g_records.size(); i++)
+    {
+        const BenchRecord& r = g_records[i];
+        fprintf(fp, "  {\"variant\": \"%s\", \"bench\": \"%s\", \"mode\": \"%s\", \"threads\": %d, \"producers\": %d, "
+            "\"ops\": %ld, \"seconds\": %.6f, \"ops_per_sec\": %.0f, \"allocs_per_op\": %.3f, "
+            "\"p50_us\": %.2f, \"p99_us\": %.2f, \"p999_us\": %.2f, \"max_us\": %.2f, \"note\": \"%s\"}%s\n",
+            BENCH_VARIANT, r.bench.c_str(), r.mode.c_str(), r.threads, r.producers, r.ops, r.seconds,
+            r.seconds > 0 ? r.ops / r.seconds : 0, r.allocsPerOp, r.p50Us, r.p99Us, r.p999Us, r.maxUs,
+            r.note.c_str(), i + 1 < g_records.size() ? "," : "");
+    }
+    fprintf(fp, "]\n");
+}
+
+// 把延迟样本(纳秒)的分位数写入结果
+static void setPercentiles(BenchRecord& r, std::vector<int64_t>& samples)
+{
+    if (samples.empty())
+        return;
+    std::sort(samples.begin(), samples.end());
+    auto at = [&](double q) -> double {
+        size_t i = std::min(samples.size() - 1, (size_t)(q * samples.size()));
+        return samples[i] / 1000.0;
+    };
+    r.p50Us = at(0.50);
+    r.p99Us = at(0.99);
+    r.p999Us = at(0.999);
+    r.maxUs = samples.back() / 1000.0;
+}
+
+///////////////////////   测试项   ///////////////////////////////
+
+#ifndef BENCH_LEGACY_POOL
+// 旧版submitTask构造任务的方式: make_shared<packaged_task> + bind + 可拷贝的function
+static void benchTaskObjectBefore(const BenchConfig& cfg, long n)
+{
+    long allocs = g_allocCount;
+    auto begin = Clock::now();
+    long sum = 0;
+    for (long i = 0; i < n; i++)
+    {
+        auto task = std::make_shared<std::packaged_task<int()>>(std::bind(add, (int)i, 1));
+        std::future<int> result = task->get_future();
+        std::function<void()> func = [task]() { (*task)(); };
+        std::function<void()> copy = func; // 旧版threadFunc中 task = taskQue_.front()
+        copy();
+        sum += result.get();
+    }
+    BenchRecord r;
+    r.bench = "task-object";
+    r.mode = "before";
+    r.ops = n;
+    r.seconds = secondsSince(begin);
+    r.allocsPerOp = (double)(g_allocCount - allocs) / n;
+    r.note = "sum=" + std::to_string(sum);
+    report(cfg, r);
+}
+
+// 新版submitTask构造任务的方式: UniqueFunction内联闭包 + 内存池分配的promise
+static void benchTaskObjectAfter(const BenchConfig& cfg, long n)
+{
+    long allocs = g_allocCount;
+    auto begin = Clock::now();
+    long sum = 0;
+    for (long i = 0; i < n; i++)
+    {
+        std::promise<int> promise(std::allocator_arg, PoolAllocator<int>());
+        std::future<int> result = promise.get_future();
+        UniqueFunction<void()> func = [promise = std::move(promise), i]() mutable { promise.set_value(add((int)i, 1)); };
+        UniqueFunction<void()> moved = std::move(func);
+        moved();
+        sum += result.get();
+    }
+    BenchRecord r;
+    r.bench = "task-object";
+    r.mode = "after";
+    r.ops = n;
+    r.seconds = secondsSince(begin);
+    r.allocsPerOp = (double)(g_allocCount - allocs) / n;
+    r.note = "sum=" + std::to_string(sum);
+    report(cfg, r);
+}
+
+// 扇出: 比较逐个submitTask和submitBatch,都通过future等待
+static void benchSubmitBatch(const BenchConfig& cfg, bool batch, int rounds, int fanout)
+{
+    ThreadPool pool;
+    pool.settaskQueMaxSize_(fanout);
+    pool.start(cfg.threads);
+
+    std::vector<int> inputs(fanout);
+    for (int i = 0; i < fanout; i++)
+        inputs[i] = i;
+    std::vector<std::future<int>> results;
+    long allocs = g_allocCount;
+    auto begin = Clock::now();
+    long sum = 0;
+    for (int r = 0; r < rounds; r++)
+    {
+        if (batch)
+        {
+            results = pool.submitBatch([](int x) { return add(x, 1); }, inputs.begin(), inputs.end());
+        }
+        else
+        {
+            results.clear();
+            for (int x : inputs)
+                results.push_back(pool.submitTask(add, x, 1));
+        }
+        for (auto& f : results)
+            sum += f.get();
+    }
+    BenchRecord r;
+    r.bench = "future-fan-out";
+    r.mode = batch ? "submitBatch" : "submitTask";
+    r.threads = cfg.threads;
+    r.producers = 1;
+    r.ops = (long)rounds * fanout;
+    r.seconds = secondsSince(begin);
+    r.allocsPerOp = (double)(g_allocCount - allocs) / r.ops;
+    ParkingStats ps = pool.parkingStats();
+    r.note = "parks=" + std::to_string(ps.parks) + " sum=" + std::to_string(sum);
+    report(cfg, r);
+}
+#endif
+
+// 空任务吞吐量: 一个线程连续提交n个空任务,等待全部完成
+static void benchEmptyTasks(const BenchConfig& cfg, PoolMode mode, const char* modeName, long n)
+{
+    Latch latch(n);
+    long allocs;
+    Clock::time_point begin;
+    {
+        BenchPool pool(mode, cfg.threads);
+        allocs = g_allocCount;
+        begin = Clock::now();
+        for (long i = 0; i < n; i++)
+            pool.post([&latch]() { latch.countDown(); });
+        latch.wait();
+    }
+    BenchRecord r;
+    r.bench = "empty-task";
+    r.mode = modeName;
+    r.threads = cfg.threads;
+    r.producers = 1;
+    r.ops = n;
+    r.seconds = secondsSince(begin);
+    r.allocsPerOp = (double)(g_allocCount - allocs) / n;
+    report(cfg, r);
+}
+
+#ifndef BENCH_LEGACY_POOL
+// 不等待结果的提交: promise状态和结果由提交线程分配、工作线程释放,
+// 按轮提交burst个任务并等待它们结束,第一轮用于预热,之后统计每个任务的堆分配次数
+static void benchFireAndForget(const BenchConfig& cfg, PoolMode mode, const char* modeName, int rounds, int burst)
+{
+    BenchPool pool(mode, cfg.threads);
+    Latch latch;
+    long allocs = 0;
+    Clock::time_point begin;
+    for (int r = 0; r <= rounds; r++)
+    {
+        if (r == 1)
+        {
+            allocs = g_allocCount;
+            begin = Clock::now();
+        }
+        latch.reset(burst);
+        for (int i = 0; i < burst; i++)
+            pool.post([&latch]() { latch.countDown(); });
+        latch.wait();
+    }
+    BenchRecord r;
+    r.bench = "fire-and-forget";
+    r.mode = modeName;
+    r.threads = cfg.threads;
+    r.producers = 1;
+    r.ops = (long)rounds * burst;
+    r.seconds = secondsSince(begin);
+    r.allocsPerOp = (double)(g_allocCount - allocs) / r.ops;
+    r.note = "burst=" + std::to_string(burst);
+    report(cfg, r);
+}
+#endif
+
+// 提交到开始执行的延迟
+// idle: 每次等上一个任务执行完再提交,测的是唤醒空闲线程的延迟
+// burst: 每次连续提交burst个任务,测的是排队加调度的延迟
+static void benchLatency(const BenchConfig& cfg, PoolMode mode, const char* modeName, long n, int burst)
+{
+    std::vector<int64_t> samples(n);
+    BenchPool pool(mode, cfg.threads);
+    Latch latch;
+    auto begin = Clock::now();
+    for (long i = 0; i < n; i += burst)
+    {
+        long count = std::min<long>(burst, n - i);
+        latch.reset(count);
+        for (long j = i; j < i + count; j++)
+        {
+            int64_t submitTime = nowNs();
+            pool.post([&samples, &latch, j, submitTime]()
+            {
+                samples[j] = nowNs() - submitTime;
+                latch.countDown();
+            });
+        }
+        latch.wait();
+    }
+    double sec = secondsSince(begin);
+    pool.drain();
+    BenchRecord r;
+    r.bench = burst == 1 ? "latency-idle" : "latency-burst";
+    r.mode = modeName;
+    r.threads = cfg.threads;
+    r.producers = 1;
+    r.ops = n;
+    r.seconds = sec;
+    setPercentiles(r, samples);
+    if (burst > 1)
+        r.note = "burst=" + std::to_string(burst);
+    report(cfg, r);
+}
+
+// 扇出/扇入: 每轮提交fanout个任务,全部完成后再开始下一轮
+static void benchFanOutIn(const BenchConfig& cfg, PoolMode mode, const char* modeName, int rounds, int fanout)
+{
+    BenchPool pool(mode, cfg.threads);
+    Latch latch;
+    std::vector<int64_t> samples(rounds);
+    auto begin = Clock::now();
+    for (int r = 0; r < rounds; r++)
+    {
+        int64_t roundBegin = nowNs();
+        latch.reset(fanout);
+        for (int i = 0; i < fanout; i++)
+            pool.post([&latch]() { latch.countDown(); });
+        latch.wait();
+        samples[r] = nowNs() - roundBegin;
+    }
+    double sec = secondsSince(begin);
+    pool.drain();
+    BenchRecord r;
+    r.bench = "fan-out-in";
+    r.mode = modeName;
+    r.threads = cfg.threads;
+    r.producers = 1;
+    r.ops = (long)rounds * fanout;
+    r.seconds = sec;
+    // 这里的分位数是每轮的耗时
+    setPercentiles(r, samples);
+    r.note = "fanout=" + std::to_string(fanout) + " percentiles=round";
+    report(cfg, r);
+}
+
+// 嵌套提交: roots个任务在线程池内部各提交children个子任务
+static void benchNested(const BenchConfig& cfg, PoolMode mode, const char* modeName, int roots, int children)
+{
+    BenchPool pool(mode, cfg.threads);
+    Latch latch((long)roots * (children + 1));
+    auto begin = Clock::now();
+    for (int i = 0; i < roots; i++)
+    {
+        pool.post([&pool, &latch, children]()
+        {
+            for (int c = 0; c < children; c++)
+                pool.post([&latch]() { latch.countDown(); });
+            latch.countDown();
+        });
+    }
+    latch.wait();
+    double sec = secondsSince(begin);
+    pool.drain();
+    BenchRecord r;
+    r.bench = "nested-submit";
+    r.mode = modeName;
+    r.threads = cfg.threads;
+    r.producers = 1;
+    r.ops = (long)roots * (children + 1);
+    r.seconds = sec;
+    r.note = "children=" + std::to_string(children);
+    report(cfg, r);
+}
+
+// 多个生产者线程同时提交空任务
+static void benchProducers(const BenchConfig& cfg, PoolMode mode, const char* modeName, int producers, long perProducer)
+{
+    BenchPool pool(mode, cfg.threads);
+    Latch latch((long)producers * perProducer);
+    std::atomic_bool go(false);
+    std::vector<std::thread> threads;
+    for (int p = 0; p < producers; p++)
+    {
+        threads.emplace_back([&]()
+        {
+            while (!go)
+                std::this_thread::yield();
+            for (long i = 0; i < perProducer; i++)
+                pool.post([&latch]() { latch.countDown(); });
+        });
+    }
+    auto begin = Clock::now();
+    go = true;
+    for (auto& t : threads)
+        t.join();
+    latch.wait();
+    double sec = secondsSince(begin);
+    pool.drain();
+    BenchRecord r;
+    r.bench = "producer-scaling";
+    r.mode = modeName;
+    r.threads = cfg.threads;
+    r.producers = producers;
+    r.ops = (long)producers * perProducer;
+    r.seconds = sec;
+    report(cfg, r);
+}
+
+// cached模式的线程增长: 1个初始线程,提交一批会阻塞一段时间的任务,统计执行任务的线程数量
+// longRun时空闲CACHED_IDLE_WAIT_SEC秒(足够回收多余线程)后再提交一批,统计回收后新出现的线程数量
+static void benchCachedGrowth(const BenchConfig& cfg, int tasks, int sleepMs)
+{
+    BenchPool pool(PoolMode::MODE_CACHED, 1, cfg.threads);
+    std::mutex mtx;
+    std::set<std::thread::id> seen;
+    auto burst = [&](const char* name, const std::set<std::thread::id>& before)
+    {
+        Latch latch(tasks);
+        std::set<std::thread::id> used;
+        auto begin = Clock::now();
+        for (int i = 0; i < tasks; i++)
+        {
+            pool.post([&]()
+            {
+                {
+                    std::unique_lock<std::mutex> lock(mtx);
+                    used.insert(std::this_thread::get_id());
+                }
+                std::this_thread::sleep_for(std::chrono::milliseconds(sleepMs));
+                latch.countDown();
+            });
+        }
+        latch.wait();
+        double sec = secondsSince(begin);
+        pool.drain();
+        int fresh = 0;
+        for (auto& id : used)
+            fresh += before.count(id) == 0 ? 1 : 0;
+        BenchRecord r;
+        r.bench = name;
+        r.mode = "cached";
+        r.threads = cfg.threads;
+        r.producers = 1;
+        r.ops = tasks;
+        r.seconds = sec;
+        r.note = "threads_used=" + std::to_string(used.size()) + " new_threads=" + std::to_string(fresh)
+            + " ideal_sec=" + std::to_string((double)tasks * sleepMs / 1000 / cfg.threads);
+        report(cfg, r);
+        return used;
+    };
+    seen = burst("cached-grow", seen);
+    if (cfg.longRun)
+    {
+        std::this_thread::sleep_for(std::chrono::seconds(CACHED_IDLE_WAIT_SEC(cfg.threads)));
+        burst("cached-after-idle", seen);
+    }
+}
+
+// 计数的缓存行布局: 每个线程模拟执行perThread个空任务,每个任务对自己的计数做同样的原子读改写
+// (running置位和复位、执行计数加一)并读取运行标志
+// packed: 各线程的计数紧挨着存放,几个线程的计数落在同一个缓存行中
+// padded: 每个线程的计数按CACHE_LINE_SIZE对齐,各占一个缓存行
+// 两种布局执行的指令相同,差别只来自缓存行在核心之间的争用,单核机器上两者应当接近
+struct PackedCounter
+{
+    std::atomic<long> running{0};
+    std::atomic<long> executed{0};
+};
+struct alignas(CACHE_LINE_SIZE) PaddedCounter
+{
+    std::atomic<long> running{0};
+    std::atomic<long> executed{0};
+};
+template<typename Counter>
+static void benchCounterLayout(const BenchConfig& cfg, const char* modeName, long perThread)
+{
+    int threads = cfg.threads;
+    std::vector<Counter> counters(threads);
+    alignas(CACHE_LINE_SIZE) std::atomic<bool> isRuning{true};
+    std::atomic<int> ready{0};
+    std::atomic<bool> go{false};
+    auto body = [&](int id)
+    {
+        ready++;
+        while (!go.load(std::memory_order_acquire))
+            std::this_thread::yield();
+        Counter& c = counters[id];
+        for (long i = 0; i < perThread; i++)
+        {
+            c.running.fetch_add(1, std::memory_order_relaxed);
+            c.running.fetch_sub(1, std::memory_order_relaxed);
+            c.executed.fetch_add(1, std::memory_order_relaxed);
+            if (!isRuning.load(std::memory_order_relaxed))
+                break;
+        }
+    };
+    std::vector<std::thread> workers;
+    for (int i = 0; i < threads; i++)
+        workers.emplace_back(body, i);
+    while (ready < threads)
+        std::this_thread::yield();
+    auto begin = Clock::now();
+    go.store(true, std::memory_order_release);
+    for (auto& t : workers)
+        t.join();
+    long executed = 0;
+    for (auto& c : counters)
+        executed += c.executed.load();
+    BenchRecord r;
+    r.bench = "counter-layout";
+    r.mode = modeName;
+    r.threads = threads;
+    r.ops = perThread * threads;
+    r.seconds = secondsSince(begin);
+    r.note = "counters_per_line=" + std::to_string(CACHE_LINE_SIZE / sizeof(Counter)) + " executed=" + std::to_string(executed);
+    report(cfg, r);
+}
+
+static BenchConfig parseArgs(int argc, char** argv)
+{
+    BenchConfig cfg;
+    for (int i = 1; i < argc; i++)
+    {
+        const char* arg = argv[i];
+        if (strcmp(arg, "--format=csv") == 0)
+            cfg.format = OutputFormat::CSV;
+        else if (strcmp(arg, "--format=json") == 0)
+            cfg.format = OutputFormat::JSON;
+        else if (strcmp(arg, "--format=text") == 0)
+            cfg.format = OutputFormat::TEXT;
+        else if (strncmp(arg, "--threads=", 10) == 0)
+            cfg.threads = std::max(1, atoi(arg + 10));
+        else if (strncmp(arg, "--out=", 6) == 0)
+            cfg.out = arg + 6;
+        else if (strcmp(arg, "--quick") == 0)
+            cfg.quick = true;
+        else if (strcmp(arg, "--long") == 0)
+            cfg.longRun = true;
+        else
+        {
+            fprintf(stderr, "usage: %s [--format=text|csv|json] [--out=FILE] [--threads=N] [--quick] [--long]\n", argv[0]);
+            exit(1);
+        }
+    }
+    return cfg;
+}
+
+int main(int argc, char** argv)
+{
+    BenchConfig cfg = parseArgs(argc, argv);
+    fprintf(stderr, "variant: %s  threads: %d\n", BENCH_VARIANT, cfg.threads);
+
+#ifndef BENCH_LEGACY_POOL
+    // 先跑一遍让线程本地内存池缓存热起来
+    BenchConfig warm = cfg;
+    warm.format = OutputFormat::JSON;
+    benchTaskObjectAfter(warm, 1000);
+    g_records.clear();
+
+    benchTaskObjectBefore(cfg, cfg.scale(200000));
+    benchTaskObjectAfter(cfg, cfg.scale(200000));
+    benchSubmitBatch(cfg, false, (int)cfg.scale(500), 400);
+    benchSubmitBatch(cfg, true, (int)cfg.scale(500), 400);
+#endif
+    for (auto& m : g_modes)
+    {
+        benchEmptyTasks(cfg, m.first, m.second, cfg.scale(200000));
+#ifndef BENCH_LEGACY_POOL
+        benchFireAndForget(cfg, m.first, m.second, (int)cfg.scale(1000), 256);
+#endif
+        benchLatency(cfg, m.first, m.second, cfg.scale(20000), 1);
+        benchLatency(cfg, m.first, m.second, cfg.scale(50000), 100);
+        benchFanOutIn(cfg, m.first, m.second, (int)cfg.scale(1000), 256);
+        benchNested(cfg, m.first, m.second, (int)cfg.scale(200), 100);
+        for (int p = 1; p <= cfg.threads; p *= 2)
+            benchProducers(cfg, m.first, m.second, p, cfg.scale(200000) / p);
+    }
+    benchCachedGrowth(cfg, cfg.threads * 4, 20);
+    // 伪共享在线程数量多时才明显,至少用16个线程测试
+    BenchConfig wide = cfg;
+    wide.threads = std::max(16, cfg.threads);
+    benchCounterLayout<PackedCounter>(wide, "packed", cfg.scale(2000000));
+    benchCounterLayout<PaddedCounter>(wide, "padded", cfg.scale(2000000));
+    // 线程池整体: 同样用至少16个工作线程测空任务吞吐量,与调整布局之前的版本对比
+    for (auto& m : g_modes)
+        benchEmptyTasks(wide, m.first, m.second, cfg.scale(200000));
+
+    if (cfg.format == OutputFormat::TEXT)
+        return 0;
+    FILE* fp = cfg.out.empty() ? stdout : fopen(cfg.out.c_str(), "w");
+    if (fp == nullptr)
+    {
+        perror(cfg.out.c_str());
+        return 1;
+    }
+    if (cfg.format == OutputFormat::CSV)
+        printCsv(fp);
+    else
+        printJson(fp);
+    if (fp != stdout)
+        fclose(fp);
+    return 0;
+}
@@ -0,0 +1,1626 @@
+#include"threadpool_finall.h"
+#include<cstdio>
+#include<cstdlib>
+#include<ctime>
+#include<sstream>
+/*
+threadpool_finall.h 功能行为测试
+g++ -std=c++17 -O2 -pthread test_features.cpp -o test_features && ./test_features
+使用-std=c++20编译时还测试协程
+每个测试函数失败时打印所在行并以非0退出码结束
+*/
+#define CHECK(cond) \
+    do { if (!(cond)) { std::printf("FAILED %s:%d: %s\n", __FILE__, __LINE__, #cond); std::exit(1); } } while (0)
+
+// future得到broken_promise表示任务被丢弃
+template<typename T>
+static bool isBroken(std::future<T>& f)
+{
+    try
+    {
+        f.get();
+    }
+    catch (const std::future_error& e)
+    {
+        return e.code() == std::future_errc::broken_promise;
+    }
+    return false;
+}
+
+// 所有者线程push/pop的同时多个线程窃取: 每个元素恰好被取走一次,初始容量很小,过程中多次扩容
+static void testWorkStealingDeque()
+{
+    const long items = 200000;
+    const int thieves = 3;
+    WorkStealingDeque<long> dq(4);
+    std::vector<std::atomic_int> taken(items);
+    std::atomic_bool done{false};
+    std::atomic_long stolen{0};
+    std::vector<std::thread> threads;
+    for (int i = 0; i < thieves; i++)
+    {
+        threads.emplace_back([&]() {
+            long v;
+            while (!done || !dq.empty())
+            {
+                if (dq.steal(v))
+                {
+                    taken[v]++;
+                    stolen++;
+                }
+            }
+        });
+    }
+    long v;
+    for (long i = 0; i < items; i++)
+    {
+        dq.push(i);
+        // 每放入3个取出1个,队列长度持续增长,触发扩容
+        if (i % 3 == 2 && dq.pop(v))
+            taken[v]++;
+        // 单核机器上也让窃取线程有机会运行
+        if (i % 1024 == 0)
+            std::this_thread::yield();
+    }
+    while (dq.pop(v))
+        taken[v]++;
+    done = true;
+    for (auto& t : threads)
+        t.join();
+    for (long i = 0; i < items; i++)
+        CHECK(taken[i] == 1);
+    CHECK(stolen > 0);
+}
+
+// 工作窃取模式: 任务中递归提交的子任务进入本地队列并被其他线程窃取,每个任务恰好执行一次
+static void testWorkStealingPool()
+{
+    ThreadPool pool;
+    pool.setMode(PoolMode::MODE_WORK_STEALING);
+    pool.settaskQueMaxSize_(1024);
+    pool.start(4);
+    const int roots = 16;
+    const int children = 1000;
+    std::vector<std::atomic_int> ran(roots * children);
+    std::atomic_int finished{0};
+    for (int r = 0; r < roots; r++)
+    {
+        pool.submitTask([&, r]() {
+            for (int c = 0; c < children; c++)
+            {
+                pool.submitTask([&, r, c]() {
+                    ran[r * children + c]++;
+                    finished++;
+                });
+            }
+        });
+    }
+    while (finished < roots * children)
+        std::this_thread::yield();
+    for (auto& n : ran)
+        CHECK(n == 1);
+    pool.shutdown();
+}
+
+// 截止时间队列满时DISCARD_OLDEST丢弃截止时间最晚的任务,而不是最紧急的任务
+static void testDeadlineDiscardLatest()
+{
+    ThreadPool pool;
+    pool.settaskQueMaxSize_(4);
+    pool.setQueueFullPolicy(QueueFullPolicy::DISCARD_OLDEST);
+    pool.start(1);
+    std::promise<void> gate;
+    std::shared_future<void> opened = gate.get_future().share();
+    std::atomic_bool blocked{false};
+    std::future<void> blocker = pool.submitTask([opened, &blocked]() { blocked = true; opened.wait(); });
+    while (!blocked)
+        std::this_thread::yield();
+
+    auto now = std::chrono::steady_clock::now();
+    std::mutex mtx;
+    std::vector<int> order;
+    auto make = [&](int id) { return [&, id]() { std::lock_guard<std::mutex> lock(mtx); order.push_back(id); }; };
+    std::vector<std::future<void>> queued;
+    for (int i = 1; i <= 4; i++)
+        queued.push_back(pool.submitTask(now + std::chrono::seconds(10 * i), make(10 * i)));
+    // 队列已满: 截止时间更早的新任务替换截止时间最晚(40)的任务
+    std::future<void> urgent = pool.submitTask(now + std::chrono::seconds(5), make(5));
+    // 新任务的截止时间比队列中所有任务都晚,丢弃新任务本身
+    std::future<void> late = pool.submitTask(now + std::chrono::seconds(100), make(100));
+    gate.set_value();
+    blocker.get();
+
+    urgent.get();
+    for (int i = 0; i < 3; i++)
+        queued[i].get();
+    CHECK(isBroken(queued[3]));
+    CHECK(isBroken(late));
+    CHECK((order == std::vector<int>{ 5, 10, 20, 30 }));
+    CHECK(pool.stats().discarded == 2);
+}
+
+// 占住线程池唯一的工作线程,直到open()
+class Blocker
+{
+public:
+    explicit Blocker(ThreadPool& pool)
+    {
+        std::shared_future<void> opened = gate_.get_future().share();
+        std::atomic_bool* started = &started_;
+        done_ = pool.submitTask([opened, started]() { started->store(true); opened.wait(); });
+        while (!started_)
+            std::this_thread::yield();
+    }
+    void open()
+    {
+        gate_.set_value();
+        done_.get();
+    }
+private:
+    std::promise<void> gate_;
+    std::future<void> done_;
+    std::atomic_bool started_{false};
+};
+
+// 多个生产者和多个消费者并发使用MPMCQueue(包括批量放入): 每个元素恰好被取出一次
+static void testMPMCQueue()
+{
+    const long perProducer = 50000;
+    const int producers = 3;
+    const int consumers = 3;
+    MPMCQueue<long> que(64);
+    std::vector<std::atomic_int> taken(perProducer * producers);
+    std::atomic_long consumed{0};
+    std::vector<std::thread> threads;
+    for (int p = 0; p < producers; p++)
+    {
+        threads.emplace_back([&, p]() {
+            long next = p * perProducer;
+            long end = next + perProducer;
+            while (next < end)
+            {
+                if (p == 0)
+                {
+                    // 批量放入,可能只放入一部分
+                    long batch[8];
+                    size_t n = (size_t)std::min<long>(8, end - next);
+                    for (size_t i = 0; i < n; i++)
+                        batch[i] = next + (long)i;
+                    size_t pushed = que.tryPushBulk(batch, n);
+                    next += (long)pushed;
+                    if (pushed == 0)
+                        std::this_thread::yield();
+                }
+                else if (que.tryEmplace(next))
+                    next++;
+                else
+                    std::this_thread::yield();
+            }
+        });
+    }
+    for (int c = 0; c < consumers; c++)
+    {
+        threads.emplace_back([&]() {
+            long v;
+            while (consumed < perProducer * producers)
+            {
+                if (que.tryPop(v))
+                {
+                    taken[v]++;
+                    consumed++;
+                }
+                else
+                    std::this_thread::yield();
+            }
+        });
+    }
+    for (auto& t : threads)
+        t.join();
+    for (auto& n : taken)
+        CHECK(n == 1);
+    CHECK(que.empty());
+}
+
+// 队列满时的五种策略: 唯一的工作线程被占住,队列(容量4)放满后再提交一个任务
+static void testQueueFullPolicies()
+{
+    const int capacity = 4;
+    std::thread::id self = std::this_thread::get_id();
+    for (QueueFullPolicy policy : { QueueFullPolicy::BLOCK, QueueFullPolicy::BLOCK_TIMEOUT, QueueFullPolicy::REJECT,
+        QueueFullPolicy::CALLER_RUNS, QueueFullPolicy::DISCARD_OLDEST })
+    {
+        ThreadPool pool;
+        pool.settaskQueMaxSize_(capacity);
+        pool.setQueueFullPolicy(policy, std::chrono::milliseconds(50));
+        pool.start(1);
+        Blocker blocker(pool);
+        std::mutex mtx;
+        std::vector<int> order;
+        auto make = [&](int id) {
+            return [&, id]() {
+                std::lock_guard<std::mutex> lock(mtx);
+                order.push_back(id);
+                return std::this_thread::get_id();
+            };
+        };
+        std::vector<std::future<std::thread::id>> queued;
+        for (int i = 0; i < capacity; i++)
+            queued.push_back(pool.submitTask(make(i)));
+        if (policy == QueueFullPolicy::BLOCK)
+        {
+            // 提交一直等到有空位,工作线程放开之后才返回
+            std::atomic_bool returned{false};
+            std::future<std::thread::id> extra;
+            std::thread submitter([&]() { extra = pool.submitTask(make(capacity)); returned = true; });
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+            CHECK(!returned);
+            blocker.open();
+            submitter.join();
+            CHECK(extra.get() != self);
+            CHECK(pool.stats().rejected == 0);
+        }
+        else if (policy == QueueFullPolicy::BLOCK_TIMEOUT)
+        {
+            auto begin = std::chrono::steady_clock::now();
+            std::future<std::thread::id> extra = pool.submitTask(make(capacity));
+            CHECK(std::chrono::steady_clock::now() - begin >= std::chrono::milliseconds(50));
+            bool rejected = false;
+            try
+            {
+                extra.get();
+            }
+            catch (const TaskRejectedError&)
+            {
+                rejected = true;
+            }
+            CHECK(rejected);
+            CHECK(pool.stats().rejected == 1);
+            blocker.open();
+        }
+        else if (policy == QueueFullPolicy::REJECT)
+        {
+            bool rejected = false;
+            try
+            {
+                pool.submitTask(make(capacity)).get();
+            }
+            catch (const TaskRejectedError&)
+            {
+                rejected = true;
+            }
+            CHECK(rejected);
+            CHECK(!pool.trySubmitTask(make(capacity)).has_value());
+            blocker.open();
+        }
+        else if (policy == QueueFullPolicy::CALLER_RUNS)
+        {
+            // 在提交线程上立即执行
+            CHECK(pool.submitTask(make(capacity)).get() == self);
+            blocker.open();
+        }
+        else
+        {
+            // 丢弃最老的任务0
+            std::future<std::thread::id> extra = pool.submitTask(make(capacity));
+            blocker.open();
+            extra.get();
+            CHECK(isBroken(queued[0]));
+            queued.erase(queued.begin());
+            CHECK(pool.stats().discarded == 1);
+        }
+        for (auto& f : queued)
+            CHECK(f.get() != self);
+        pool.shutdown();
+        std::vector<int> expected;
+        if (policy == QueueFullPolicy::CALLER_RUNS)
+            expected = { 4, 0, 1, 2, 3 };
+        else if (policy == QueueFullPolicy::DISCARD_OLDEST)
+            expected = { 1, 2, 3, 4 };
+        else if (policy == QueueFullPolicy::BLOCK)
+            expected = { 0, 1, 2, 3, 4 };
+        else
+            expected = { 0, 1, 2, 3 };
+        CHECK(order == expected);
+    }
+}
+
+// 工作线程以外的线程等待TaskGroup/parallelFor时不执行线程池中无关的任务
+static void testExternalWaitDoesNotRunForeignTasks()
+{
+    ThreadPool pool;
+    pool.start(1);
+    std::thread::id self = std::this_thread::get_id();
+    {
+        TaskGroup group(pool);
+        std::promise<void> gate;
+        std::shared_future<void> opened = gate.get_future().share();
+        std::atomic_bool started{false};
+        group.spawn([&]() { started = true; opened.wait(); });
+        while (!started)
+            std::this_thread::yield();
+        std::future<std::thread::id> foreign = pool.submitTask([]() { return std::this_thread::get_id(); });
+        std::thread opener([&]() { std::this_thread::sleep_for(std::chrono::milliseconds(50)); gate.set_value(); });
+        group.wait();
+        opener.join();
+        CHECK(foreign.get() != self);
+    }
+    {
+        Blocker blocker(pool);
+        std::future<std::thread::id> foreign = pool.submitTask([]() { return std::this_thread::get_id(); });
+        std::thread opener([&]() { std::this_thread::sleep_for(std::chrono::milliseconds(50)); blocker.open(); });
+        std::atomic_int sum{0};
+        pool.parallelFor(0, 64, 1, [&](int i) { sum += i; });
+        opener.join();
+        CHECK(sum == 64 * 63 / 2);
+        CHECK(foreign.get() != self);
+    }
+    // 凭证被cancelAll移除后,睡眠中的wait被唤醒并自己执行组内的任务
+    {
+        TaskGroup group(pool);
+        std::atomic_bool started{false};
+        std::thread::id ranOn;
+        group.spawn([&]() {
+            started = true;
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+            group.spawn([&]() { ranOn = std::this_thread::get_id(); });
+            pool.cancelAll();
+        });
+        while (!started)
+            std::this_thread::yield();
+        group.wait();
+        CHECK(ranOn == self);
+    }
+}
+
+// 等待future并返回是否得到指定类型的异常
+template<typename E, typename F>
+static bool throws(F&& f)
+{
+    try
+    {
+        f.get();
+    }
+    catch (const E&)
+    {
+        return true;
+    }
+    return false;
+}
+
+// then链式传递结果,前驱或后续任务的异常传递到最后的future;whenAll/whenAny组合
+static void testPoolFutures()
+{
+    ThreadPool pool;
+    pool.settaskQueMaxSize_(64);
+    pool.start(2);
+    auto chain = pool.submitAsync([]() { return 20; })
+        .then([](int v) { return v + 1; })
+        .then([](int v) { return std::to_string(v * 2); });
+    CHECK(chain.get() == "42");
+
+    // 前驱失败时不调用后续任务
+    std::atomic_bool called{false};
+    auto failed = pool.submitAsync([]() -> int { throw std::runtime_error("first"); })
+        .then([&](int v) { called = true; return v; })
+        .then([&](int v) { called = true; return v; });
+    CHECK(throws<std::runtime_error>(failed));
+    CHECK(!called);
+    auto thrownInThen = pool.submitAsync([]() {}).then([]() -> int { throw std::logic_error("then"); });
+    CHECK(throws<std::logic_error>(thrownInThen));
+
+    std::vector<PoolFuture<int>> many;
+    for (int i = 0; i < 10; i++)
+        many.push_back(pool.submitAsync([i]() { return i; }));
+    std::vector<PoolFuture<int>> all = whenAll(std::move(many)).get();
+    int sum = 0;
+    for (auto& f : all)
+        sum += f.get();
+    CHECK(sum == 45);
+    auto pair = whenAll(pool.submitAsync([]() { return 1; }), pool.submitAsync([]() { return std::string("x"); })).get();
+    CHECK(std::get<0>(pair).get() == 1);
+    CHECK(std::get<1>(pair).get() == "x");
+
+    // 第一个就绪的future失败时whenAny同样就绪,下标指向它
+    std::promise<void> gate;
+    std::shared_future<void> opened = gate.get_future().share();
+    std::vector<PoolFuture<int>> race;
+    race.push_back(pool.submitAsync([opened]() { opened.wait(); return 1; }));
+    race.push_back(pool.submitAsync([]() -> int { throw std::runtime_error("fast"); }));
+    WhenAnyResult<std::vector<PoolFuture<int>>> any = whenAny(std::move(race)).get();
+    CHECK(any.index == 1);
+    CHECK(!any.futures[0].isReady());
+    CHECK(throws<std::runtime_error>(any.futures[1]));
+    gate.set_value();
+    CHECK(any.futures[0].get() == 1);
+}
+
+// TaskGraph: 每个节点在所有前驱完成之后执行;节点抛出异常时run的future得到该异常,后继不再执行
+static void testTaskGraph()
+{
+    ThreadPool pool;
+    pool.settaskQueMaxSize_(64);
+    pool.start(4);
+    const int count = 40;
+    std::atomic_int clock{0};
+    std::vector<int> finishedAt(count, -1);
+    std::vector<std::pair<int, int>> edges;
+    TaskGraph graph(pool);
+    std::vector<TaskGraph::Node> nodes;
+    for (int i = 0; i < count; i++)
+        nodes.push_back(graph.emplace([&, i]() { finishedAt[i] = clock++; }));
+    // 确定的伪随机无环图: 只从编号小的节点连向编号大的节点
+    unsigned seed = 12345;
+    for (int i = 0; i < count; i++)
+    {
+        for (int j = i + 1; j < count; j++)
+        {
+            seed = seed * 1103515245 + 12345;
+            if ((seed >> 16) % 8 == 0)
+            {
+                nodes[i].precede(nodes[j]);
+                edges.emplace_back(i, j);
+            }
+        }
+    }
+    for (int round = 0; round < 3; round++)
+    {
+        clock = 0;
+        graph.run().get();
+        for (int i = 0; i < count; i++)
+            CHECK(finishedAt[i] >= 0);
+        for (auto& e : edges)
+            CHECK(finishedAt[e.first] < finishedAt[e.second]);
+    }
+
+    TaskGraph failing(pool);
+    std::atomic_bool after{false};
+    TaskGraph::Node a = failing.emplace([]() {});
+    TaskGraph::Node b = failing.emplace([]() { throw std::runtime_error("node"); });
+    TaskGraph::Node c = failing.emplace([&]() { after = true; });
+    a.precede(b);
+    b.precede(c);
+    CHECK(throws<std::runtime_error>(failing.run()));
+    CHECK(!after);
+}
+
+// 可取消任务: 开始前通过句柄取消、排队超时、cancelAll与正在执行的工作线程竞争;
+// 每个future要么得到结果要么得到取消异常,stats().cancelled等于没有执行的任务数量
+static void testCancellation()
+{
+    {
+        ThreadPool pool;
+        pool.settaskQueMaxSize_(64);
+        pool.start(1);
+        Blocker blocker(pool);
+        std::atomic_bool ran{false};
+        auto task = pool.submitCancellable([&]() { ran = true; return 1; });
+        CHECK(task.handle.cancel());
+        CHECK(task.handle.cancelled());
+        // 开始执行前取消,future立即就绪
+        CHECK(task.future.wait_for(std::chrono::seconds(0)) == std::future_status::ready);
+        CHECK(throws<TaskCancelledError>(task.future));
+        CHECK(!task.handle.cancel());
+
+        auto timed = pool.submitWithTimeout(std::chrono::milliseconds(20), [&]() { ran = true; });
+        std::this_thread::sleep_for(std::chrono::milliseconds(40));
+        blocker.open();
+        CHECK(throws<TaskTimeoutError>(timed.future));
+        CHECK(!timed.handle.cancel());
+        // 排在后面的普通任务执行完时前两个已经出队
+        pool.submitTask([]() {}).get();
+        CHECK(!ran);
+        CHECK(pool.stats().cancelled == 2);
+    }
+    for (int round = 0; round < 5; round++)
+    {
+        ThreadPool pool;
+        pool.settaskQueMaxSize_(4096);
+        pool.start(4);
+        const int count = 2000;
+        std::vector<CancellableFuture<int>> tasks;
+        std::atomic_int stopped{0};
+        long handleCancelled = 0;
+        for (int i = 0; i < count; i++)
+        {
+            tasks.push_back(pool.submitCancellable([&, i](StopToken token) {
+                for (int k = 0; k < 100 && !token.stopRequested(); k++)
+                    cpuRelax();
+                if (token.stopRequested())
+                    stopped++;
+                return i;
+            }));
+            // 任务可能已经开始执行,此时cancel返回false
+            if (i % 7 == 0 && tasks.back().handle.cancel())
+                handleCancelled++;
+        }
+        std::thread canceller([&]() { pool.cancelAll(); });
+        canceller.join();
+        pool.shutdown();
+        long cancelled = 0;
+        for (int i = 0; i < count; i++)
+        {
+            try
+            {
+                CHECK(tasks[i].future.get() == i);
+                CHECK(!tasks[i].handle.cancelled());
+            }
+            catch (const TaskCancelledError&)
+            {
+                CHECK(tasks[i].handle.cancelled());
+                cancelled++;
+            }
+        }
+        CHECK(cancelled >= handleCancelled);
+        CHECK(pool.stats().cancelled == cancelled);
+    }
+}
+
+// N个线程都在睡眠时提交一个任务只定向唤醒一个线程,没有惊群,虚假唤醒有上界
+static void testParkingSingleWake()
+{
+    const int threads = 8;
+    const int rounds = 20;
+    ThreadPool pool;
+    pool.settaskQueMaxSize_(64);
+    pool.start(threads);
+    auto waitAllParked = [&]() {
+        while (pool.stats().parkedThreads != threads)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    };
+    waitAllParked();
+    ParkingStats before = pool.parkingStats();
+    for (int i = 0; i < rounds; i++)
+    {
+        CHECK(pool.submitTask([i]() { return i; }).get() == i);
+        waitAllParked();
+    }
+    ParkingStats after = pool.parkingStats();
+    CHECK(after.unparks - before.unparks == rounds);
+    // 被唤醒的线程执行完后重新睡眠,其他线程一直在睡眠
+    CHECK(after.parks - before.parks == rounds);
+    CHECK(after.spuriousWakeups - before.spuriousWakeups <= rounds / 10);
+}
+
+// Pipeline: 按顺序串行阶段按源阶段产生的顺序执行,同时在流水线中的数据不超过令牌数量;
+// 某个阶段抛出异常后源阶段停止产生数据,run的future得到该异常
+static void testPipeline()
+{
+    ThreadPool pool;
+    pool.settaskQueMaxSize_(64);
+    pool.start(4);
+    const int items = 2000;
+    const size_t tokens = 8;
+    {
+        Pipeline pipeline(pool, tokens);
+        int next = 0;
+        std::atomic_int inFlight{0};
+        std::atomic_int maxInFlight{0};
+        std::vector<int> out;
+        pipeline.source([&]() -> std::optional<int> {
+            if (next == items)
+                return std::nullopt;
+            int now = ++inFlight;
+            int seen = maxInFlight;
+            while (now > seen && !maxInFlight.compare_exchange_weak(seen, now))
+                ;
+            return next++;
+        })
+            .stage(StageMode::STAGE_PARALLEL, [](int v) {
+                // 不同的数据耗时不同,并行阶段的完成顺序被打乱
+                for (int k = 0; k < (v % 7) * 200; k++)
+                    cpuRelax();
+                return v;
+            })
+            .stage(StageMode::STAGE_SERIAL_IN_ORDER, [&](int v) {
+                out.push_back(v);
+                inFlight--;
+            });
+        pipeline.run().get();
+        CHECK(out.size() == (size_t)items);
+        for (int i = 0; i < items; i++)
+            CHECK(out[i] == i);
+        CHECK(maxInFlight <= (int)tokens);
+        CHECK(inFlight == 0);
+    }
+    {
+        Pipeline pipeline(pool, tokens);
+        std::atomic_int produced{0};
+        std::atomic_int reachedEnd{0};
+        pipeline.source([&]() -> std::optional<int> {
+            if (produced == 1000000)
+                return std::nullopt;
+            return produced++;
+        })
+            .stage(StageMode::STAGE_PARALLEL, [](int v) {
+                if (v == 10)
+                    throw std::runtime_error("stage");
+                return v;
+            })
+            .stage(StageMode::STAGE_SERIAL_OUT_OF_ORDER, [&](int) { reachedEnd++; });
+        CHECK(throws<std::runtime_error>(pipeline.run()));
+        // 异常之后源阶段最多再产生令牌数量级的数据
+        CHECK(produced < 10 + 4 * (int)tokens);
+        CHECK(reachedEnd < produced);
+    }
+}
+
+// parallelFor每个下标恰好执行一次,parallelReduce按区间顺序合并,parallelSort与std::sort结果相同;
+// 叶子任务抛出的异常在调用线程重新抛出,工作线程中嵌套调用同样成立
+static void testParallelAlgorithms()
+{
+    for (PoolMode mode : { PoolMode::MODE_FIXED, PoolMode::MODE_WORK_STEALING })
+    {
+        ThreadPool pool;
+        pool.setMode(mode);
+        pool.settaskQueMaxSize_(1024);
+        pool.start(4);
+        const int n = 100000;
+        std::vector<std::atomic_int> hits(n);
+        pool.parallelFor(0, n, [&](int i) { hits[i]++; });
+        for (int i = 0; i < n; i++)
+            CHECK(hits[i] == 1);
+        // 粒度为7,最后一块不满
+        std::vector<int> squares(1000, -1);
+        pool.parallelFor(0, 1000, 7, [&](int i) { squares[i] = i * i; });
+        for (int i = 0; i < 1000; i++)
+            CHECK(squares[i] == i * i);
+
+        long sum = pool.parallelReduce(0L, (long)n, 0L, 0L,
+            [](long b, long e, long acc) { for (long i = b; i < e; i++) acc += i; return acc; },
+            [](long x, long y) { return x + y; });
+        CHECK(sum == (long)n * (n - 1) / 2);
+        // 不满足交换律的合并: 拼接字符串,结果必须按区间顺序
+        std::string digits = pool.parallelReduce(0, 1000, 3, std::string(),
+            [](int b, int e, std::string acc) { for (int i = b; i < e; i++) acc += char('0' + i % 10); return acc; },
+            [](const std::string& x, const std::string& y) { return x + y; });
+        CHECK(digits.size() == 1000);
+        for (int i = 0; i < 1000; i++)
+            CHECK(digits[i] == char('0' + i % 10));
+
+        std::vector<int> data(200000);
+        unsigned seed = 12345;
+        for (int& v : data)
+        {
+            seed = seed * 1103515245u + 12345u;
+            v = (int)(seed >> 8) % 50000;
+        }
+        std::vector<int> expected = data;
+        std::sort(expected.begin(), expected.end());
+        std::vector<int> sorted = data;
+        pool.parallelSort(sorted.begin(), sorted.end());
+        CHECK(sorted == expected);
+        std::sort(expected.begin(), expected.end(), std::greater<int>());
+        pool.parallelSort(data.begin(), data.end(), std::greater<int>());
+        CHECK(data == expected);
+
+        // 叶子任务的异常
+        std::atomic_int ran{0};
+        bool caught = false;
+        try
+        {
+            pool.parallelFor(0, n, 100, [&](int i) {
+                ran++;
+                if (i == 777)
+                    throw std::runtime_error("leaf");
+            });
+        }
+        catch (const std::runtime_error&)
+        {
+            caught = true;
+        }
+        CHECK(caught);
+        CHECK(ran < n);
+        caught = false;
+        try
+        {
+            pool.parallelReduce(0, n, 100, 0, [](int b, int e, int acc) {
+                if (b <= 5000 && 5000 < e)
+                    throw std::logic_error("reduce");
+                return acc + (e - b);
+            }, [](int x, int y) { return x + y; });
+        }
+        catch (const std::logic_error&)
+        {
+            caught = true;
+        }
+        CHECK(caught);
+
+        // 在工作线程中嵌套调用
+        auto nested = pool.submitTask([&]() {
+            long inner = pool.parallelReduce(0L, 10000L, 0L, 0L,
+                [](long b, long e, long acc) { return acc + (e - b); },
+                [](long x, long y) { return x + y; });
+            bool innerCaught = false;
+            try
+            {
+                pool.parallelFor(0, 10000, [](int i) {
+                    if (i == 9999)
+                        throw std::runtime_error("nested");
+                });
+            }
+            catch (const std::runtime_error&)
+            {
+                innerCaught = true;
+            }
+            return inner == 10000 && innerCaught;
+        });
+        CHECK(nested.get());
+    }
+}
+
+// 等待cond成立,最多等待5秒
+template<typename Cond>
+static bool eventually(Cond cond)
+{
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (!cond())
+    {
+        if (std::chrono::steady_clock::now() > deadline)
+            return false;
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return true;
+}
+
+// stats(): 线程数量、忙碌线程、排队任务数量与实际情况一致,执行次数等于各线程计数之和
+static void testStats()
+{
+    ThreadPool pool;
+    pool.settaskQueMaxSize_(64);
+    pool.start(4);
+    PoolStats s = pool.stats();
+    CHECK(s.threads == 4);
+    CHECK(s.threadsCreated == 4);
+    CHECK(s.threadsDestroyed == 0);
+    CHECK(s.executed == 0);
+    // 每个槽位一项,包括为补偿线程预留的槽位
+    CHECK(s.workers.size() >= 4);
+
+    std::vector<std::unique_ptr<Blocker>> blockers;
+    for (int i = 0; i < 4; i++)
+        blockers.push_back(std::make_unique<Blocker>(pool));
+    std::atomic_int ran{0};
+    std::vector<std::future<void>> futures;
+    for (int i = 0; i < 10; i++)
+        futures.push_back(pool.submitTask([&]() { ran++; }));
+    s = pool.stats();
+    CHECK(s.idleThreads == 0);
+    CHECK(s.queuedTasks == 10);
+    CHECK(s.executed == 0);
+    for (auto& b : blockers)
+        b->open();
+    for (auto& f : futures)
+        f.get();
+    futures.clear();
+    // 执行计数在任务返回后才增加
+    CHECK(eventually([&]() { return pool.stats().executed == 14; }));
+
+    const int tasks = 2000;
+    for (int i = 0; i < tasks; i++)
+        futures.push_back(pool.submitTask([&]() { ran++; }));
+    for (auto& f : futures)
+        f.get();
+    CHECK(eventually([&]() { return pool.stats().executed == 14 + tasks; }));
+    CHECK(eventually([&]() { return pool.stats().idleThreads == 4; }));
+    s = pool.stats();
+    long perWorker = 0;
+    for (const WorkerStats& w : s.workers)
+    {
+        perWorker += w.executed;
+        CHECK(w.busySec >= 0 && w.idleSec >= 0);
+    }
+    CHECK(perWorker == s.executed);
+    CHECK(s.queuedTasks == 0);
+    CHECK(s.rejected == 0 && s.discarded == 0 && s.cancelled == 0);
+    // 按TASK_WAIT_SAMPLE采样
+    CHECK(s.execTime.count() > 0 && s.execTime.count() <= s.executed);
+    CHECK(s.waitTime.count() > 0 && s.waitTime.count() <= s.executed);
+    CHECK(ran == 10 + tasks);
+}
+
+// cached模式: 提交任务不创建线程,排队时由控制器增加线程(不超过上限),空闲后回收到初始线程数量
+static void testCachedController()
+{
+    {
+        // 控制器周期很长,提交后线程数量不变
+        ThreadPool pool;
+        pool.setMode(PoolMode::MODE_CACHED);
+        pool.settaskQueMaxSize_(64);
+        pool.setMaxThreadSisze_(8);
+        ElasticConfig config;
+        config.interval = std::chrono::milliseconds(10000);
+        pool.setElasticConfig(config);
+        pool.start(2);
+        std::vector<std::future<void>> futures;
+        for (int i = 0; i < 20; i++)
+            futures.push_back(pool.submitTask([]() { std::this_thread::sleep_for(std::chrono::milliseconds(1)); }));
+        CHECK(pool.stats().threads == 2);
+        for (auto& f : futures)
+            f.get();
+        CHECK(pool.stats().threadsCreated == 2);
+    }
+    ThreadPool pool;
+    pool.setMode(PoolMode::MODE_CACHED);
+    pool.settaskQueMaxSize_(64);
+    pool.setMaxThreadSisze_(6);
+    ElasticConfig config;
+    config.interval = std::chrono::milliseconds(5);
+    config.growWait = std::chrono::microseconds(1000);
+    config.growTicks = 1;
+    config.shrinkTicks = 4;
+    pool.setElasticConfig(config);
+    pool.start(2);
+    std::vector<std::future<void>> futures;
+    for (int i = 0; i < 60; i++)
+        futures.push_back(pool.submitTask([]() { std::this_thread::sleep_for(std::chrono::milliseconds(10)); }));
+    int maxThreads = 0;
+    for (auto& f : futures)
+    {
+        while (f.wait_for(std::chrono::milliseconds(1)) != std::future_status::ready)
+            maxThreads = std::max(maxThreads, pool.stats().threads);
+        f.get();
+    }
+    CHECK(maxThreads > 2);
+    CHECK(maxThreads <= 6);
+    CHECK(eventually([&]() { return pool.stats().threads == 2; }));
+    PoolStats s = pool.stats();
+    CHECK(s.threadsCreated > 2);
+    CHECK(s.threadsDestroyed == s.threadsCreated - 2);
+    // 继续空闲也不低于初始线程数量
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    CHECK(pool.stats().threads == 2);
+}
+
+// 当前线程允许运行的CPU
+static std::vector<int> threadCpus()
+{
+    std::vector<int> cpus;
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (pthread_getaffinity_np(pthread_self(), sizeof(set), &set) == 0)
+    {
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+        {
+            if (CPU_ISSET(cpu, &set))
+                cpus.push_back(cpu);
+        }
+    }
+#endif
+    return cpus;
+}
+
+// CPU列表解析;AFFINITY_CORE/AFFINITY_CUSTOM的工作线程绑定到进程允许的CPU;
+// 节点拓扑覆盖所有允许的CPU,NodeHint指定任何节点(包括不存在的节点)的任务都会执行
+static void testAffinity()
+{
+    CHECK(CpuTopology::parseCpuList("0-3,8,10-11") == std::vector<int>({ 0, 1, 2, 3, 8, 10, 11 }));
+    CHECK(CpuTopology::parseCpuList("5\n") == std::vector<int>({ 5 }));
+    CHECK(CpuTopology::parseCpuList("").empty());
+
+    std::vector<int> allowed = threadCpus();
+    std::vector<NumaNode> nodes = CpuTopology::detect();
+    CHECK(!nodes.empty());
+    size_t nodeCpus = 0;
+    for (const NumaNode& n : nodes)
+    {
+        nodeCpus += n.cpus.size();
+        for (int cpu : n.cpus)
+            CHECK(allowed.empty() || std::find(allowed.begin(), allowed.end(), cpu) != allowed.end());
+    }
+    CHECK(allowed.empty() || nodeCpus == allowed.size());
+
+    for (AffinityPolicy policy : { AffinityPolicy::AFFINITY_CORE, AffinityPolicy::AFFINITY_NODE, AffinityPolicy::AFFINITY_CUSTOM })
+    {
+        ThreadPool pool;
+        pool.settaskQueMaxSize_(64);
+        AffinityConfig config;
+        config.policy = policy;
+        if (!allowed.empty())
+            config.cpuSets = { { allowed.back() } };
+        pool.setAffinity(config);
+        pool.start(2);
+        CHECK(pool.nodeCount() == (int)nodes.size());
+        std::vector<std::future<std::vector<int>>> futures;
+        for (int i = 0; i < 20; i++)
+            futures.push_back(pool.submitTask(threadCpus));
+        for (auto& f : futures)
+        {
+            std::vector<int> cpus = f.get();
+            if (allowed.empty())
+                continue;
+            if (policy == AffinityPolicy::AFFINITY_CORE)
+                CHECK(cpus.size() == 1);
+            else if (policy == AffinityPolicy::AFFINITY_CUSTOM)
+                CHECK(cpus == std::vector<int>({ allowed.back() }));
+            for (int cpu : cpus)
+                CHECK(std::find(allowed.begin(), allowed.end(), cpu) != allowed.end());
+        }
+        std::vector<std::future<int>> hinted;
+        for (const NumaNode& n : nodes)
+            hinted.push_back(pool.submitTask(NodeHint{ n.id }, [](int v) { return v; }, n.id));
+        hinted.push_back(pool.submitTask(NodeHint{ 12345 }, [](int v) { return v; }, 12345));
+        for (size_t i = 0; i < nodes.size(); i++)
+            CHECK(hinted[i].get() == nodes[i].id);
+        CHECK(hinted.back().get() == 12345);
+    }
+}
+
+#ifdef THREADPOOL_COROUTINE
+// 切换到工作线程后返回a + b,仍在调用线程上执行时计数
+static CoTask<int> coAdd(ThreadPool& pool, std::thread::id caller, int a, int b, std::atomic_int& onCaller)
+{
+    co_await pool.schedule();
+    if (std::this_thread::get_id() == caller)
+        onCaller++;
+    co_return a + b;
+}
+
+static CoTask<int> coSum(ThreadPool& pool, std::thread::id caller, std::atomic_int& onCaller)
+{
+    int total = 0;
+    for (int i = 0; i < 100; i++)
+        total += co_await coAdd(pool, caller, i, 1, onCaller);
+    total += co_await pool.submitAsync([]() { return 1000; });
+    co_return total;
+}
+
+static CoTask<void> coThrow(ThreadPool& pool)
+{
+    co_await pool.schedule();
+    throw std::runtime_error("coroutine");
+}
+
+// 内层CoTask和PoolFuture的异常都在co_await处重新抛出
+static CoTask<int> coCatch(ThreadPool& pool)
+{
+    int caught = 0;
+    try
+    {
+        co_await coThrow(pool);
+    }
+    catch (const std::runtime_error&)
+    {
+        caught++;
+    }
+    try
+    {
+        co_await pool.submitAsync([]() -> int { throw std::logic_error("future"); });
+    }
+    catch (const std::logic_error&)
+    {
+        caught++;
+    }
+    co_return caught;
+}
+
+// co_await pool.schedule()在工作线程上恢复;CoTask返回值和异常传递给等待方;submitCoroutine的future得到结果或异常
+static void testCoroutines()
+{
+    ThreadPool pool;
+    pool.setMode(PoolMode::MODE_WORK_STEALING);
+    pool.settaskQueMaxSize_(1024);
+    pool.start(4);
+    std::atomic_int onCaller{0};
+    std::thread::id self = std::this_thread::get_id();
+    CHECK(pool.submitCoroutine(coSum(pool, self, onCaller)).get() == 5050 + 1000);
+    CHECK(onCaller == 0);
+    CHECK(pool.submitCoroutine(coCatch(pool)).get() == 2);
+    CHECK(throws<std::runtime_error>(pool.submitCoroutine(coThrow(pool))));
+    // 大量协程同时在线程池中切换
+    std::vector<PoolFuture<int>> futures;
+    for (int i = 0; i < 200; i++)
+        futures.push_back(pool.submitCoroutine(coAdd(pool, self, i, i, onCaller)));
+    for (int i = 0; i < 200; i++)
+        CHECK(futures[i].get() == 2 * i);
+    CHECK(onCaller == 0);
+}
+#endif
+
+// TaskArena按对齐要求顺序分配,rewind后复用同一块内存,超大的内存块在回退时还给堆;
+// 工作线程中currentArena()在任务结束后回退,嵌套执行的任务不会覆盖外层任务的分配
+static void testTaskArena()
+{
+    {
+        TaskArena arena(1024);
+        TaskArena::Mark start = arena.mark();
+        void* a = arena.allocate(10, 1);
+        void* b = arena.allocate(64, 64);
+        CHECK(reinterpret_cast<uintptr_t>(b) % 64 == 0);
+        CHECK(static_cast<char*>(b) >= static_cast<char*>(a) + 10);
+        CHECK(arena.usedSince(start));
+        arena.rewind(start);
+        CHECK(!arena.usedSince(start));
+        CHECK(arena.allocate(10, 1) == a);
+        size_t normal = arena.capacity();
+        CHECK(arena.allocate(1 << 16, 16) != nullptr);
+        CHECK(arena.capacity() > normal);
+        arena.rewind(start);
+        CHECK(arena.capacity() == normal);
+    }
+    CHECK(ThreadPool::currentArena() == std::pmr::get_default_resource());
+
+    ThreadPool pool;
+    pool.setMode(PoolMode::MODE_WORK_STEALING);
+    pool.settaskQueMaxSize_(1024);
+    pool.start(1);
+    // 只有一个工作线程,前后两个任务的第一次分配得到同一个地址
+    auto first = [](){ return ThreadPool::currentArena()->allocate(128, 16); };
+    void* p1 = pool.submitTask(first).get();
+    void* p2 = pool.submitTask(first).get();
+    CHECK(p1 == p2);
+    CHECK(pool.submitTask([]() { return ThreadPool::currentArena() != std::pmr::get_default_resource(); }).get());
+
+    auto nested = pool.submitTask([&pool]() {
+        std::pmr::vector<int> outer(ThreadPool::currentArena());
+        for (int i = 0; i < 1000; i++)
+            outer.push_back(i);
+        // 区间任务在本线程上嵌套执行,各自分配并在结束时回退
+        pool.parallelFor(0, 64, 1, [](int i) {
+            std::pmr::vector<int> inner(64, -i, ThreadPool::currentArena());
+            (void)inner;
+        });
+        std::pmr::vector<int> after(1000, -1, ThreadPool::currentArena());
+        bool ok = after.size() == 1000;
+        for (int i = 0; i < 1000; i++)
+            ok = ok && outer[i] == i;
+        return ok;
+    });
+    CHECK(nested.get());
+}
+
+// 唯一的工作线程在BlockingScope中等待另一个任务的结果: 线程池增加一个补偿线程执行该任务,
+// 离开阻塞区域后多出的线程退出;不在工作线程中使用BlockingScope什么也不做;submitBlocking由阻塞执行器执行
+static void testBlockingScope()
+{
+    ThreadPool pool;
+    pool.settaskQueMaxSize_(64);
+    pool.start(1);
+    {
+        BlockingScope outside;
+    }
+    CHECK(pool.stats().compensations == 0);
+
+    std::promise<int> gate;
+    std::shared_future<int> gated = gate.get_future().share();
+    std::atomic_bool entered{false};
+    auto blocked = pool.submitTask([&]() {
+        BlockingScope scope;
+        entered = true;
+        return gated.get();
+    });
+    while (!entered)
+        std::this_thread::yield();
+    auto opener = pool.submitTask([&]() {
+        int threads = pool.stats().threads;
+        gate.set_value(7);
+        return threads;
+    });
+    CHECK(blocked.wait_for(std::chrono::seconds(5)) == std::future_status::ready);
+    CHECK(blocked.get() == 7);
+    CHECK(opener.get() == 2);
+    CHECK(pool.stats().compensations >= 1);
+    CHECK(eventually([&]() { return pool.stats().threads == 1; }));
+    CHECK(pool.submitTask([]() { return 1; }).get() == 1);
+
+    // 阻塞执行器的任务同时执行,不占用计算线程
+    std::atomic_int sleeping{0};
+    std::atomic_int maxSleeping{0};
+    std::vector<std::future<void>> futures;
+    for (int i = 0; i < 3; i++)
+    {
+        futures.push_back(pool.submitBlocking([&]() {
+            int now = ++sleeping;
+            int seen = maxSleeping;
+            while (now > seen && !maxSleeping.compare_exchange_weak(seen, now))
+                ;
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+            sleeping--;
+        }));
+    }
+    CHECK(pool.submitTask([]() { return 2; }).get() == 2);
+    for (auto& f : futures)
+        f.get();
+    CHECK(maxSleeping > 1);
+    CHECK(eventually([&]() { return pool.stats().blockingExecuted == 3; }));
+    CHECK(pool.stats().blockingThreads >= 1);
+}
+
+// 字符串中子串出现的次数
+static int countOf(const std::string& text, const std::string& pattern)
+{
+    int n = 0;
+    for (size_t pos = text.find(pattern); pos != std::string::npos; pos = text.find(pattern, pos + 1))
+        n++;
+    return n;
+}
+
+// writeTrace: 每个线程只保留最近capacity个任务,标签按JSON转义,排队区间的开始和结束成对出现;
+// 没有开启跟踪时导出空的事件列表
+static void testTrace()
+{
+    {
+        ThreadPool pool;
+        pool.start(1);
+        pool.submitTask([]() {}).get();
+        std::ostringstream out;
+        pool.writeTrace(out);
+        CHECK(out.str() == "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n]}\n");
+    }
+    ThreadPool pool;
+    pool.settaskQueMaxSize_(256);
+    pool.enableTracing(16);
+    pool.start(2);
+    const int tasks = 100;
+    std::vector<std::future<void>> futures;
+    for (int i = 0; i < tasks; i++)
+    {
+        futures.push_back(pool.submitTask([i]() {
+            if (i % 2 == 0)
+                ThreadPool::traceTag("tagged \"task\"");
+        }));
+    }
+    for (auto& f : futures)
+        f.get();
+    // 记录在任务返回之后写入
+    CHECK(eventually([&]() { return pool.stats().executed == tasks; }));
+    std::ostringstream out;
+    pool.writeTrace(out);
+    std::string json = out.str();
+    const std::string head = "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+    CHECK(json.compare(0, head.size(), head) == 0);
+    CHECK(json.size() >= 4 && json.compare(json.size() - 4, 4, "\n]}\n") == 0);
+    int spans = countOf(json, "\"ph\":\"X\"");
+    CHECK(spans > 0 && spans <= 2 * 16);
+    CHECK(countOf(json, "\"ph\":\"b\"") == countOf(json, "\"ph\":\"e\""));
+    CHECK(countOf(json, "\"ph\":\"b\"") <= spans);
+    CHECK(countOf(json, "\"name\":\"tagged \\\"task\\\"\"") + countOf(json, "\"name\":\"task\"") == spans);
+    CHECK(countOf(json, "{") == countOf(json, "}"));
+    CHECK(countOf(json, "\"thread_name\"") >= 1);
+    CHECK(pool.writeTrace(std::string("/tmp/threadpool_test_trace.json")));
+    CHECK(!pool.writeTrace(std::string("/nonexistent-dir/trace.json")));
+    std::remove("/tmp/threadpool_test_trace.json");
+}
+
+// 多个非工作线程同时等待同一个TaskGroup(包括与析构并发)全部返回,异常只由其中一个重新抛出
+static void testTaskGroupMultipleWaiters()
+{
+    ThreadPool pool;
+    pool.settaskQueMaxSize_(64);
+    pool.start(2);
+    for (int round = 0; round < 20; round++)
+    {
+        bool fail = round % 2 == 1;
+        std::atomic_int ran{0};
+        std::atomic_int thrown{0};
+        {
+            TaskGroup group(pool);
+            for (int i = 0; i < 4; i++)
+            {
+                group.spawn([&, i]() {
+                    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+                    ran++;
+                    if (fail && i == 0)
+                        throw std::runtime_error("boom");
+                });
+            }
+            std::vector<std::thread> waiters;
+            for (int w = 0; w < 3; w++)
+            {
+                waiters.emplace_back([&]() {
+                    try
+                    {
+                        group.wait();
+                    }
+                    catch (const std::runtime_error&)
+                    {
+                        thrown++;
+                    }
+                });
+            }
+            for (auto& t : waiters)
+                t.join();
+            CHECK(thrown == (fail ? 1 : 0));
+            if (!fail)
+                CHECK(ran == 4);
+        }
+        // 析构中的wait与另一个线程的wait并发: 任务在gate打开前不结束,waiter一定在析构返回前进入wait
+        ran = 0;
+        std::promise<void> gate;
+        std::shared_future<void> opened = gate.get_future().share();
+        std::thread waiter;
+        std::thread opener;
+        {
+            TaskGroup group(pool);
+            for (int i = 0; i < 4; i++)
+                group.spawn([&, opened]() { opened.wait(); ran++; });
+            waiter = std::thread([&]() { group.wait(); CHECK(ran == 4); });
+            opener = std::thread([&]() { std::this_thread::sleep_for(std::chrono::milliseconds(5)); gate.set_value(); });
+        }
+        CHECK(ran == 4);
+        waiter.join();
+        opener.join();
+    }
+}
+
+// forEach的回调抛出异常时关闭通道,生产者不会在send中永远等待
+static void testChannelForEachErrorClosesChannel()
+{
+    ThreadPool pool;
+    pool.start(2);
+    std::atomic_int sent{0};
+    std::atomic_bool rejected{false};
+    Channel<int> ch = pool.submitStream<int>([&](Channel<int>& out) {
+        for (int i = 0; i < 100; i++)
+        {
+            if (!out.send(i))
+            {
+                rejected = true;
+                return;
+            }
+            sent++;
+        }
+    }, 4);
+    PoolFuture<void> done = ch.forEach([](int v) {
+        if (v == 2)
+            throw std::runtime_error("boom");
+    });
+    bool caught = false;
+    try
+    {
+        done.get();
+    }
+    catch (const std::runtime_error&)
+    {
+        caught = true;
+    }
+    CHECK(caught);
+    CHECK(ch.closed());
+    pool.shutdown();
+    CHECK(rejected);
+    CHECK(sent < 100);
+}
+
+// 工作线程中range-for消费通道: 生产者很慢时登记后睡眠而不是一直自旋,睡眠期间补偿的线程继续执行其他任务
+static void testChannelWorkerReceiveParks()
+{
+    ThreadPool pool;
+    pool.settaskQueMaxSize_(64);
+    pool.start(1);
+    Channel<int> ch(pool, 4);
+    std::future<double> consumer = pool.submitTask([&ch]() {
+        timespec begin;
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &begin);
+        int sum = 0;
+        for (int v : ch)
+            sum += v;
+        timespec end;
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &end);
+        CHECK(sum == 0 + 1 + 2 + 3 + 4);
+        return (end.tv_sec - begin.tv_sec) * 1e3 + (end.tv_nsec - begin.tv_nsec) / 1e6;
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    // 唯一的工作线程在等待数据,其他任务由补偿线程执行
+    CHECK(pool.submitTask([]() { return 7; }).get() == 7);
+    for (int i = 0; i < 5; i++)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        CHECK(ch.send(i));
+    }
+    ch.close();
+    // 等待约120ms,自旋时几乎全部是CPU时间
+    CHECK(consumer.get() < 30);
+
+    // 生产者任务移动时不拷贝通道,可以内联保存在任务对象中
+    auto producer = [](Channel<int>&) {};
+    static_assert(std::is_nothrow_move_constructible<StreamTask<int, decltype(producer)>>::value,
+        "StreamTask must be nothrow movable");
+}
+
+// trySend和send按同样的方式构造元素
+static void testChannelSendConstruction()
+{
+    Channel<std::vector<int>> ch(8);
+    CHECK(ch.trySend(3));
+    CHECK(ch.send(3));
+    CHECK(ch.tryReceive()->size() == 3);
+    CHECK(ch.tryReceive()->size() == 3);
+    Channel<double> numbers(2);
+    CHECK(numbers.trySend(1));
+    CHECK(*numbers.tryReceive() == 1.0);
+}
+
+// 同一个key的任务按提交顺序执行并且不重叠,不同key并行执行;任务队列很小时执行任务重新排队失败也不影响顺序
+static void testKeyedOrdering()
+{
+    for (PoolMode mode : { PoolMode::MODE_FIXED, PoolMode::MODE_WORK_STEALING })
+    {
+        for (int queueSize : { 1 << 14, 2 })
+        {
+            ThreadPool pool;
+            pool.setMode(mode);
+            pool.settaskQueMaxSize_(queueSize);
+            pool.setQueueFullPolicy(QueueFullPolicy::CALLER_RUNS);
+            pool.start(4);
+            const int keys = 16;
+            const int perKey = 2000;
+            std::vector<int> next(keys, 0);
+            std::vector<std::atomic_int> inside(keys);
+            std::atomic_long errors{0};
+            std::atomic_long done{0};
+            std::vector<std::thread> producers;
+            // 每个生产者负责一部分key,同一个key的提交顺序确定
+            for (int p = 0; p < 4; p++)
+            {
+                producers.emplace_back([&, p]() {
+                    for (int i = 0; i < perKey; i++)
+                    {
+                        for (int k = p; k < keys; k += 4)
+                        {
+                            pool.submitKeyed(k, [&, k, i]() {
+                                if (inside[k]++ != 0 || next[k] != i)
+                                    errors++;
+                                next[k] = i + 1;
+                                inside[k]--;
+                                done++;
+                            });
+                        }
+                    }
+                });
+            }
+            for (auto& t : producers)
+                t.join();
+            while (done < keys * perKey)
+                std::this_thread::yield();
+            CHECK(errors == 0);
+            for (int k = 0; k < keys; k++)
+                CHECK(next[k] == perKey);
+        }
+    }
+}
+
+// 多个线程提交到同一个strand: 任务不重叠,每个提交线程的任务按它的提交顺序执行
+static void testStrandOrdering()
+{
+    ThreadPool pool;
+    pool.start(4);
+    Strand strand = pool.strand();
+    const int producers = 4;
+    const int perProducer = 5000;
+    std::vector<int> last(producers, -1);
+    std::atomic_int inside{0};
+    std::atomic_long errors{0};
+    std::vector<std::vector<std::future<int>>> results(producers);
+    std::vector<std::thread> threads;
+    for (int p = 0; p < producers; p++)
+    {
+        threads.emplace_back([&, p]() {
+            for (int i = 0; i < perProducer; i++)
+            {
+                results[p].push_back(strand.submit([&, p, i]() {
+                    if (inside++ != 0 || last[p] != i - 1)
+                        errors++;
+                    last[p] = i;
+                    inside--;
+                    return i;
+                }));
+            }
+        });
+    }
+    for (auto& t : threads)
+        t.join();
+    for (int p = 0; p < producers; p++)
+    {
+        for (int i = 0; i < perProducer; i++)
+            CHECK(results[p][i].get() == i);
+    }
+    CHECK(errors == 0);
+    // 执行完的任务按批扣除,最后一批扣除之后才归零
+    while (strand.pending() != 0)
+        std::this_thread::yield();
+}
+
+// 执行完一批后任务队列已满,执行任务不能重新排队时在当前线程继续执行剩余的任务
+static void testStrandQueueFull()
+{
+    ThreadPool pool;
+    pool.settaskQueMaxSize_(2);
+    pool.setQueueFullPolicy(QueueFullPolicy::REJECT);
+    pool.start(1);
+    Blocker blocker(pool);
+    Strand strand = pool.strand();
+    std::vector<int> order;
+    std::vector<std::future<void>> foreign;
+    strand.submit([&]() {
+        // 占满任务队列
+        for (;;)
+        {
+            std::future<void> f = pool.submitTask([]() {});
+            if (f.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+                break;
+            foreign.push_back(std::move(f));
+        }
+        order.push_back(0);
+    });
+    std::future<void> last;
+    for (int i = 1; i < 3 * STRAND_BATCH; i++)
+        last = strand.submit([&order, i]() { order.push_back(i); });
+    blocker.open();
+    last.get();
+    for (auto& f : foreign)
+        f.get();
+    CHECK(order.size() == 3 * STRAND_BATCH);
+    for (int i = 0; i < 3 * STRAND_BATCH; i++)
+        CHECK(order[i] == i);
+}
+
+// 执行任务被cancelAll移除时strand中排队的任务被丢弃,之后提交的任务正常执行
+static void testStrandCancel()
+{
+    ThreadPool pool;
+    pool.start(1);
+    Blocker blocker(pool);
+    Strand strand = pool.strand();
+    std::future<int> dropped = strand.submit([]() { return 1; });
+    pool.cancelAll();
+    blocker.open();
+    CHECK(isBroken(dropped));
+    CHECK(strand.submit([]() { return 7; }).get() == 7);
+}
+
+// 定时任务不早于到期时间执行,按到期时间先后执行,可以在到期前取消,周期任务取消后不再触发
+static void testTimers()
+{
+    ThreadPool pool;
+    pool.start(2);
+    auto begin = std::chrono::steady_clock::now();
+    std::mutex mtx;
+    std::vector<int> order;
+    auto late = pool.submitAfter(std::chrono::milliseconds(100), [&]() {
+        std::lock_guard<std::mutex> lock(mtx);
+        order.push_back(100);
+        return std::chrono::steady_clock::now();
+    });
+    auto early = pool.submitAfter(std::chrono::milliseconds(20), [&]() {
+        std::lock_guard<std::mutex> lock(mtx);
+        order.push_back(20);
+    });
+    auto cancelled = pool.submitAfter(std::chrono::milliseconds(50), []() { return 1; });
+    CHECK(cancelled.handle.cancel());
+    std::atomic_int ticks{0};
+    CancelHandle every = pool.submitEvery(std::chrono::milliseconds(5), [&]() { ticks++; });
+
+    early.future.get();
+    CHECK(late.future.get() - begin >= std::chrono::milliseconds(100));
+    CHECK((order == std::vector<int>{ 20, 100 }));
+    bool caught = false;
+    try
+    {
+        cancelled.future.get();
+    }
+    catch (const TaskCancelledError&)
+    {
+        caught = true;
+    }
+    CHECK(caught);
+
+    while (ticks < 3)
+        std::this_thread::yield();
+    every.cancel();
+    // 取消时可能正有一次已经放入任务队列
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    int stopped = ticks;
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    CHECK(ticks == stopped);
+
+    // shutdown移除还没有到期的定时任务
+    auto pending = pool.submitAfter(std::chrono::seconds(60), []() {});
+    pool.shutdown();
+    caught = false;
+    try
+    {
+        pending.future.get();
+    }
+    catch (const TaskCancelledError&)
+    {
+        caught = true;
+    }
+    CHECK(caught);
+}
+
+// 三种关闭方式: DRAIN执行完排队的任务;CANCEL_PENDING和IMMEDIATE丢弃排队的任务并通过StopToken请求正在执行的任务停止,
+// 其中IMMEDIATE不等待线程退出
+static void testShutdownModes()
+{
+    const int queued = 10;
+    for (ShutdownMode mode : { ShutdownMode::DRAIN, ShutdownMode::CANCEL_PENDING, ShutdownMode::IMMEDIATE })
+    {
+        ThreadPool pool;
+        pool.settaskQueMaxSize_(64);
+        pool.start(1);
+        std::atomic_bool started{false};
+        auto running = pool.submitCancellable([&](StopToken token) {
+            started = true;
+            // DRAIN时运行100ms后结束,其他方式一直运行到请求停止,避免排队的任务在shutdown之前开始执行
+            auto until = std::chrono::steady_clock::now() + std::chrono::milliseconds(100);
+            while (!token.stopRequested() && (mode != ShutdownMode::DRAIN || std::chrono::steady_clock::now() < until))
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            return token.stopRequested();
+        });
+        while (!started)
+            std::this_thread::yield();
+        std::atomic_int ran{0};
+        std::vector<std::future<void>> futures;
+        for (int i = 0; i < queued; i++)
+            futures.push_back(pool.submitTask([&]() { ran++; }));
+
+        ShutdownResult result = pool.shutdown(mode);
+        CHECK(running.future.get() == (mode != ShutdownMode::DRAIN));
+        if (mode == ShutdownMode::DRAIN)
+        {
+            CHECK(ran == queued);
+            CHECK(result.discarded == 0);
+            CHECK(result.runningThreads == 0);
+            for (auto& f : futures)
+                f.get();
+        }
+        else
+        {
+            CHECK(ran == 0);
+            CHECK(result.discarded == queued);
+            for (auto& f : futures)
+                CHECK(isBroken(f));
+        }
+        if (mode == ShutdownMode::CANCEL_PENDING)
+            CHECK(result.runningThreads == 0);
+
+        // 关闭之后提交的任务被拒绝
+        bool rejected = false;
+        try
+        {
+            pool.submitTask([]() {}).get();
+        }
+        catch (const TaskRejectedError&)
+        {
+            rejected = true;
+        }
+        CHECK(rejected);
+    }
+}
+
+int main()
+{
+    testWorkStealingDeque();
+    testWorkStealingPool();
+    testMPMCQueue();
+    testQueueFullPolicies();
+    testPoolFutures();
+    testTaskGraph();
+    testCancellation();
+    testParkingSingleWake();
+    testPipeline();
+    testParallelAlgorithms();
+    testStats();
+    testCachedController();
+    testAffinity();
+    testTaskArena();
+    testBlockingScope();
+    testTrace();
+#ifdef THREADPOOL_COROUTINE
+    testCoroutines();
+#endif
+    testDeadlineDiscardLatest();
+    testExternalWaitDoesNotRunForeignTasks();
+    testTaskGroupMultipleWaiters();
+    testChannelForEachErrorClosesChannel();
+    testChannelWorkerReceiveParks();
+    testChannelSendConstruction();
+    testKeyedOrdering();
+    testStrandOrdering();
+    testStrandQueueFull();
+    testStrandCancel();
+    testTimers();
+    testShutdownModes();
+    std::printf("all tests passed\n");
+    return 0;
+}
@@ -0,0 +1,182 @@
+#include"threadpool.h"
+#include<chrono>
+#include<thread>
+#include<future>
+#include<string>
+#include<cstdio>
+#include<cstdlib>
+/*
+旧版threadpool.h中TypedTask/TypedResult的测试
+g++ -std=c++17 -O2 -pthread test_typed.cpp threadpool.cpp -o test_typed && ./test_typed
+失败时打印所在行并以非0退出码结束
+*/
+#define CHECK(cond) \
+    do { if (!(cond)) { std::printf("FAILED %s:%d: %s\n", __FILE__, __LINE__, #cond); std::exit(1); } } while (0)
+
+class SumTask : public TypedTask<long>
+{
+public:
+    SumTask(long begin, long end) : begin_(begin), end_(end) {}
+    long run() override
+    {
+        long sum = 0;
+        for (long i = begin_; i <= end_; i++)
+            sum += i;
+        return sum;
+    }
+private:
+    long begin_;
+    long end_;
+};
+
+class StringTask : public TypedTask<std::string>
+{
+public:
+    explicit StringTask(int n) : n_(n) {}
+    std::string run() override { return std::string(n_, 'x'); }
+private:
+    int n_;
+};
+
+class ThrowTask : public TypedTask<int>
+{
+public:
+    int run() override { throw std::logic_error("run failed"); }
+};
+
+//在gate打开之前不结束,结束时设置done
+class GateTask : public TypedTask<int>
+{
+public:
+    GateTask(std::shared_future<void> gate, std::atomic_bool* done) : gate_(gate), done_(done) {}
+    int run() override
+    {
+        gate_.wait();
+        done_->store(true);
+        return 7;
+    }
+private:
+    std::shared_future<void> gate_;
+    std::atomic_bool* done_;
+};
+
+//旧的Any接口,同样在gate打开之前不结束
+class GateAnyTask : public Task
+{
+public:
+    GateAnyTask(std::shared_future<void> gate, std::atomic_bool* done) : gate_(gate), done_(done) {}
+    Any run() override
+    {
+        gate_.wait();
+        done_->store(true);
+        return 1;
+    }
+private:
+    std::shared_future<void> gate_;
+    std::atomic_bool* done_;
+};
+
+//非void返回值,包括需要析构的类型
+static void testValues()
+{
+    ThreadPool pool;
+    pool.settaskQueMaxSize_(16);
+    pool.start(2);
+    TypedResult<long> r1 = pool.submitTask(std::make_shared<SumTask>(1, 100));
+    TypedResult<long> r2 = pool.submitTask(std::make_shared<SumTask>(101, 200));
+    TypedResult<std::string> r3 = pool.submitTask(std::make_shared<StringTask>(100));
+    CHECK(r1.valid() && r2.valid() && r3.valid());
+    CHECK(r1.get() + r2.get() == 20100);
+    CHECK(r3.get() == std::string(100, 'x'));
+}
+
+//run()抛出的异常由get()重新抛出
+static void testException()
+{
+    ThreadPool pool;
+    pool.settaskQueMaxSize_(16);
+    pool.start(1);
+    TypedResult<int> r = pool.submitTask(std::make_shared<ThrowTask>());
+    bool caught = false;
+    try
+    {
+        r.get();
+    }
+    catch (const std::logic_error&)
+    {
+        caught = true;
+    }
+    CHECK(caught);
+    //异常之后线程池继续工作
+    CHECK(pool.submitTask(std::make_shared<SumTask>(1, 10)).get() == 55);
+}
+
+//任务完成前丢弃或移动Result,任务完成时只访问自己的任务对象
+static void testResultOutlived()
+{
+    ThreadPool pool;
+    pool.settaskQueMaxSize_(16);
+    pool.start(2);
+    std::promise<void> gate;
+    std::shared_future<void> opened = gate.get_future().share();
+    std::atomic_bool typedDone{false};
+    std::atomic_bool anyDone{false};
+    std::atomic_bool movedDone{false};
+    //丢弃返回值,调用方也不再持有任务对象
+    pool.submitTask(std::make_shared<GateTask>(opened, &typedDone));
+    {
+        Result dropped = pool.submitTask(std::make_shared<GateAnyTask>(opened, &anyDone));
+    }
+    TypedResult<int> moved = pool.submitTask(std::make_shared<GateTask>(opened, &movedDone));
+    TypedResult<int> target = std::move(moved);
+    CHECK(!target.ready());
+    gate.set_value();
+    CHECK(target.get() == 7);
+    while (!typedDone || !anyDone)
+        std::this_thread::yield();
+    CHECK(movedDone);
+}
+
+//队列满时提交失败,get()抛出异常
+static void testQueueFull()
+{
+    ThreadPool pool;
+    pool.settaskQueMaxSize_(1);
+    pool.start(1);
+    std::promise<void> gate;
+    std::shared_future<void> opened = gate.get_future().share();
+    std::atomic_bool done{false};
+    std::atomic_bool queuedDone{false};
+    TypedResult<int> running = pool.submitTask(std::make_shared<GateTask>(opened, &done));
+    //等工作线程取走第一个任务,队列中只剩一个空位
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    TypedResult<int> queued = pool.submitTask(std::make_shared<GateTask>(opened, &queuedDone));
+    CHECK(queued.valid());
+    //队列已满,等待1秒后失败
+    TypedResult<long> rejected = pool.submitTask(std::make_shared<SumTask>(1, 10));
+    CHECK(!rejected.valid());
+    CHECK(!rejected.ready());
+    bool caught = false;
+    try
+    {
+        rejected.get();
+    }
+    catch (const std::runtime_error&)
+    {
+        caught = true;
+    }
+    CHECK(caught);
+    gate.set_value();
+    CHECK(running.get() == 7);
+    CHECK(queued.get() == 7);
+}
+
+int main()
+{
+    testValues();
+    testException();
+    testResultOutlived();
+    testQueueFull();
+    std::printf("all tests passed\n");
+    return 0;
+}
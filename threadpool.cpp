@@ -1,16 +1,19 @@
 #include "threadpool.h"
+#ifdef __linux__
+#include<unistd.h>
+#include<sys/syscall.h>
+#include<linux/futex.h>
+#endif
 #define TASK_MAX_SIZE 1024
 #define THREAD_MAX_SIZE 10
 #define THREAD_MAX_FREE_TIME 60 // 单位:秒
 ThreadPool::ThreadPool()
-    : initThreadSize_(0)
+    : PoolMode_(PoolMode::MODE_FIXED)
     , isRuning_(false)
+    , initThreadSize_(0)
     , maxThreadSisze_(THREAD_MAX_SIZE)
-    , taskSize_(0)
-    , curThreadSize_(0)
-    , freeThreadSize_(0)
     , taskQueMaxSize_(TASK_MAX_SIZE)
-    , PoolMode_(PoolMode::MODE_FIXED) 
+    , curThreadSize_(0)
     {};
 ThreadPool::~ThreadPool() 
 {
@@ -32,8 +35,6 @@ void ThreadPool::start(int8_t size)
 
     // 记录初始化线程个数
     initThreadSize_ = size;
-    // 空闲线程个数
-    freeThreadSize_ = size;
     // 创建线程
     for (int i = 0; i < initThreadSize_; i++)
     {
@@ -44,22 +45,27 @@ void ThreadPool::start(int8_t size)
         // unique_ptr 删除了拷贝构造函数 只保留了移动构造函数 因此需要使用move做资源转移
         threads_.emplace(thtreadId,std::move(ptr));
     }
-    // 启动线程
-    for (int i = 0; i < initThreadSize_; i++)
+    // 启动线程 线程id是全局递增的,不一定从0开始
+    for (auto& thread : threads_)
     {
-        threads_[i]->start();
+        thread.second->start();
         curThreadSize_++;
     }
 };
 // 设置任务队列任务上限值
-void ThreadPool::settaskQueMaxSize_(int8_t taskQueMaxSize_)
+void ThreadPool::settaskQueMaxSize_(int taskQueMaxSize)
 {
     if (poolState())
         return;
-    taskQueMaxSize_ = taskQueMaxSize_;
+    taskQueMaxSize_ = taskQueMaxSize;
 };
 // 给线程池提交任务
 Result ThreadPool::submitTask(std::shared_ptr<Task> sp)
+{
+    bool pushed = pushTask(sp);
+    return Result(std::move(sp), pushed);
+};
+bool ThreadPool::pushTask(std::shared_ptr<TaskBase> sp)
 {
     // 获取锁
     std::unique_lock<std::mutex> lock(taskQueMtx_);
@@ -72,29 +78,27 @@ Result ThreadPool::submitTask(std::shared_ptr<Task> sp)
     {
         // 表示notFull_等待1s仍然没有满足 tashQue_.size() < tashQueMaxSize_ 的条件
         std::cerr << "tash queue is full, submit tash fail." << std::endl;
-        return Result(std::move(sp), false);
+        return false;
     };
 
     // 放入任务
 
-    taskQue_.push(sp);
-    taskSize_++;
+    taskQue_.push(std::move(sp));
 
     // 因为新放了任务，所以任务队列肯定不满 ,因此可以通过notEmpty通知，进行分配执行任务
     notEmpty_.notify_all();
 
     // 如果线程池的模式为cache(该模式适用于解决任务数量多且快的状态) && 任务数量多余线程池的线程数量 && 线程池中线程数量未达到上限
-    if (PoolMode_ == PoolMode::MODE_CACHED && taskSize_ > curThreadSize_ && curThreadSize_ < maxThreadSisze_)
+    if (PoolMode_ == PoolMode::MODE_CACHED && taskQue_.size() > (size_t)curThreadSize_ && (size_t)curThreadSize_ < maxThreadSisze_)
     {
         // c++11 提供make_shared c++14 提供make_unique
         auto ptr = std::make_unique<Thread>(std::bind(&ThreadPool::threadFunc, this,std::placeholders::_1));
         UINT threadId= ptr->getThreadId();
         threads_.emplace(threadId,std::move(ptr));
-        ptr->start();
+        threads_[threadId]->start();
         curThreadSize_++;
-        freeThreadSize_++;
     }
-    return Result(sp);
+    return true;
 };
 void ThreadPool::threadFunc(int threadid)
 {
@@ -102,7 +106,7 @@ void ThreadPool::threadFunc(int threadid)
     for (;;)
     {
         // 先获取锁
-        std::shared_ptr<Task> task;
+        std::shared_ptr<TaskBase> task;
         {
             std::unique_lock<std::mutex> lock(taskQueMtx_);
 
@@ -116,7 +120,7 @@ void ThreadPool::threadFunc(int threadid)
                     recycle_.notify_all();
                     return ;
                 }
-                if (curThreadSize_ > initThreadSize_)
+                if ((size_t)curThreadSize_ > initThreadSize_)
                 {
                     
                         // 每一秒返回一次 如何区分是超时返回？还是有任务执行返回？
@@ -129,7 +133,6 @@ void ThreadPool::threadFunc(int threadid)
                         {
                             // 回收线程--记录线程数量相关的变量修改 && 把线程对象从线程列表中删除
                             curThreadSize_--;
-                            freeThreadSize_--;
                             threads_.erase(threadid);
                             return;
                         }
@@ -143,11 +146,9 @@ void ThreadPool::threadFunc(int threadid)
            }
            
 
-            freeThreadSize_--;
             // 从任务队列中取出一个任务出来
             task = taskQue_.front();
             taskQue_.pop();
-            taskSize_--;
 
             //  如果依然有剩余任务,继续通知其他线程执行任务
             if (taskQue_.size() > 0)
@@ -161,7 +162,6 @@ void ThreadPool::threadFunc(int threadid)
         // 当前线程负责执行任务
         if (task != nullptr)
             task->exec();
-        freeThreadSize_++;
 
         lastTime = std::chrono::high_resolution_clock().now();
     }
@@ -182,10 +182,53 @@ void ThreadPool::setMaxThreadSisze_(size_t count)
     }
 }
 /////////////////      Task        ////////////////////////////
-void Task::exec()
+void TaskBase::exec()
+{
+    try
+    {
+        execute();
+    }
+    catch (...)
+    {
+        error_ = std::current_exception();
+    }
+    done_.complete();
+}
+/////////////////   CompletionState   /////////////////////////
+#ifdef __linux__
+static void futexWait(std::atomic<uint32_t>* addr, uint32_t expected)
+{
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(addr), FUTEX_WAIT_PRIVATE, expected, nullptr, nullptr, 0);
+}
+static void futexWakeAll(std::atomic<uint32_t>* addr)
+{
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(addr), FUTEX_WAKE_PRIVATE, INT32_MAX, nullptr, nullptr, 0);
+}
+#else
+// 没有futex的平台上退化为让出CPU轮询
+static void futexWait(std::atomic<uint32_t>* addr, uint32_t expected)
+{
+    if (addr->load(std::memory_order_acquire) == expected)
+        std::this_thread::yield();
+}
+static void futexWakeAll(std::atomic<uint32_t>*) {}
+#endif
+void CompletionState::wait()
+{
+    uint32_t state = state_.load(std::memory_order_acquire);
+    while (state != READY)
+    {
+        // 先登记有等待者,完成方看到WAITING才会调用futex唤醒
+        if (state == PENDING && !state_.compare_exchange_weak(state, WAITING, std::memory_order_acquire))
+            continue;
+        futexWait(&state_, WAITING);
+        state = state_.load(std::memory_order_acquire);
+    }
+}
+void CompletionState::complete()
 {
-    if (result_)
-        result_->setAny(run());
+    if (state_.exchange(READY, std::memory_order_acq_rel) == WAITING)
+        futexWakeAll(&state_);
 }
 ///////////////////     Thread   ///////////////////////////////
 
@@ -197,7 +240,7 @@ void Thread::start()
     t.detach();
 };
 Thread::Thread(ThreadFunc func)
-        :func_(func_)
+        :func_(func)
         ,threadId_(generateId_++)
 {};
 UINT Thread::generateId_ = 0;
@@ -207,25 +250,17 @@ UINT Thread::getThreadId()
 }
 //////////////////////  Result  //////////////////////////////
 
-Result::Result(std::shared_ptr<Task> task, bool isVaild = true)
-    : task_(task), isVaild(isVaild)
-{
-    task_->setResult(this);
-};
+Result::Result(std::shared_ptr<Task> task, bool isVaild)
+    : task_(std::move(task)), isVaild(isVaild)
+{};
 Any Result::get()
 {
     if (!isVaild)
     {
         return "";
     }
-    sem_.wait();
-
-    return std::move(any_);
-};
-void Result::setAny(Any any)
-{
+    task_->wait();
+    task_->rethrow();
     // 获取task的返回值
-    this->any_ = std::move(any);
-
-    sem_.post();
+    return std::move(task_->any_);
 };
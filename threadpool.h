@@ -10,6 +10,11 @@
 #include<mutex>
 #include<condition_variable>
 #include<unordered_map>
+#include<cstdint>
+#include<exception>
+#include<stdexcept>
+#include<type_traits>
+#include<new>
 enum class PoolMode
 {
     MODE_FIXED,     // 线程数量固定
@@ -51,6 +56,7 @@ private:
     class Derive : public Base
     {
         public:
+        Derive(T data):data_(data){}
         T data_;
     };
     std::unique_ptr<Base> ptr;
@@ -92,35 +98,156 @@ private:
     std::condition_variable cond_;
     int resLimit_;
 };
-class Task;
+//任务的完成状态,只有一个原子状态字
+//任务完成时只有在有线程等待的情况下才需要唤醒,Linux下等待方直接在状态字上futex睡眠,不需要mutex和条件变量
+class CompletionState
+{
+public:
+    bool ready() const { return state_.load(std::memory_order_acquire) == READY; }
+    //等待任务完成
+    void wait();
+    //设置为完成并唤醒等待的线程
+    void complete();
+private:
+    enum : uint32_t
+    {
+        PENDING = 0,    // 未完成
+        WAITING = 1,    // 未完成且有线程在等待
+        READY = 2,      // 已完成
+    };
+    std::atomic<uint32_t> state_{PENDING};
+};
+
+//任务的公共基类,线程池只通过exec执行任务
+//完成状态和返回值都保存在任务对象中,Result通过shared_ptr共享任务对象,谁先析构都不会访问已经释放的内存
+class TaskBase
+{
+public:
+    virtual ~TaskBase() = default;
+    //执行任务,run()抛出的异常保存下来在get()中重新抛出
+    void exec();
+    bool ready() const { return done_.ready(); }
+    void wait() { done_.wait(); }
+protected:
+    //执行run()并保存返回值
+    virtual void execute() = 0;
+    void rethrow()
+    {
+        if (error_)
+            std::rethrow_exception(error_);
+    }
+private:
+    CompletionState done_;
+    std::exception_ptr error_;
+};
+
+//任务函数
+class Task : public TaskBase
+{
+public:
+    //用户可以自定义任务
+    virtual Any run()=0;
+private:
+    void execute() override { any_ = run(); }
+    Any any_;
+    friend class Result;
+};
+
 class Result
 {
 public:
     Result(std::shared_ptr<Task>task,bool isVaild = true);
     ~Result() = default;
-    //当子线程执行完task之后将task的返回结果设置到Result中!!!
-    void setAny(Any any);
+    Result(Result&&) = default;
+    Result& operator=(Result&&) = default;
+    //等待task执行完成,取出task的返回值
     Any get();
 private:
-    Semaphore sem_;
     std::shared_ptr<Task> task_;
-    Any any_;
-    std::atomic_bool isVaild;
+    bool isVaild;
 };
 
-//任务函数
-class Task
+//返回值的内联存储,返回值直接构造在任务对象中,不需要Any的堆分配和dynamic_cast
+template<typename T>
+class TypedValue
 {
 public:
-    Task()
-        :result_(nullptr)
+    TypedValue() = default;
+    TypedValue(const TypedValue&) = delete;
+    TypedValue& operator=(const TypedValue&) = delete;
+    ~TypedValue()
+    {
+        if (hasValue_)
+            ptr()->~T();
+    }
+    template<typename Func>
+    void emplace(Func&& func)
+    {
+        new (storage_) T(func());
+        hasValue_ = true;
+    }
+    T take() { return std::move(*ptr()); }
+private:
+    T* ptr() { return std::launder(reinterpret_cast<T*>(storage_)); }
+    alignas(T) unsigned char storage_[sizeof(T)];
+    bool hasValue_ = false;
+};
+template<>
+class TypedValue<void>
+{
+public:
+    template<typename Func>
+    void emplace(Func&& func) { func(); }
+    void take() {}
+};
+
+template<typename T>
+class TypedResult;
+
+//返回值类型确定的任务,用户继承后实现 T run()
+//class MyTask : public TypedTask<int> { int run() override { ... } };
+//每个任务对象只能提交一次
+template<typename T>
+class TypedTask : public TaskBase
+{
+public:
+    using result_type = T;
+    virtual T run() = 0;
+private:
+    void execute() override { value_.emplace([this]() { return run(); }); }
+    TypedValue<T> value_;
+    friend class TypedResult<T>;
+};
+
+//TypedTask的返回值,只保存任务对象的shared_ptr,可以移动,析构时不需要等待任务执行完成
+template<typename T>
+class TypedResult
+{
+public:
+    TypedResult(std::shared_ptr<TypedTask<T>> task, bool isVaild = true)
+        : task_(std::move(task))
+        , isVaild_(isVaild)
         {}
-    void exec();
-    //用户可以自定义任务
-    virtual Any run()=0;
-    void setResult(Result*r){result_ =r; }
+    //任务是否成功提交到线程池
+    bool valid() const { return isVaild_; }
+    bool ready() const { return isVaild_ && task_->ready(); }
+    void wait()
+    {
+        if (isVaild_)
+            task_->wait();
+    }
+    //等待任务执行完成并取出返回值,只能调用一次;提交失败时抛出std::runtime_error
+    T get()
+    {
+        if (!isVaild_)
+            throw std::runtime_error("task queue is full, submit task fail.");
+        task_->wait();
+        task_->rethrow();
+        return task_->value_.take();
+    }
 private:
-    Result * result_;
+    std::shared_ptr<TypedTask<T>> task_;
+    bool isVaild_;
 };
 class Thread
 {
@@ -151,31 +278,43 @@ public:
     //处理器核心数作为线程数量
     void start(int8_t size = std::thread::hardware_concurrency()); //开启线程池
     //设置任务队列任务上限值
-    void settaskQueMaxSize_(int8_t taskQueMaxSize_);
+    void settaskQueMaxSize_(int taskQueMaxSize);
     //给线程池提交任务
     Result submitTask(std::shared_ptr<Task> sp);
+    //提交返回值类型确定的任务,返回值保存在任务对象中,不需要Any
+    template<typename TaskT>
+    auto submitTask(std::shared_ptr<TaskT> sp)
+        -> typename std::enable_if<std::is_base_of<TypedTask<typename TaskT::result_type>, TaskT>::value,
+            TypedResult<typename TaskT::result_type>>::type
+    {
+        bool pushed = pushTask(sp);
+        return TypedResult<typename TaskT::result_type>(std::move(sp), pushed);
+    }
     void setMaxThreadSisze_(size_t count);
     
 private:
+    //放入任务队列,队列满等待超时返回false
+    bool pushTask(std::shared_ptr<TaskBase> sp);
     void threadFunc(int threadid);
     bool poolState();
-    //std::vector<std::unique_ptr<Thread>> threads_; 线程数组
-    std::unordered_map<UINT,std::unique_ptr<Thread>>threads_;
+    // 成员按访问方式分组,每组从新的缓存行开始,避免伪共享
+    // 启动后只读,每个线程循环时都要读取
+    alignas(64) PoolMode   PoolMode_;   //当前线程池的工作模式
+    std::atomic_bool isRuning_;
     size_t initThreadSize_; //初始的线程数量
     size_t maxThreadSisze_; //线程池线程数量上限
-    std::atomic_int curThreadSize_;//记录当前线程池中线程总数量
-    std::atomic_int freeThreadSize_;//记录空闲线程数量 
-    std::queue<std::shared_ptr<Task>> taskQue_; //任务队列
-    std::atomic_int8_t taskSize_;   // 任务的数量
-    int8_t taskQueMaxSize_; //任务队列最大上限
-    
-    std::mutex taskQueMtx_;
+    int taskQueMaxSize_; //任务队列最大上限
+
+    // 由taskQueMtx_保护,加锁时一起修改
+    // 不再保留每个任务都要修改的taskSize_/freeThreadSize_: 任务数量直接取taskQue_.size(),空闲线程数量没有使用
+    alignas(64) std::mutex taskQueMtx_;
+    std::queue<std::shared_ptr<TaskBase>> taskQue_; //任务队列
+    std::atomic_int curThreadSize_;//记录当前线程池中线程总数量 只在创建和回收线程时修改
+    //std::vector<std::unique_ptr<Thread>> threads_; 线程数组
+    std::unordered_map<UINT,std::unique_ptr<Thread>>threads_;
     std::condition_variable notFull_;   //表示任务队列不满
     std::condition_variable notEmpty_;  //表示任务队列不空  
     std::condition_variable recycle_;   //线程池析构回收子线程资源
-
-    PoolMode   PoolMode_;   //当前线程池的工作模式
-    std::atomic_bool isRuning_;
 };
 
 
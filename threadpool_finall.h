@@ -11,261 +11,6110 @@
 #include<condition_variable>
 #include<unordered_map>
 #include<future>
+#include<cstdint>
+#include<optional>
+#include<stdexcept>
+#include<tuple>
+#include<type_traits>
+#include<cstddef>
+#include<new>
+#include<algorithm>
+#include<iterator>
+#include<utility>
+#include<exception>
+#include<memory_resource>
+#include<deque>
+#include<fstream>
+#include<string>
+#include<cstdio>
+#ifdef __linux__
+#include<pthread.h>
+#include<sched.h>
+#endif
+// C++20编译时提供协程支持: co_await pool.schedule()、CoTask<T>以及co_await PoolFuture
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+#include<coroutine>
+#define THREADPOOL_COROUTINE
+#endif
 #define TASK_MAX_SIZE 2
 #define THREAD_MAX_SIZE 5
-#define THREAD_MAX_FREE_TIME 20 // 单位:秒
+#define WS_DEQUE_INIT_SIZE 256   // 工作窃取双端队列的初始容量(必须是2的幂)
+#define TASK_SUBMIT_TIMEOUT 1    // BLOCK_TIMEOUT策略默认的等待时间 单位:秒
+#define TASK_INLINE_SIZE 64      // 任务对象的内联存储大小,不超过该大小的闭包不需要堆分配
+#define POOL_ALLOC_MAX_SIZE 256  // 小对象内存池管理的最大内存块 单位:字节
+#define POOL_ALLOC_CACHE_COUNT 1024 // 每个线程每种规格最多缓存的空闲内存块数量
+#define POOL_ALLOC_BATCH_COUNT 64   // 线程缓存与全局仓库之间每次转移的内存块数量
+#define POOL_ALLOC_DEPOT_BATCHES 32 // 全局仓库每种规格最多保存的批数,超出的批还给全局堆
+#define IDLE_SPIN_MIN 64         // 空闲线程睡眠前自旋检查任务的最少次数
+#define IDLE_SPIN_MAX 4096       // 空闲线程睡眠前自旋检查任务的最多次数
+#define PARALLEL_CHUNKS_PER_THREAD 8    // 自动选择粒度时每个线程平均分到的块数
+#define PARALLEL_SORT_MIN_SIZE 8192     // 小于该长度的序列直接串行排序
+#define TASK_AGING_INTERVAL 16   // 每取这么多次任务从最低优先级开始取一次,防止低优先级任务饿死
+#define TASK_WAIT_SAMPLE 64      // 普通优先级每这么多个任务采样一次排队时间,工作线程每这么多个任务采样一次执行时间
+#define STATS_HIST_BUCKETS 32    // 时间直方图的桶数,第i个桶统计[2^i, 2^(i+1))纳秒
+#define CACHE_LINE_SIZE 64       // 缓存行大小,被不同线程写入的数据按缓存行对齐分开存放
+#define TASK_ARENA_BLOCK_SIZE 65536 // 工作线程arena每次向堆申请的内存块大小 单位:字节
+#define CACHED_CONTROL_INTERVAL 20  // cached模式线程数量控制器的采样周期 单位:毫秒
+#define CACHED_GROW_WAIT 2000       // 任务排队时间超过该值视为过载 单位:微秒
+#define CACHED_GROW_TICKS 2         // 连续过载这么多个周期才增加线程
+#define CACHED_GROW_STEP 2          // 每次最多增加的线程数量
+#define CACHED_SHRINK_UTIL 0.3      // 线程利用率低于该值且没有排队任务视为空闲
+#define CACHED_SHRINK_TICKS 50      // 连续空闲这么多个周期才回收一个线程
+#define THREAD_COMPENSATE_MAX 8     // 工作线程进入阻塞区域时最多同时存在的补偿线程数量
+#define BLOCKING_THREAD_MAX_SIZE 64 // 阻塞执行器的线程数量上限
+#define BLOCKING_THREAD_IDLE_TIME 10 // 阻塞执行器的线程空闲超过该时间后退出 单位:秒
+#define TIMER_TICK_US 100           // 定时器时间轮一个tick的长度,定时任务最多晚这么久放入任务队列 单位:微秒
+#define TIMER_WHEEL_LEVELS 6        // 时间轮的层数,每层64个槽,可以直接表示64^6个tick(100us时约79天)
+#define TRACE_BUFFER_SIZE 16384     // 开启跟踪时每个工作线程保留的最近任务记录数量
+#define CHANNEL_DEFAULT_SIZE 1024   // Channel的默认容量
+#define CHANNEL_DRAIN_BATCH 64      // forEach的消费任务每次最多处理这么多个数据,之后重新调度,不长期占用工作线程
+#define PIPELINE_MAX_TOKENS 16      // Pipeline默认同时在流水线中的数据数量上限
+#define STRAND_BATCH 64             // strand的执行任务每次最多连续执行这么多个任务,之后重新排队
+#define STRAND_KEYED_COUNT 1024     // submitKeyed使用的strand数量(必须是2的幂),key按哈希分配到其中一个
 enum class PoolMode
 {
-    MODE_FIXED,     // 线程数量固定
-    MODE_CACHED,    // 线程数量可以增长
+    MODE_FIXED,         // 线程数量固定
+    MODE_CACHED,        // 线程数量可以增长
+    MODE_WORK_STEALING, // 线程数量固定,每个线程拥有本地双端队列并相互窃取任务
+};
+
+// 任务队列满时submitTask的处理策略
+enum class QueueFullPolicy
+{
+    BLOCK,              // 一直阻塞,直到队列有空位
+    BLOCK_TIMEOUT,      // 阻塞等待一段时间,超时后拒绝
+    REJECT,             // 立即拒绝
+    CALLER_RUNS,        // 由提交任务的线程自己执行
+    DISCARD_OLDEST,     // 丢弃队列中最老的任务,再放入新任务
+};
+
+// 工作线程绑定CPU的方式
+enum class AffinityPolicy
+{
+    AFFINITY_NONE,      // 不绑定,由操作系统调度
+    AFFINITY_CORE,      // 每个线程绑定一个CPU核心,线程轮流分配到各NUMA节点
+    AFFINITY_NODE,      // 每个线程绑定到一个NUMA节点的全部核心,线程轮流分配到各NUMA节点
+    AFFINITY_CUSTOM,    // 第i个线程绑定到cpuSets[i % cpuSets.size()]
+};
+
+struct AffinityConfig
+{
+    AffinityPolicy policy = AffinityPolicy::AFFINITY_NONE;
+    std::vector<std::vector<int>> cpuSets;  // 只用于AFFINITY_CUSTOM
+};
+
+// 提交任务时指定希望执行任务的NUMA节点(节点编号与/sys/devices/system/node/nodeN一致)
+struct NodeHint
+{
+    int node;
+};
+
+// shutdown的方式
+enum class ShutdownMode
+{
+    DRAIN,              // 执行完所有排队的任务后退出
+    CANCEL_PENDING,     // 移除排队的任务(同cancelAll,正在执行的可取消任务也会通过StopToken得知),等待正在执行的任务结束
+    IMMEDIATE,          // 移除排队的任务,请求正在执行的可取消任务停止,不等待线程退出
+};
+
+// shutdown的结果
+struct ShutdownResult
+{
+    long completed;     // shutdown期间执行完的任务数量
+    long discarded;     // shutdown期间被移除或取消的任务数量
+    int runningThreads; // 返回时还没有退出的线程数量(等待超时或IMMEDIATE)
+};
+
+// 执行任务的线程组
+enum class Executor
+{
+    EXECUTOR_COMPUTE,   // 计算线程,数量为start()指定的线程数量
+    EXECUTOR_BLOCKING,  // 阻塞线程,执行I/O、sleep等会长时间阻塞的任务,按需创建,空闲一段时间后退出
+};
+
+// 流水线阶段的执行方式
+enum class StageMode
+{
+    STAGE_PARALLEL,             // 多个数据可以同时执行
+    STAGE_SERIAL_IN_ORDER,      // 同一时间只执行一个数据,按源阶段产生的顺序执行
+    STAGE_SERIAL_OUT_OF_ORDER,  // 同一时间只执行一个数据,按到达的顺序执行
+};
+
+// 任务优先级,每个优先级对应一条独立的任务队列
+enum class TaskPriority
+{
+    PRIORITY_HIGH,          // 延迟敏感的任务
+    PRIORITY_NORMAL,        // 默认优先级
+    PRIORITY_BACKGROUND,    // 后台批处理任务
+};
+
+// 任务被拒绝时,submitTask返回的future中保存的异常
+class TaskRejectedError : public std::runtime_error
+{
+public:
+    TaskRejectedError()
+        : std::runtime_error("task queue is full, submit task fail.")
+        {}
+};
+
+// 线程本地的小对象内存池
+// 按16字节划分规格,每个线程每种规格维护一个空闲链表,分配和释放都不需要加锁
+// 内存块经常由一个线程分配、另一个线程释放(提交线程分配promise状态,工作线程释放),
+// 因此线程缓存满时把POOL_ALLOC_BATCH_COUNT个块作为一批放入全局仓库,缓存为空时从仓库取一整批,
+// 仓库只在转移整批时短暂加锁,释放方缓存的内存块就能回到分配方
+// 线程退出时把缓存的内存块还给全局堆
+class SmallObjectPool
+{
+public:
+    static void* allocate(size_t size)
+    {
+        Cache& c = cache();
+        if (size > POOL_ALLOC_MAX_SIZE || c.destroyed)
+            return ::operator new(size);
+        size_t cls = sizeClass(size);
+        FreeList& list = c.lists[cls];
+        if (list.head == nullptr && !refill(list, cls))
+            return ::operator new(classSize(cls));
+        Block* b = list.head;
+        list.head = b->next;
+        list.count--;
+        return b;
+    }
+    static void deallocate(void* p, size_t size)
+    {
+        Cache& c = cache();
+        if (size > POOL_ALLOC_MAX_SIZE || c.destroyed)
+        {
+            ::operator delete(p);
+            return;
+        }
+        size_t cls = sizeClass(size);
+        FreeList& list = c.lists[cls];
+        if (list.count >= POOL_ALLOC_CACHE_COUNT)
+            flush(list, cls);
+        Block* b = static_cast<Block*>(p);
+        b->next = list.head;
+        list.head = b;
+        list.count++;
+    }
+private:
+    static constexpr size_t ALIGN = 16;
+    static constexpr size_t CLASS_COUNT = POOL_ALLOC_MAX_SIZE / ALIGN;
+    // batch只在批的第一个块中使用,把仓库中的批串起来
+    struct Block
+    {
+        Block* next;
+        Block* batch;
+    };
+    struct FreeList
+    {
+        Block* head;
+        size_t count;
+    };
+    // Cache是平凡类型,线程退出时不会被析构,由CacheGuard负责归还内存并打上标记
+    struct Cache
+    {
+        FreeList lists[CLASS_COUNT];
+        bool destroyed;
+    };
+    // 全局仓库,每个批是一条长度为POOL_ALLOC_BATCH_COUNT的链表
+    // 只由平凡类型组成,程序退出时不会被析构,其他线程退出时仍然可以访问
+    struct Depot
+    {
+        std::atomic_flag lock;
+        Block* batches;
+        size_t count;
+    };
+    struct CacheGuard
+    {
+        ~CacheGuard()
+        {
+            Cache& c = rawCache();
+            for (FreeList& list : c.lists)
+            {
+                freeChain(list.head);
+                list.head = nullptr;
+                list.count = 0;
+            }
+            c.destroyed = true;
+        }
+    };
+    static size_t sizeClass(size_t size) { return size == 0 ? 0 : (size - 1) / ALIGN; }
+    static size_t classSize(size_t cls) { return (cls + 1) * ALIGN; }
+    static void freeChain(Block* b)
+    {
+        while (b != nullptr)
+            ::operator delete(std::exchange(b, b->next));
+    }
+    static void lockDepot(Depot& d)
+    {
+        while (d.lock.test_and_set(std::memory_order_acquire))
+            std::this_thread::yield();
+    }
+    // 从仓库取一批放入空的线程缓存
+    static bool refill(FreeList& list, size_t cls)
+    {
+        Depot& d = depot(cls);
+        lockDepot(d);
+        Block* batch = d.batches;
+        if (batch != nullptr)
+        {
+            d.batches = batch->batch;
+            d.count--;
+        }
+        d.lock.clear(std::memory_order_release);
+        if (batch == nullptr)
+            return false;
+        list.head = batch;
+        list.count = POOL_ALLOC_BATCH_COUNT;
+        return true;
+    }
+    // 把线程缓存头部的一批放入仓库,仓库已满时还给全局堆
+    static void flush(FreeList& list, size_t cls)
+    {
+        Block* batch = list.head;
+        Block* last = batch;
+        for (size_t i = 1; i < POOL_ALLOC_BATCH_COUNT; i++)
+            last = last->next;
+        list.head = last->next;
+        list.count -= POOL_ALLOC_BATCH_COUNT;
+        last->next = nullptr;
+        Depot& d = depot(cls);
+        lockDepot(d);
+        bool full = d.count >= POOL_ALLOC_DEPOT_BATCHES;
+        if (!full)
+        {
+            batch->batch = d.batches;
+            d.batches = batch;
+            d.count++;
+        }
+        d.lock.clear(std::memory_order_release);
+        if (full)
+            freeChain(batch);
+    }
+    static Depot& depot(size_t cls)
+    {
+        static Depot depots[CLASS_COUNT];
+        return depots[cls];
+    }
+    static Cache& rawCache()
+    {
+        static thread_local Cache c;
+        return c;
+    }
+    static Cache& cache()
+    {
+        static thread_local CacheGuard guard;
+        (void)guard;
+        return rawCache();
+    }
+};
+
+// 从SmallObjectPool分配内存的分配器,用于任务节点、promise共享状态等线程池内部对象
+template<typename T>
+class PoolAllocator
+{
+public:
+    using value_type = T;
+    PoolAllocator() noexcept = default;
+    template<typename U>
+    PoolAllocator(const PoolAllocator<U>&) noexcept {}
+    T* allocate(size_t n) { return static_cast<T*>(SmallObjectPool::allocate(n * sizeof(T))); }
+    void deallocate(T* p, size_t n) noexcept { SmallObjectPool::deallocate(p, n * sizeof(T)); }
+    template<typename U>
+    bool operator==(const PoolAllocator<U>&) const noexcept { return true; }
+    template<typename U>
+    bool operator!=(const PoolAllocator<U>&) const noexcept { return false; }
+};
+
+// 工作线程私有的arena分配器,按顺序在内存块中分配,释放为空操作
+// 每个任务结束后回退到任务开始时的位置,内存块保留给之后的任务复用,任务嵌套执行(helpWhile)时只回退内层任务的分配
+// 分配的内存只在当前任务返回之前有效,不能交给其他任务,也不能跨co_await保存
+class TaskArena : public std::pmr::memory_resource
+{
+public:
+    // 回退位置: 内存块下标和块内偏移
+    struct Mark
+    {
+        size_t block;
+        size_t offset;
+    };
+    explicit TaskArena(size_t blockSize = TASK_ARENA_BLOCK_SIZE)
+        : blockSize_(blockSize)
+        , cur_(0)
+        , offset_(0)
+        {}
+    TaskArena(const TaskArena&) = delete;
+    TaskArena& operator=(const TaskArena&) = delete;
+    ~TaskArena() override { release(); }
+
+    Mark mark() const { return Mark{ cur_, offset_ }; }
+    // 回退到m,m之后的普通内存块保留复用,超大的内存块还给堆
+    void rewind(Mark m)
+    {
+        for (size_t i = blocks_.size(); i > m.block + 1; i--)
+        {
+            if (blocks_[i - 1].size > blockSize_)
+            {
+                ::operator delete(blocks_[i - 1].data);
+                blocks_.erase(blocks_.begin() + (i - 1));
+            }
+        }
+        cur_ = m.block;
+        offset_ = m.offset;
+    }
+    // 有没有在m之后分配过内存
+    bool usedSince(Mark m) const { return cur_ != m.block || offset_ != m.offset; }
+    // 把所有内存块还给堆
+    void release()
+    {
+        for (Block& b : blocks_)
+            ::operator delete(b.data);
+        blocks_.clear();
+        cur_ = 0;
+        offset_ = 0;
+    }
+    // 已经向堆申请的内存大小
+    size_t capacity() const
+    {
+        size_t n = 0;
+        for (const Block& b : blocks_)
+            n += b.size;
+        return n;
+    }
+protected:
+    void* do_allocate(size_t bytes, size_t align) override
+    {
+        for (;;)
+        {
+            if (cur_ < blocks_.size())
+            {
+                Block& b = blocks_[cur_];
+                uintptr_t base = reinterpret_cast<uintptr_t>(b.data);
+                uintptr_t p = (base + offset_ + align - 1) & ~(uintptr_t)(align - 1);
+                if (p + bytes <= base + b.size)
+                {
+                    offset_ = p + bytes - base;
+                    return reinterpret_cast<void*>(p);
+                }
+                // 当前块放不下,换下一个块
+                cur_++;
+                offset_ = 0;
+                continue;
+            }
+            // 保留的内存块都用完了,向堆申请新块
+            size_t size = std::max(blockSize_, bytes + align);
+            blocks_.push_back(Block{ static_cast<char*>(::operator new(size)), size });
+        }
+    }
+    void do_deallocate(void*, size_t, size_t) override {}
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override { return this == &other; }
+private:
+    struct Block
+    {
+        char* data;
+        size_t size;
+    };
+    size_t blockSize_;
+    std::vector<Block> blocks_;
+    size_t cur_;        // 正在分配的内存块下标,等于blocks_.size()表示需要新块
+    size_t offset_;     // 当前块内已经分配的字节数
+};
+
+// 只能移动的函数对象,小闭包直接存放在内联缓冲区中
+// 和std::function相比不要求闭包可拷贝,因此可以捕获promise等只能移动的对象
+template<typename Signature>
+class UniqueFunction;
+
+template<typename R, typename... Args>
+class UniqueFunction<R(Args...)>
+{
+public:
+    UniqueFunction() noexcept : ops_(nullptr) {}
+    UniqueFunction(std::nullptr_t) noexcept : ops_(nullptr) {}
+    template<typename F, typename = std::enable_if_t<!std::is_same<std::decay_t<F>, UniqueFunction>::value>>
+    UniqueFunction(F&& f)
+        : ops_(nullptr)
+    {
+        using Fn = std::decay_t<F>;
+        if constexpr (isInline<Fn>())
+        {
+            new (storage_) Fn(std::forward<F>(f));
+            ops_ = &InlineOps<Fn>::ops;
+        }
+        else
+        {
+            // 闭包太大,放到内存池中,内联缓冲区只保存指针
+            Fn* p = PoolAllocator<Fn>().allocate(1);
+            try
+            {
+                new (p) Fn(std::forward<F>(f));
+            }
+            catch (...)
+            {
+                PoolAllocator<Fn>().deallocate(p, 1);
+                throw;
+            }
+            *reinterpret_cast<Fn**>(storage_) = p;
+            ops_ = &HeapOps<Fn>::ops;
+        }
+    }
+    UniqueFunction(UniqueFunction&& other) noexcept
+        : ops_(other.ops_)
+    {
+        if (ops_ != nullptr)
+        {
+            ops_->move(storage_, other.storage_);
+            other.ops_ = nullptr;
+        }
+    }
+    UniqueFunction& operator=(UniqueFunction&& other) noexcept
+    {
+        if (this != &other)
+        {
+            reset();
+            if (other.ops_ != nullptr)
+            {
+                ops_ = other.ops_;
+                ops_->move(storage_, other.storage_);
+                other.ops_ = nullptr;
+            }
+        }
+        return *this;
+    }
+    UniqueFunction& operator=(std::nullptr_t) noexcept
+    {
+        reset();
+        return *this;
+    }
+    UniqueFunction(const UniqueFunction&) = delete;
+    UniqueFunction& operator=(const UniqueFunction&) = delete;
+    ~UniqueFunction() { reset(); }
+
+    R operator()(Args... args) { return ops_->invoke(storage_, std::forward<Args>(args)...); }
+    explicit operator bool() const noexcept { return ops_ != nullptr; }
+    // 和std::function::target一样: 保存的是Fn类型的闭包时返回它的指针,否则返回nullptr
+    template<typename Fn>
+    Fn* target() noexcept
+    {
+        if constexpr (isInline<Fn>())
+            return ops_ == &InlineOps<Fn>::ops ? reinterpret_cast<Fn*>(storage_) : nullptr;
+        else
+            return ops_ == &HeapOps<Fn>::ops ? HeapOps<Fn>::get(storage_) : nullptr;
+    }
+    bool operator==(std::nullptr_t) const noexcept { return ops_ == nullptr; }
+    bool operator!=(std::nullptr_t) const noexcept { return ops_ != nullptr; }
+private:
+    struct Ops
+    {
+        R (*invoke)(void*, Args&&...);
+        void (*move)(void* dst, void* src) noexcept;
+        void (*destroy)(void*) noexcept;
+    };
+    template<typename Fn>
+    static constexpr bool isInline()
+    {
+        return sizeof(Fn) <= TASK_INLINE_SIZE
+            && alignof(Fn) <= alignof(std::max_align_t)
+            && std::is_nothrow_move_constructible<Fn>::value;
+    }
+    template<typename Fn>
+    struct InlineOps
+    {
+        static R invoke(void* s, Args&&... args) { return (*static_cast<Fn*>(s))(std::forward<Args>(args)...); }
+        static void move(void* dst, void* src) noexcept
+        {
+            new (dst) Fn(std::move(*static_cast<Fn*>(src)));
+            static_cast<Fn*>(src)->~Fn();
+        }
+        static void destroy(void* s) noexcept { static_cast<Fn*>(s)->~Fn(); }
+        static constexpr Ops ops{ &invoke, &move, &destroy };
+    };
+    template<typename Fn>
+    struct HeapOps
+    {
+        static Fn* get(void* s) { return *static_cast<Fn**>(s); }
+        static R invoke(void* s, Args&&... args) { return (*get(s))(std::forward<Args>(args)...); }
+        static void move(void* dst, void* src) noexcept { *static_cast<Fn**>(dst) = get(src); }
+        static void destroy(void* s) noexcept
+        {
+            Fn* p = get(s);
+            p->~Fn();
+            PoolAllocator<Fn>().deallocate(p, 1);
+        }
+        static constexpr Ops ops{ &invoke, &move, &destroy };
+    };
+    void reset() noexcept
+    {
+        if (ops_ != nullptr)
+        {
+            ops_->destroy(storage_);
+            ops_ = nullptr;
+        }
+    }
+    alignas(std::max_align_t) unsigned char storage_[TASK_INLINE_SIZE];
+    const Ops* ops_;
+};
+
+// 自旋等待时降低CPU占用
+inline void cpuRelax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#else
+    std::this_thread::yield();
+#endif
+}
+
+// 每个工作线程独占的二值信号量,用于线程的睡眠和定向唤醒
+// unpark先于park发生时许可会被保留,下一次park立即返回
+class Parker
+{
+public:
+    Parker() : permit_(false) {}
+    void park()
+    {
+        std::unique_lock<std::mutex> lock(mtx_);
+        cond_.wait(lock, [&]() -> bool { return permit_; });
+        permit_ = false;
+    }
+    void unpark()
+    {
+        {
+            std::unique_lock<std::mutex> lock(mtx_);
+            permit_ = true;
+        }
+        cond_.notify_one();
+    }
+private:
+    std::mutex mtx_;
+    std::condition_variable cond_;
+    bool permit_;
+};
+
+// 等待一批任务结束的计数: 工作线程等待时帮线程池执行任务,其他线程用wait()睡眠,计数归零时被唤醒
+// 计数只在锁内归零并唤醒全部等待方,done()返回true之前加锁一次确认归零的一方已经离开,调用方随后可以立即销毁计数
+// 可以有多个线程同时等待
+class WaitCount
+{
+public:
+    void add(long n) { count_.fetch_add(n, std::memory_order_relaxed); }
+    void store(long n) { count_.store(n, std::memory_order_relaxed); }
+    void countDown()
+    {
+        long c = count_.load(std::memory_order_relaxed);
+        while (c != 1)
+        {
+            if (count_.compare_exchange_weak(c, c - 1, std::memory_order_acq_rel, std::memory_order_relaxed))
+                return;
+        }
+        // 可能是最后一个,在锁内减一;期间有新的add时由之后结束的一方归零
+        std::unique_lock<std::mutex> lock(mtx_);
+        if (count_.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            cond_.notify_all();
+    }
+    // 计数是否已经归零
+    bool done()
+    {
+        if (count_.load(std::memory_order_acquire) != 0)
+            return false;
+        std::unique_lock<std::mutex> lock(mtx_);
+        return true;
+    }
+    // 唤醒所有正在wait()的线程,让它们重新检查条件
+    void wake()
+    {
+        std::unique_lock<std::mutex> lock(mtx_);
+        generation_.fetch_add(1, std::memory_order_seq_cst);
+        cond_.notify_all();
+    }
+    // 在检查条件之前取得,传给wait(): 检查之后发生的wake()不会被错过
+    unsigned long generation() const { return generation_.load(std::memory_order_seq_cst); }
+    // 睡眠直到计数归零,或者取得gen之后有wake()
+    void wait(unsigned long gen)
+    {
+        std::unique_lock<std::mutex> lock(mtx_);
+        cond_.wait(lock, [&]() -> bool {
+            return count_.load(std::memory_order_relaxed) == 0 || generation_.load(std::memory_order_relaxed) != gen;
+        });
+    }
+private:
+    std::atomic_long count_{0};
+    std::atomic_ulong generation_{0};
+    std::mutex mtx_;
+    std::condition_variable cond_;
+};
+
+// 空闲线程栈(Treiber无锁栈),保存空闲线程的下标
+// head_高32位是版本号,每次修改加一,避免ABA问题
+class IdleStack
+{
+public:
+    explicit IdleStack(int capacity)
+        : head_(pack(0, EMPTY))
+        , next_(capacity)
+        {}
+    void push(int index)
+    {
+        uint64_t head = head_.load(std::memory_order_relaxed);
+        do
+        {
+            next_[index].store(indexOf(head), std::memory_order_relaxed);
+        } while (!head_.compare_exchange_weak(head, pack(tagOf(head) + 1, (uint32_t)index),
+            std::memory_order_release, std::memory_order_relaxed));
+    }
+    // 栈为空时返回-1
+    int pop()
+    {
+        uint64_t head = head_.load(std::memory_order_acquire);
+        for (;;)
+        {
+            uint32_t index = indexOf(head);
+            if (index == EMPTY)
+                return -1;
+            uint32_t next = next_[index].load(std::memory_order_relaxed);
+            if (head_.compare_exchange_weak(head, pack(tagOf(head) + 1, next),
+                std::memory_order_acquire, std::memory_order_acquire))
+                return (int)index;
+        }
+    }
+private:
+    static constexpr uint32_t EMPTY = 0xffffffffu;
+    static uint64_t pack(uint32_t tag, uint32_t index) { return ((uint64_t)tag << 32) | index; }
+    static uint32_t tagOf(uint64_t head) { return (uint32_t)(head >> 32); }
+    static uint32_t indexOf(uint64_t head) { return (uint32_t)head; }
+    alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> head_;
+    std::vector<std::atomic<uint32_t>> next_;
+};
+
+// Chase-Lev 无锁工作窃取双端队列
+// 只有所有者线程可以在底部push/pop,其他线程只能从顶部steal
+// T 必须是可平凡拷贝的类型(一般存放任务指针)
+template<typename T>
+class WorkStealingDeque
+{
+public:
+    explicit WorkStealingDeque(int64_t capacity = WS_DEQUE_INIT_SIZE)
+        : top_(0)
+        , bottom_(0)
+        , array_(new Array(capacity))
+        {}
+    ~WorkStealingDeque()
+    {
+        for (Array* a : garbage_)
+            delete a;
+        delete array_.load(std::memory_order_relaxed);
+    }
+    WorkStealingDeque(const WorkStealingDeque&) = delete;
+    WorkStealingDeque& operator=(const WorkStealingDeque&) = delete;
+
+    // 所有者线程在底部放入一个元素,容量不够时扩容
+    void push(T item)
+    {
+        int64_t b = bottom_.load(std::memory_order_relaxed);
+        int64_t t = top_.load(std::memory_order_acquire);
+        Array* a = array_.load(std::memory_order_relaxed);
+        if (b - t > a->capacity() - 1)
+        {
+            // 旧数组可能仍被窃取线程读取,不能立即释放,等队列析构时统一回收
+            garbage_.push_back(a);
+            a = a->grow(b, t);
+            array_.store(a, std::memory_order_release);
+        }
+        a->put(b, item);
+        // release保证窃取线程读到新的bottom_时一定能看到放入的元素
+        bottom_.store(b + 1, std::memory_order_release);
+    }
+    // 所有者线程从底部取出一个元素(LIFO,缓存更友好)
+    bool pop(T& item)
+    {
+        int64_t b = bottom_.load(std::memory_order_relaxed) - 1;
+        Array* a = array_.load(std::memory_order_relaxed);
+        bottom_.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t t = top_.load(std::memory_order_relaxed);
+        if (t > b)
+        {
+            // 队列为空
+            bottom_.store(b + 1, std::memory_order_relaxed);
+            return false;
+        }
+        item = a->get(b);
+        if (t == b)
+        {
+            // 只剩最后一个元素,和窃取线程竞争
+            bool won = top_.compare_exchange_strong(t, t + 1,
+                std::memory_order_seq_cst, std::memory_order_relaxed);
+            bottom_.store(b + 1, std::memory_order_relaxed);
+            return won;
+        }
+        return true;
+    }
+    // 任意线程从顶部窃取一个元素(FIFO)
+    bool steal(T& item)
+    {
+        int64_t t = top_.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t b = bottom_.load(std::memory_order_acquire);
+        if (t >= b)
+            return false;
+        Array* a = array_.load(std::memory_order_acquire);
+        item = a->get(t);
+        return top_.compare_exchange_strong(t, t + 1,
+            std::memory_order_seq_cst, std::memory_order_relaxed);
+    }
+    bool empty() const
+    {
+        int64_t b = bottom_.load(std::memory_order_relaxed);
+        int64_t t = top_.load(std::memory_order_relaxed);
+        return b <= t;
+    }
+    size_t size() const
+    {
+        int64_t b = bottom_.load(std::memory_order_relaxed);
+        int64_t t = top_.load(std::memory_order_relaxed);
+        return b > t ? (size_t)(b - t) : 0;
+    }
+private:
+    class Array
+    {
+    public:
+        explicit Array(int64_t capacity)
+            : capacity_(capacity)
+            , mask_(capacity - 1)
+            , buf_(new std::atomic<T>[capacity])
+            {}
+        ~Array() { delete[] buf_; }
+        int64_t capacity() const { return capacity_; }
+        void put(int64_t i, T item) { buf_[i & mask_].store(item, std::memory_order_relaxed); }
+        T get(int64_t i) const { return buf_[i & mask_].load(std::memory_order_relaxed); }
+        Array* grow(int64_t b, int64_t t) const
+        {
+            Array* a = new Array(capacity_ * 2);
+            for (int64_t i = t; i < b; i++)
+                a->put(i, get(i));
+            return a;
+        }
+    private:
+        int64_t capacity_;
+        int64_t mask_;
+        std::atomic<T>* buf_;
+    };
+    // top_由窃取的线程CAS,bottom_由所有者线程每次push/pop写入,分开放在两个缓存行
+    alignas(CACHE_LINE_SIZE) std::atomic<int64_t> top_;
+    alignas(CACHE_LINE_SIZE) std::atomic<int64_t> bottom_;
+    std::atomic<Array*> array_;
+    std::vector<Array*> garbage_; // 扩容后被替换下来的旧数组,只有所有者线程访问
+};
+
+// Vyukov 有界多生产者多消费者无锁队列
+// 每个槽位带一个序号,生产者和消费者各自用CAS推进位置,互不加锁
+// 容量会向上取整为2的幂
+template<typename T>
+class MPMCQueue
+{
+public:
+    explicit MPMCQueue(size_t capacity)
+    {
+        size_t cap = 2;
+        while (cap < capacity)
+            cap <<= 1;
+        mask_ = cap - 1;
+        cells_ = new Cell[cap];
+        for (size_t i = 0; i < cap; i++)
+            cells_[i].seq.store(i, std::memory_order_relaxed);
+        enqueuePos_.store(0, std::memory_order_relaxed);
+        dequeuePos_.store(0, std::memory_order_relaxed);
+    }
+    ~MPMCQueue()
+    {
+        T item;
+        while (tryPop(item))
+            ;
+        delete[] cells_;
+    }
+    MPMCQueue(const MPMCQueue&) = delete;
+    MPMCQueue& operator=(const MPMCQueue&) = delete;
+
+    // 队列满时返回false,此时item不会被移走
+    bool tryPush(T& item)
+    {
+        return tryEmplace(std::move(item));
+    }
+    // 占到槽位后才用args在槽位上直接构造元素,队列满时返回false,此时args不会被移走
+    template<typename... A>
+    bool tryEmplace(A&&... args)
+    {
+        Cell* cell;
+        size_t pos = enqueuePos_.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            cell = &cells_[pos & mask_];
+            size_t seq = cell->seq.load(std::memory_order_acquire);
+            intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+            if (dif == 0)
+            {
+                if (enqueuePos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            }
+            else if (dif < 0)
+            {
+                return false;
+            }
+            else
+            {
+                pos = enqueuePos_.load(std::memory_order_relaxed);
+            }
+        }
+        // 和std::vector::emplace_back一样用圆括号构造,只有聚合类型(例如QueuedTask)才用花括号
+        if constexpr (std::is_constructible<T, A&&...>::value)
+            new (cell->data()) T(std::forward<A>(args)...);
+        else
+            new (cell->data()) T{ std::forward<A>(args)... };
+        cell->seq.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+    // 一次CAS占用连续的空闲槽位批量放入,返回实际放入的个数(队列满时为0)
+    // 前返回值个元素会被移走
+    size_t tryPushBulk(T* items, size_t count)
+    {
+        size_t pos = enqueuePos_.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            intptr_t dif = (intptr_t)cells_[pos & mask_].seq.load(std::memory_order_acquire) - (intptr_t)pos;
+            if (dif < 0)
+                return 0;
+            if (dif > 0)
+            {
+                pos = enqueuePos_.load(std::memory_order_relaxed);
+                continue;
+            }
+            // 统计从pos开始连续空闲的槽位,这些槽位在被我们占用之前不会被别的线程写入
+            size_t n = 1;
+            while (n < count && cells_[(pos + n) & mask_].seq.load(std::memory_order_acquire) == pos + n)
+                n++;
+            if (enqueuePos_.compare_exchange_weak(pos, pos + n, std::memory_order_relaxed))
+            {
+                for (size_t i = 0; i < n; i++)
+                {
+                    Cell& cell = cells_[(pos + i) & mask_];
+                    new (cell.data()) T(std::move(items[i]));
+                    cell.seq.store(pos + i + 1, std::memory_order_release);
+                }
+                return n;
+            }
+        }
+    }
+    // 队列空时返回false
+    bool tryPop(T& item)
+    {
+        return tryConsume([&](T& data) { item = std::move(data); });
+    }
+    // 取出队头元素并在槽位上直接交给consume处理,队列空时返回false
+    template<typename F>
+    bool tryConsume(F&& consume)
+    {
+        Cell* cell;
+        size_t pos = dequeuePos_.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            cell = &cells_[pos & mask_];
+            size_t seq = cell->seq.load(std::memory_order_acquire);
+            intptr_t dif = (intptr_t)seq - (intptr_t)(pos + 1);
+            if (dif == 0)
+            {
+                if (dequeuePos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            }
+            else if (dif < 0)
+            {
+                return false;
+            }
+            else
+            {
+                pos = dequeuePos_.load(std::memory_order_relaxed);
+            }
+        }
+        T* data = cell->data();
+        consume(*data);
+        data->~T();
+        cell->seq.store(pos + mask_ + 1, std::memory_order_release);
+        return true;
+    }
+    // 近似值,只用于判断是否需要唤醒/睡眠
+    size_t size() const
+    {
+        size_t e = enqueuePos_.load(std::memory_order_relaxed);
+        size_t d = dequeuePos_.load(std::memory_order_relaxed);
+        return e > d ? e - d : 0;
+    }
+    bool empty() const { return size() == 0; }
+    size_t capacity() const { return mask_ + 1; }
+    // 累计入队/出队的元素数量
+    size_t pushedCount() const { return enqueuePos_.load(std::memory_order_relaxed); }
+    size_t poppedCount() const { return dequeuePos_.load(std::memory_order_relaxed); }
+private:
+    // 每个槽位按缓存行对齐,相邻槽位的生产者和消费者不会互相干扰
+    struct alignas(CACHE_LINE_SIZE) Cell
+    {
+        std::atomic<size_t> seq;
+        alignas(T) unsigned char storage[sizeof(T)];
+        T* data() { return reinterpret_cast<T*>(storage); }
+    };
+    // 生产者和消费者的位置放在不同的缓存行,避免伪共享
+    alignas(CACHE_LINE_SIZE) Cell* cells_;
+    size_t mask_;
+    alignas(CACHE_LINE_SIZE) std::atomic<size_t> enqueuePos_;
+    alignas(CACHE_LINE_SIZE) std::atomic<size_t> dequeuePos_;
+};
+
+// 分层时间轮: 每层64个槽,第0层一个槽对应一个tick,第i层一个槽对应64^i个tick
+// 定时器放入到期tick与当前tick最高的不同位所在的层,同一层的定时器都在当前tick所在的窗口内,
+// 低层的定时器总是比高层的先到期,下一个到期时间由最低的非空层的占用位图直接得到,插入和到期都是O(1)
+// 高层的槽到期时其中的定时器按新的当前tick重新放入低层;超出范围的定时器放在far_中,每个顶层窗口检查一次
+// Node需要有Node* next和uint64_t expire成员,时间轮不负责释放节点,不是线程安全的
+template<typename Node>
+class TimerWheel
+{
+public:
+    static constexpr uint64_t NONE = UINT64_MAX;
+    void insert(Node* node)
+    {
+        size_++;
+        // 已经到期的定时器放在当前tick的槽中
+        uint64_t expire = std::max(node->expire, now_);
+        int level = levelOf(expire);
+        if (level >= TIMER_WHEEL_LEVELS)
+        {
+            node->next = far_;
+            far_ = node;
+            return;
+        }
+        int slot = (int)((expire >> (level * SLOT_BITS)) & SLOT_MASK);
+        node->next = slots_[level][slot];
+        slots_[level][slot] = node;
+        occupied_[level] |= 1ULL << slot;
+    }
+    // 下一个需要处理的tick,没有定时器时返回NONE
+    uint64_t nextExpire() const
+    {
+        for (int level = 0; level < TIMER_WHEEL_LEVELS; level++)
+        {
+            if (occupied_[level] == 0)
+                continue;
+            int slot = __builtin_ctzll(occupied_[level]);
+            int windowBits = (level + 1) * SLOT_BITS;
+            return (now_ >> windowBits << windowBits) + ((uint64_t)slot << (level * SLOT_BITS));
+        }
+        if (far_ != nullptr)
+            return ((now_ >> TOTAL_BITS) + 1) << TOTAL_BITS;
+        return NONE;
+    }
+    // 把当前时间推进到now,返回到期的定时器链表
+    Node* advance(uint64_t now)
+    {
+        Node* expired = nullptr;
+        uint64_t next;
+        while ((next = nextExpire()) <= now)
+        {
+            Node* list = take(next);
+            while (list != nullptr)
+            {
+                Node* node = list;
+                list = node->next;
+                size_--;
+                if (node->expire <= now_)
+                {
+                    node->next = expired;
+                    expired = node;
+                }
+                else
+                {
+                    insert(node);
+                }
+            }
+        }
+        now_ = std::max(now_, now);
+        return expired;
+    }
+    // 取出所有定时器
+    Node* takeAll()
+    {
+        Node* all = far_;
+        far_ = nullptr;
+        for (int level = 0; level < TIMER_WHEEL_LEVELS; level++)
+        {
+            while (occupied_[level] != 0)
+            {
+                int slot = __builtin_ctzll(occupied_[level]);
+                occupied_[level] &= occupied_[level] - 1;
+                Node* list = slots_[level][slot];
+                slots_[level][slot] = nullptr;
+                while (list != nullptr)
+                {
+                    Node* node = list;
+                    list = node->next;
+                    node->next = all;
+                    all = node;
+                }
+            }
+        }
+        size_ = 0;
+        return all;
+    }
+    size_t size() const { return size_; }
+private:
+    static constexpr int SLOT_BITS = 6;
+    static constexpr int SLOT_COUNT = 1 << SLOT_BITS;
+    static constexpr uint64_t SLOT_MASK = SLOT_COUNT - 1;
+    static constexpr int TOTAL_BITS = SLOT_BITS * TIMER_WHEEL_LEVELS;
+
+    int levelOf(uint64_t expire) const
+    {
+        int bit = 63 - __builtin_clzll((expire ^ now_) | SLOT_MASK);
+        return bit / SLOT_BITS;
+    }
+    // 取出tick为next的槽(或far_)并把当前时间推进到next
+    Node* take(uint64_t next)
+    {
+        now_ = next;
+        for (int level = 0; level < TIMER_WHEEL_LEVELS; level++)
+        {
+            if (occupied_[level] == 0)
+                continue;
+            int slot = __builtin_ctzll(occupied_[level]);
+            occupied_[level] &= ~(1ULL << slot);
+            Node* list = slots_[level][slot];
+            slots_[level][slot] = nullptr;
+            return list;
+        }
+        Node* list = far_;
+        far_ = nullptr;
+        return list;
+    }
+
+    Node* slots_[TIMER_WHEEL_LEVELS][SLOT_COUNT] = {};
+    uint64_t occupied_[TIMER_WHEEL_LEVELS] = {};    // 每层非空槽的位图
+    Node* far_ = nullptr;                           // 超出时间轮范围的定时器
+    uint64_t now_ = 0;                              // 当前tick
+    size_t size_ = 0;
+};
+
+// 一个工作线程的任务跟踪记录,固定容量的环形缓冲区,写满后覆盖最早的记录
+// 只有所属线程写入,不加锁;其他线程随时可以读取快照,读取期间被覆盖的记录会被丢弃
+class TraceBuffer
+{
+public:
+    struct Record
+    {
+        int64_t enqueue;    // 入队时间,0表示没有记录(工作窃取模式的本地任务)
+        int64_t dequeue;    // 出队时间
+        int64_t start;      // 开始执行的时间
+        int64_t end;        // 执行结束的时间
+        const char* tag;    // 任务设置的标签,没有设置时为nullptr
+    };
+
+    explicit TraceBuffer(size_t capacity)
+    {
+        size_t cap = 1;
+        while (cap < capacity)
+            cap <<= 1;
+        mask_ = cap - 1;
+        events_ = std::make_unique<Event[]>(cap);
+    }
+
+    void record(const Record& r)
+    {
+        uint64_t head = published_.load(std::memory_order_relaxed);
+        // 先声明要覆盖的位置,读取方据此判断读到的记录是否被覆盖
+        claimed_.store(head + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        Event& e = events_[head & mask_];
+        e.enqueue.store(r.enqueue, std::memory_order_relaxed);
+        e.dequeue.store(r.dequeue, std::memory_order_relaxed);
+        e.start.store(r.start, std::memory_order_relaxed);
+        e.end.store(r.end, std::memory_order_relaxed);
+        e.tag.store(r.tag, std::memory_order_relaxed);
+        published_.store(head + 1, std::memory_order_release);
+    }
+
+    // 按时间顺序把当前保留的记录追加到out
+    void snapshot(std::vector<Record>& out) const
+    {
+        uint64_t cap = mask_ + 1;
+        uint64_t end = published_.load(std::memory_order_acquire);
+        uint64_t begin = end > cap ? end - cap : 0;
+        size_t base = out.size();
+        for (uint64_t i = begin; i < end; i++)
+        {
+            const Event& e = events_[i & mask_];
+            out.push_back(Record{ e.enqueue.load(std::memory_order_relaxed), e.dequeue.load(std::memory_order_relaxed),
+                e.start.load(std::memory_order_relaxed), e.end.load(std::memory_order_relaxed),
+                e.tag.load(std::memory_order_relaxed) });
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        uint64_t claimed = claimed_.load(std::memory_order_relaxed);
+        uint64_t valid = claimed > cap ? claimed - cap : 0;
+        if (valid > begin)
+            out.erase(out.begin() + base, out.begin() + base + (size_t)std::min(valid - begin, end - begin));
+    }
+
+    // 累计记录的任务数量,超过容量的部分已被覆盖
+    uint64_t recorded() const { return published_.load(std::memory_order_relaxed); }
+
+private:
+    struct Event
+    {
+        std::atomic<int64_t> enqueue{0};
+        std::atomic<int64_t> dequeue{0};
+        std::atomic<int64_t> start{0};
+        std::atomic<int64_t> end{0};
+        std::atomic<const char*> tag{nullptr};
+    };
+
+    std::unique_ptr<Event[]> events_;
+    uint64_t mask_ = 0;
+    alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> claimed_{0};
+    std::atomic<uint64_t> published_{0};
+};
+
+// strand的任务队列: 无锁多生产者单消费者链表队列(带哨兵节点),加上已提交还没有执行完的任务数量
+// 计数从0变为1的提交方负责调度执行任务,计数回到0之前只存在一个执行任务,因此任务按提交顺序依次执行
+// 出队和执行只由当前持有执行权的线程进行,执行权通过计数的原子操作在线程之间传递,不需要加锁
+class alignas(CACHE_LINE_SIZE) StrandQueue
+{
+public:
+    using Task = UniqueFunction<void()>;
+
+    StrandQueue() : head_(&stub_), tail_(&stub_) {}
+    StrandQueue(const StrandQueue&) = delete;
+    StrandQueue& operator=(const StrandQueue&) = delete;
+    ~StrandQueue()
+    {
+        Node* node = head_;
+        while (node != nullptr)
+        {
+            Node* next = node->next.load(std::memory_order_relaxed);
+            freeNode(node);
+            node = next;
+        }
+    }
+
+    // 放入任务,返回true表示原来没有待执行的任务,调用方需要调度执行任务
+    bool push(Task&& task)
+    {
+        Node* node = new (PoolAllocator<Node>().allocate(1)) Node(std::move(task));
+        Node* prev = tail_.exchange(node, std::memory_order_acq_rel);
+        prev->next.store(node, std::memory_order_release);
+        return pending_.fetch_add(1, std::memory_order_acq_rel) == 0;
+    }
+    // 取出最早的任务,只能由持有执行权的线程调用,并且计数表明至少还有一个任务
+    void pop(Task& task)
+    {
+        Node* head = head_;
+        Node* next;
+        // 另一个提交方已经换掉tail_但还没有链接上,等它完成
+        while ((next = head->next.load(std::memory_order_acquire)) == nullptr)
+            cpuRelax();
+        task = std::move(next->task);
+        head_ = next;
+        freeNode(head);
+    }
+    // 执行完n个任务后调用,返回true表示还有任务,执行权仍然属于调用方
+    bool finish(size_t n)
+    {
+        return pending_.fetch_sub(n, std::memory_order_acq_rel) != n;
+    }
+    // 丢弃所有待执行的任务并交出执行权,只能由持有执行权的线程调用
+    void discard()
+    {
+        size_t n;
+        do
+        {
+            n = pending();
+            for (size_t i = 0; i < n; i++)
+            {
+                Task task;
+                pop(task);
+            }
+        } while (finish(n));
+    }
+    size_t pending() const { return pending_.load(std::memory_order_acquire); }
+
+private:
+    struct Node
+    {
+        explicit Node(Task&& t) : task(std::move(t)) {}
+        Node() = default;
+        std::atomic<Node*> next{nullptr};
+        Task task;
+    };
+    void freeNode(Node* node)
+    {
+        if (node == &stub_)
+            return;
+        node->~Node();
+        PoolAllocator<Node>().deallocate(node, 1);
+    }
+
+    Node stub_;
+    Node* head_;                                            // 只由持有执行权的线程访问
+    alignas(CACHE_LINE_SIZE) std::atomic<Node*> tail_;      // 提交方修改
+    std::atomic<size_t> pending_{0};
 };
 
 class Thread
 {
 public:
-    //线程所执行的线程函数对象
-    using ThreadFunc = std::function<void(int)>;
-    Thread(ThreadFunc func)
-        :func_(func)
-        ,threadId_(generateId_++)
-        {};
-    ~Thread() = default;
+    //线程所执行的线程函数对象
+    using ThreadFunc = std::function<void(int)>;
+    Thread(ThreadFunc func)
+        :func_(func)
+        ,threadId_(generateId_++)
+        {};
+    ~Thread()
+    {
+        join();
+    };
+
+    //启动线程
+    void start()
+    {
+        // 创建一个线程并执行线程函数,线程对象由线程池持有,线程退出后由线程池join回收
+        thread_ = std::thread(func_,threadId_);
+    };
+    //等待线程函数返回,不能在线程自己内部调用
+    void join()
+    {
+        if (thread_.joinable())
+            thread_.join();
+    };
+
+    //获取线程id
+    int getThreadId(){return threadId_;};
+private:
+    ThreadFunc func_;
+    static int generateId_;
+    int threadId_; 
+    std::thread thread_;
+};
+int Thread::generateId_ = 0;
+
+// 一个NUMA节点以及本进程可以使用的CPU
+struct NumaNode
+{
+    int id;
+    std::vector<int> cpus;
+};
+
+// CPU拓扑探测和线程绑定,只在Linux下生效,其他平台视为一个节点并且不绑定
+class CpuTopology
+{
+public:
+    // 从/sys读取各NUMA节点的CPU列表,只保留本进程允许使用的CPU(容器的cpuset)
+    static std::vector<NumaNode> detect()
+    {
+        std::vector<int> allowed = allowedCpus();
+        std::vector<NumaNode> nodes;
+#ifdef __linux__
+        std::string online;
+        std::ifstream onlineIn("/sys/devices/system/node/online");
+        std::getline(onlineIn, online);
+        // 节点编号可能不连续,online给出实际存在的节点
+        for (int id : parseCpuList(online))
+        {
+            std::ifstream in("/sys/devices/system/node/node" + std::to_string(id) + "/cpulist");
+            std::string list;
+            std::getline(in, list);
+            NumaNode node{ id, {} };
+            for (int cpu : parseCpuList(list))
+            {
+                if (std::find(allowed.begin(), allowed.end(), cpu) != allowed.end())
+                    node.cpus.push_back(cpu);
+            }
+            if (!node.cpus.empty())
+                nodes.push_back(std::move(node));
+        }
+#endif
+        if (nodes.empty())
+            nodes.push_back(NumaNode{ 0, allowed });
+        return nodes;
+    }
+    // 解析"0-3,8-11"格式的CPU列表(节点列表也是同样的格式)
+    static std::vector<int> parseCpuList(const std::string& list)
+    {
+        std::vector<int> cpus;
+        size_t pos = 0;
+        while (pos < list.size())
+        {
+            size_t end = list.find(',', pos);
+            if (end == std::string::npos)
+                end = list.size();
+            std::string range = list.substr(pos, end - pos);
+            size_t dash = range.find('-');
+            try
+            {
+                int lo = std::stoi(range.substr(0, dash));
+                int hi = dash == std::string::npos ? lo : std::stoi(range.substr(dash + 1));
+                for (int cpu = lo; cpu <= hi; cpu++)
+                    cpus.push_back(cpu);
+            }
+            catch (const std::exception&)
+            {
+                // 忽略空白或无法解析的部分
+            }
+            pos = end + 1;
+        }
+        return cpus;
+    }
+    static std::vector<int> allowedCpus()
+    {
+        std::vector<int> cpus;
+#ifdef __linux__
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        if (sched_getaffinity(0, sizeof(set), &set) == 0)
+        {
+            for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+            {
+                if (CPU_ISSET(cpu, &set))
+                    cpus.push_back(cpu);
+            }
+        }
+#endif
+        if (cpus.empty())
+        {
+            for (int cpu = 0; cpu < (int)std::max(1u, std::thread::hardware_concurrency()); cpu++)
+                cpus.push_back(cpu);
+        }
+        return cpus;
+    }
+    // 把调用线程绑定到cpus,失败(例如CPU不存在)时保持原来的绑定
+    static bool pinCurrentThread(const std::vector<int>& cpus)
+    {
+#ifdef __linux__
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (int cpu : cpus)
+        {
+            if (cpu >= 0 && cpu < CPU_SETSIZE)
+                CPU_SET(cpu, &set);
+        }
+        return CPU_COUNT(&set) > 0 && pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+        (void)cpus;
+        return false;
+#endif
+    }
+};
+// 任务在开始执行前被取消时,future中保存的异常
+class TaskCancelledError : public std::runtime_error
+{
+public:
+    TaskCancelledError()
+        : std::runtime_error("task cancelled before it started.")
+        {}
+};
+
+// 任务排队超过超时时间还没有开始执行时,future中保存的异常
+class TaskTimeoutError : public std::runtime_error
+{
+public:
+    TaskTimeoutError()
+        : std::runtime_error("task timed out in queue.")
+        {}
+};
+
+// 可取消任务的共享状态,由任务、CancelHandle和StopToken共享
+class CancelState
+{
+public:
+    enum Status
+    {
+        QUEUED,     // 在队列中等待执行
+        RUNNING,    // 已经开始执行
+        CANCELLED,  // 开始执行前被取消或超时,future已经得到异常
+    };
+    explicit CancelState(std::shared_ptr<std::atomic_ulong> poolEpoch)
+        : poolEpoch_(std::move(poolEpoch))
+        , epoch_(poolEpoch_->load())
+        {}
+    virtual ~CancelState() = default;
+    // 任务还没有开始时标记为取消并把e写入future,返回false表示任务已经开始或已经取消
+    bool abort(std::exception_ptr e)
+    {
+        int expected = QUEUED;
+        if (!status_.compare_exchange_strong(expected, CANCELLED))
+            return false;
+        setError(e);
+        return true;
+    }
+    // 开始执行,返回false表示已经被取消
+    bool start()
+    {
+        int expected = QUEUED;
+        return status_.compare_exchange_strong(expected, RUNNING);
+    }
+    void requestStop() { stop_.store(true, std::memory_order_relaxed); }
+    // 任务自己请求了停止,或者提交之后线程池调用过cancelAll
+    bool stopRequested() const
+    {
+        return stop_.load(std::memory_order_relaxed) || poolEpoch_->load(std::memory_order_relaxed) != epoch_;
+    }
+    Status status() const { return (Status)status_.load(); }
+protected:
+    virtual void setError(std::exception_ptr e) = 0;
+private:
+    std::atomic_int status_{QUEUED};
+    std::atomic_bool stop_{false};
+    std::shared_ptr<std::atomic_ulong> poolEpoch_;  // 线程池的cancelAll计数,线程池析构后仍然有效
+    unsigned long epoch_;                           // 提交时的cancelAll计数
+};
+
+template<typename RType>
+class CancelTaskState : public CancelState
+{
+public:
+    explicit CancelTaskState(std::shared_ptr<std::atomic_ulong> poolEpoch)
+        : CancelState(std::move(poolEpoch))
+        , promise(std::allocator_arg, PoolAllocator<RType>())
+        {}
+    std::promise<RType> promise;
+protected:
+    void setError(std::exception_ptr e) override { promise.set_exception(e); }
+};
+
+// 周期任务的取消状态,不会进入RUNNING状态,取消后不再触发
+class PeriodicTaskState : public CancelState
+{
+public:
+    using CancelState::CancelState;
+protected:
+    void setError(std::exception_ptr) override {}
+};
+
+// 传给可取消任务的停止标志,任务在执行过程中定期检查,发现请求停止后尽快返回
+class StopToken
+{
+public:
+    StopToken() = default;
+    explicit StopToken(std::shared_ptr<CancelState> state) : state_(std::move(state)) {}
+    bool stopRequested() const { return state_ && state_->stopRequested(); }
+private:
+    std::shared_ptr<CancelState> state_;
+};
+
+// 可取消任务的句柄,拷贝之间共享取消状态
+class CancelHandle
+{
+public:
+    CancelHandle() = default;
+    explicit CancelHandle(std::shared_ptr<CancelState> state) : state_(std::move(state)) {}
+    bool valid() const { return state_ != nullptr; }
+    // 任务还在排队时future立即得到TaskCancelledError,任务出队时直接丢弃;
+    // 已经开始执行时只能通过StopToken通知任务,返回false
+    bool cancel()
+    {
+        state_->requestStop();
+        return state_->abort(std::make_exception_ptr(TaskCancelledError()));
+    }
+    // 任务是否在开始执行前被取消或超时
+    bool cancelled() const { return state_->status() == CancelState::CANCELLED; }
+private:
+    std::shared_ptr<CancelState> state_;
+};
+
+template<typename T>
+struct CancellableFuture
+{
+    std::future<T> future;
+    CancelHandle handle;
+};
+
+// 可取消任务的返回值类型,可调用对象的第一个参数可以是StopToken
+template<typename Func, typename... Args>
+struct CancellableResult
+{
+    static constexpr bool takesToken = std::is_invocable<std::decay_t<Func>&, StopToken, std::decay_t<Args>&...>::value;
+    using type = typename std::conditional_t<takesToken,
+        std::invoke_result<std::decay_t<Func>&, StopToken, std::decay_t<Args>&...>,
+        std::invoke_result<std::decay_t<Func>&, std::decay_t<Args>&...>>::type;
+};
+
+// 线程睡眠/唤醒相关的统计
+struct ParkingStats
+{
+    long parks;             // 线程进入睡眠的次数
+    long unparks;           // 提交任务时定向唤醒线程的次数
+    long spuriousWakeups;   // 线程被唤醒后没有拿到任务的次数
+};
+
+// 时间直方图,第i个桶统计[2^i, 2^(i+1))纳秒的样本数量
+struct LatencyHistogram
+{
+    long buckets[STATS_HIST_BUCKETS] = {};
+
+    long count() const
+    {
+        long n = 0;
+        for (long b : buckets)
+            n += b;
+        return n;
+    }
+    // 近似的分位数,返回样本所在桶的上界 单位:微秒
+    double percentileUs(double q) const
+    {
+        long n = count();
+        if (n == 0)
+            return 0;
+        long rank = (long)(q * (n - 1)) + 1;
+        for (int i = 0; i < STATS_HIST_BUCKETS; i++)
+        {
+            rank -= buckets[i];
+            if (rank <= 0)
+                return (double)(1LL << (i + 1)) / 1000.0;
+        }
+        return (double)(1LL << STATS_HIST_BUCKETS) / 1000.0;
+    }
+};
+
+// 一个工作线程槽位的统计
+struct WorkerStats
+{
+    int slot;           // 槽位下标,cached模式下回收后的槽位会被新线程复用
+    int node;           // 线程所属的NUMA节点,没有设置绑定时为-1
+    long executed;      // 执行的任务数量
+    long stolen;        // 从其他线程本地队列窃取的任务数量
+    double busySec;     // 不在睡眠的时间(包括自旋) 单位:秒
+    double idleSec;     // 睡眠的时间 单位:秒
+};
+
+// 线程池运行状态的快照
+struct PoolStats
+{
+    int threads;                // 当前线程数量
+    int idleThreads;            // 没有在执行任务的线程数量
+    int parkedThreads;          // 正在睡眠的线程数量
+    long queuedTasks;           // 任务队列(包括各优先级和截止时间队列)中的任务数量
+    long localQueuedTasks;      // 工作窃取模式下各线程本地队列中的任务数量
+    long executed;              // 工作线程执行的任务数量
+    long stolen;                // 窃取的任务数量
+    long rejected;              // 被拒绝的提交次数
+    long discarded;             // DISCARD_OLDEST策略丢弃的任务数量
+    long cancelled;             // 因为取消、超时或cancelAll没有执行的任务数量
+    long threadsCreated;        // 创建过的线程数量
+    long threadsDestroyed;      // 退出的线程数量
+    long compensations;         // 工作线程进入阻塞区域时创建补偿线程(或取消回收线程)的次数
+    int blockingThreads;        // 阻塞执行器的线程数量
+    int blockingIdleThreads;    // 阻塞执行器中等待任务的线程数量
+    long blockingQueued;        // 阻塞执行器排队的任务数量
+    long blockingExecuted;      // 阻塞执行器执行的任务数量
+    long pendingTimers;         // 还没有到期的定时任务数量
+    long timersFired;           // 到期后放入任务队列的定时任务数量(周期任务每次触发计一次)
+    double queueWaitUs;         // cached模式控制器最近一个周期测得的排队时间 单位:微秒
+    double utilization;         // cached模式控制器最近一个周期测得的线程利用率
+    ParkingStats parking;
+    std::vector<WorkerStats> workers;
+    LatencyHistogram waitTime;  // 采样任务的排队时间
+    LatencyHistogram execTime;  // 采样任务的执行时间
+};
+template<typename T>
+class PoolFuture;
+template<typename T>
+class FutureState;
+class TaskGraph;
+class TaskGroup;
+class Pipeline;
+class Strand;
+class BlockingScope;
+template<typename T>
+class Channel;
+#ifdef THREADPOOL_COROUTINE
+class ScheduleAwaiter;
+template<typename T = void>
+class CoTask;
+template<typename T>
+class PoolFutureAwaiter;
+#endif
+// cached模式线程数量控制器的参数
+// 排队时间连续growTicks个周期超过growWait时增加最多growStep个线程,
+// 没有排队任务且利用率连续shrinkTicks个周期低于shrinkUtil时回收一个线程
+struct ElasticConfig
+{
+    std::chrono::milliseconds interval{CACHED_CONTROL_INTERVAL};
+    std::chrono::microseconds growWait{CACHED_GROW_WAIT};
+    int growTicks = CACHED_GROW_TICKS;
+    int growStep = CACHED_GROW_STEP;
+    double shrinkUtil = CACHED_SHRINK_UTIL;
+    int shrinkTicks = CACHED_SHRINK_TICKS;
+};
+
+// 一条任务队列的统计信息
+struct LaneStats
+{
+    size_t depth;       // 当前排队的任务数量(近似值)
+    long submitted;     // 入队的任务数量
+    long dequeued;      // 出队的任务数量
+    long aged;          // 为防止饥饿越过更高优先级的任务先执行的次数
+    long sampled;       // 采样了排队时间的任务数量
+    double avgWaitUs;   // 采样任务的平均排队时间 单位:微秒
+    double maxWaitUs;   // 采样任务的最长排队时间 单位:微秒
+};
+
+class ThreadPool
+{
+public:
+    ThreadPool()
+    : PoolMode_(PoolMode::MODE_FIXED)
+    , isRuning_(false)
+    , initThreadSize_(0)
+    , maxThreadSisze_(THREAD_MAX_SIZE)
+    , taskQueMaxSize_(TASK_MAX_SIZE)
+    , queFullPolicy_(QueueFullPolicy::BLOCK_TIMEOUT)
+    , submitTimeout_(std::chrono::seconds(TASK_SUBMIT_TIMEOUT))
+    , idleCount_(0)
+    , unparks_(0)
+    , fullWaiters_(0)
+    , curThreadSize_(0)
+    {
+        for (int i = LANE_HIGH; i <= LANE_BACKGROUND; i++)
+            lanes_[i].que = std::make_unique<MPMCQueue<QueuedTask>>(TASK_MAX_SIZE);
+    };
+    ~ThreadPool()
+    {
+        // 没有调用过shutdown时执行完剩余任务;调用过时等待还没有退出的线程
+        shutdown(ShutdownMode::DRAIN);
+    };
+    //关闭线程池,之后线程池外部提交的任务被拒绝,正在执行的任务派生的子任务仍然可以提交
+    //timeout为线程退出的最长等待时间,超时返回时剩余的线程由析构函数等待;在工作线程中调用时不等待
+    ShutdownResult shutdown(ShutdownMode mode = ShutdownMode::DRAIN,
+        std::chrono::milliseconds timeout = std::chrono::milliseconds::max())
+    {
+        auto begin = std::chrono::steady_clock::now();
+        long executedBefore = executedCount();
+        long cancelledBefore = cancelled_;
+        shutdown_ = true;
+        // 还没有到期的定时任务不再触发
+        cancelled_ += (long)clearTimers(true);
+        if (mode != ShutdownMode::DRAIN)
+            cancelAll();
+        isRuning_ = false;
+        // 先停止控制器,之后不会再创建新线程
+        {
+            std::unique_lock<std::mutex> lock(superviseMtx_);
+        }
+        superviseCond_.notify_all();
+        if (supervisor_.joinable())
+            supervisor_.join();
+        // 唤醒所有睡眠的线程,让它们处理完剩余任务后退出
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        for (auto& slot : slots_)
+        {
+            if (cancelIdle(*slot))
+                slot->parker.unpark();
+        }
+        if (mode != ShutdownMode::IMMEDIATE && curPool_ != this)
+        {
+            std::unique_lock<std::mutex>lock(taskQueMtx_);
+            auto allExited = [&]()->bool{return exitedThreads_.size() == threads_.size();};
+            if (timeout == std::chrono::milliseconds::max())
+                recycle_.wait(lock, allExited);
+            else
+                recycle_.wait_for(lock, timeout, allExited);
+        }
+        reapThreads();
+        // 工作线程退出后再停止阻塞执行器,排空期间执行的任务仍然可以提交阻塞任务
+        std::chrono::milliseconds remaining = timeout;
+        if (timeout != std::chrono::milliseconds::max())
+            remaining = std::max(std::chrono::milliseconds(0), timeout
+                - std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - begin));
+        stopBlocking(mode != ShutdownMode::IMMEDIATE && curPool_ != this, remaining);
+        reapBlocking();
+        ShutdownResult result;
+        result.completed = executedCount() - executedBefore;
+        result.discarded = cancelled_ - cancelledBefore;
+        {
+            std::unique_lock<std::mutex>lock(blockingMtx_);
+            result.runningThreads = (int)blockingThreads_.size();
+        }
+        std::unique_lock<std::mutex>lock(taskQueMtx_);
+        result.runningThreads += (int)threads_.size();
+        return result;
+    };
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+    void setMode(PoolMode mode)
+    {
+        if (poolState())
+            return;
+        PoolMode_ = mode;
+    }; 
+    //设置线程池的工作模式
+    //处理器核心数作为线程数量
+    void start(int size = std::thread::hardware_concurrency())
+    {
+        // 设置线程的运行状态
+        isRuning_ = true;
+
+        // 记录初始化线程个数
+        initThreadSize_ = size;
+        // 每个线程占用一个槽位,cached模式按线程数量上限预先分配,另外预留补偿线程使用的槽位
+        int slotCount = size;
+        if (PoolMode_ == PoolMode::MODE_CACHED && maxThreadSisze_ > (size_t)size)
+            slotCount = (int)maxThreadSisze_;
+        slotCount += THREAD_COMPENSATE_MAX;
+        // 工作窃取模式下每个槽位拥有一个本地双端队列
+        if (PoolMode_ == PoolMode::MODE_WORK_STEALING)
+        {
+            for (int i = 0; i < slotCount; i++)
+                workers_.emplace_back(std::make_unique<WorkStealingDeque<Task*>>());
+        }
+        for (int i = 0; i < slotCount; i++)
+        {
+            slots_.emplace_back(std::make_unique<WorkerSlot>());
+            if (tracing_)
+                slots_.back()->trace = std::make_unique<TraceBuffer>(traceCapacity_);
+        }
+        traceBase_ = nowTicks();
+        placeWorkers();
+        for (int i = slotCount - 1; i >= size; i--)
+            freeSlots_.push_back(i);
+        idleStack_ = std::make_unique<IdleStack>(slotCount);
+        // 创建线程
+        std::vector<int> threadIds;
+        for (size_t i = 0; i < initThreadSize_; i++)
+        {
+            // c++11 提供make_shared c++14 提供make_unique
+            auto ptr = std::make_unique<Thread>(std::bind(&ThreadPool::threadFunc, this, std::placeholders::_1, i));
+            int thtreadId = ptr->getThreadId();
+            // unique_ptr 删除了拷贝构造函数 只保留了移动构造函数 因此需要使用move做资源转移
+
+            threads_.emplace(thtreadId,std::move(ptr));
+            threadIds.push_back(thtreadId);
+        }
+        // 启动线程
+        // 线程id是全局递增的,不一定从0开始,所以按照创建时记录的id启动
+        for (size_t i = 0; i < initThreadSize_; i++)
+        {
+            std::cout<<"start:"<<i<<std::endl;
+            threads_[threadIds[i]]->start();
+            curThreadSize_++;
+            threadsCreated_++;
+        }
+        // cached模式下由后台控制器负责增减线程,提交任务的线程不再创建线程
+        if (PoolMode_ == PoolMode::MODE_CACHED)
+            supervisor_ = std::thread(&ThreadPool::superviseFunc, this);
+    } //开启线程池
+    //线程睡眠/唤醒的统计,睡眠次数和无效唤醒次数由各工作线程分别计数
+    ParkingStats parkingStats() const
+    {
+        ParkingStats s{ 0, unparks_.load(), 0 };
+        for (auto& slot : slots_)
+        {
+            s.parks += slot->counters.parks.load(std::memory_order_relaxed);
+            s.spuriousWakeups += slot->counters.spuriousWakeups.load(std::memory_order_relaxed);
+        }
+        return s;
+    };
+    //线程池运行状态的快照,计数分散在各工作线程的私有缓存行中,这里汇总
+    PoolStats stats()
+    {
+        PoolStats s;
+        int64_t now = nowTicks();
+        s.threads = curThreadSize_;
+        s.idleThreads = s.threads - busyThreads();
+        s.parkedThreads = idleCount_;
+        s.queuedTasks = 0;
+        for (int i = LANE_HIGH; i < laneCount(); i++)
+            s.queuedTasks += (long)laneDepth(i);
+        s.localQueuedTasks = 0;
+        for (auto& w : workers_)
+            s.localQueuedTasks += (long)w->size();
+        s.executed = 0;
+        s.stolen = 0;
+        s.rejected = rejected_;
+        s.discarded = discarded_;
+        s.cancelled = cancelled_;
+        s.threadsCreated = threadsCreated_;
+        s.threadsDestroyed = threadsDestroyed_;
+        s.compensations = compensations_;
+        {
+            std::unique_lock<std::mutex> lock(blockingMtx_);
+            s.blockingThreads = (int)(blockingThreads_.size() - blockingExited_.size());
+            s.blockingIdleThreads = blockingIdle_;
+            s.blockingQueued = (long)blockingQue_.size();
+        }
+        s.blockingExecuted = blockingExecuted_;
+        {
+            std::unique_lock<std::mutex> lock(timerMtx_);
+            s.pendingTimers = (long)(timerWheel_.size() + timerOverflow_.size());
+        }
+        s.timersFired = timersFired_;
+        {
+            std::unique_lock<std::mutex> lock(superviseMtx_);
+            s.queueWaitUs = queueWaitUs_;
+            s.utilization = utilization_;
+        }
+        s.parking = parkingStats();
+        for (size_t i = 0; i < slots_.size(); i++)
+        {
+            const WorkerCounters& c = slots_[i]->counters;
+            WorkerStats w;
+            w.slot = (int)i;
+            w.node = nodeQues_.empty() ? -1 : nodes_[slots_[i]->node].id;
+            w.executed = c.executed.load(std::memory_order_relaxed);
+            w.stolen = c.stolen.load(std::memory_order_relaxed);
+            // 加上还没有结束的忙碌/睡眠时间段
+            int64_t busy = c.busyNs.load(std::memory_order_relaxed);
+            int64_t idle = c.idleNs.load(std::memory_order_relaxed);
+            int64_t busySince = c.busySince.load(std::memory_order_relaxed);
+            int64_t idleSince = c.idleSince.load(std::memory_order_relaxed);
+            if (busySince != 0)
+                busy += std::max<int64_t>(0, now - busySince);
+            else if (idleSince != 0)
+                idle += std::max<int64_t>(0, now - idleSince);
+            w.busySec = busy / 1e9;
+            w.idleSec = idle / 1e9;
+            s.executed += w.executed;
+            s.stolen += w.stolen;
+            s.workers.push_back(w);
+            for (int b = 0; b < STATS_HIST_BUCKETS; b++)
+            {
+                s.waitTime.buckets[b] += c.waitHist[b].load(std::memory_order_relaxed);
+                s.execTime.buckets[b] += c.execHist[b].load(std::memory_order_relaxed);
+            }
+        }
+        return s;
+    };
+    //设置任务队列任务上限值(会向上取整为2的幂),每个优先级的队列以及截止时间队列各自使用这个上限
+    void settaskQueMaxSize_(int size)
+    {
+        if (poolState())
+            return;
+        taskQueMaxSize_ = size;
+        for (int i = LANE_HIGH; i <= LANE_BACKGROUND; i++)
+            lanes_[i].que = std::make_unique<MPMCQueue<QueuedTask>>(size);
+    };
+    //设置任务队列满时的处理策略,timeout只对BLOCK_TIMEOUT有效
+    void setQueueFullPolicy(QueueFullPolicy policy,
+        std::chrono::milliseconds timeout = std::chrono::seconds(TASK_SUBMIT_TIMEOUT))
+    {
+        if (poolState())
+            return;
+        queFullPolicy_ = policy;
+        submitTimeout_ = timeout;
+    };
+    //给线程池提交任务
+    //使用可变参模板编程,让submitTask可以接收任意任务函数和任意数量的参数
+    //pool.submitTask(sum1,10,20);
+    //返回值 future<x> 使用decltype来推导类型
+    template<typename Func,typename... Args>
+    auto submitTask(Func&& func,Args&&... args) -> std::future<decltype(func(args...))>
+    {
+        using RType = decltype(func(args...));
+        // promise的共享状态从线程本地内存池分配,任务对象内联保存闭包,小任务提交时不需要堆分配
+        std::promise<RType> promise(std::allocator_arg, PoolAllocator<RType>());
+        std::future<RType> result = promise.get_future();
+        //十分经典的处理！！！因为我们在定义taskQue时并不知道任务函数对象的返回值会是什么所以我们使用了void中间层
+        //在实际传递的时候通过lambda表达式来传递真正要执行的函数对象
+        Task task = makeTask(std::move(promise), std::forward<Func>(func), std::forward<Args>(args)...);
+
+        // 工作窃取模式下,工作线程内部提交的任务直接放入自己的本地队列,不需要竞争任务队列的锁
+        if (PoolMode_ == PoolMode::MODE_WORK_STEALING && curPool_ == this)
+        {
+            workers_[curIndex_]->push(newTask(std::move(task)));
+            wakeSleepers(1);
+            return result;
+        }
+
+        switch (pushTask(task, queFullPolicy_))
+        {
+        case PushResult::PUSHED:
+            break;
+        case PushResult::CALLER_RUN:
+            task();
+            break;
+        case PushResult::REJECTED:
+            return rejectedFuture<RType>();
+        }
+        return result;
+    };
+    //按优先级提交任务,高优先级任务先于普通和后台任务执行
+    //pool.submitTask(TaskPriority::PRIORITY_HIGH, handler, req);
+    template<typename Func,typename... Args>
+    auto submitTask(TaskPriority priority,Func&& func,Args&&... args) -> std::future<decltype(func(args...))>
+    {
+        return submitToLane((int)priority, 0, std::forward<Func>(func), std::forward<Args>(args)...);
+    };
+    //带截止时间提交任务,截止时间队列按最早截止时间优先(EDF)执行,并且优先于所有优先级队列
+    template<typename Func,typename... Args>
+    auto submitTask(std::chrono::steady_clock::time_point deadline,Func&& func,Args&&... args) -> std::future<decltype(func(args...))>
+    {
+        int64_t ticks = std::chrono::duration_cast<std::chrono::nanoseconds>(deadline.time_since_epoch()).count();
+        return submitToLane(LANE_DEADLINE, ticks, std::forward<Func>(func), std::forward<Args>(args)...);
+    };
+    //提交任务并提示希望在哪个NUMA节点执行,任务先由该节点的线程执行,其他节点的线程空闲时也会帮忙执行
+    //节点不存在或线程没有按节点分组时和普通提交一样
+    template<typename Func,typename... Args>
+    auto submitTask(NodeHint hint,Func&& func,Args&&... args) -> std::future<decltype(func(args...))>
+    {
+        int node = nodeIndex(hint.node);
+        int lane = node >= 0 ? LANE_COUNT + node : (int)LANE_NORMAL;
+        return submitToLane(lane, 0, std::forward<Func>(func), std::forward<Args>(args)...);
+    };
+    //各优先级队列的深度和排队时间统计
+    LaneStats laneStats(TaskPriority priority)
+    {
+        return laneStatsOf((int)priority);
+    };
+    LaneStats deadlineLaneStats()
+    {
+        return laneStatsOf(LANE_DEADLINE);
+    };
+    //尝试提交任务,任务队列满时不阻塞也不执行任何满队列策略,直接返回std::nullopt
+    template<typename Func,typename... Args>
+    auto trySubmitTask(Func&& func,Args&&... args) -> std::optional<std::future<decltype(func(args...))>>
+    {
+        using RType = decltype(func(args...));
+        std::promise<RType> promise(std::allocator_arg, PoolAllocator<RType>());
+        std::future<RType> result = promise.get_future();
+        Task task = makeTask(std::move(promise), std::forward<Func>(func), std::forward<Args>(args)...);
+
+        if (PoolMode_ == PoolMode::MODE_WORK_STEALING && curPool_ == this)
+        {
+            workers_[curIndex_]->push(newTask(std::move(task)));
+            wakeSleepers(1);
+            return result;
+        }
+        if (pushTask(task, QueueFullPolicy::REJECT) != PushResult::PUSHED)
+            return std::nullopt;
+        return result;
+    };
+    //批量提交任务: 对[first, last)中的每个元素提交一个func(*it)任务
+    //整批任务尽量用一次队列操作放入,并且只唤醒min(任务数, 空闲线程数)个线程
+    template<typename Func,typename Iter>
+    auto submitBatch(Func&& func,Iter first,Iter last) -> std::vector<std::future<decltype(func(*first))>>
+    {
+        using RType = decltype(func(*first));
+        std::vector<std::future<RType>> results;
+        std::vector<Task> tasks;
+        for (; first != last; ++first)
+        {
+            std::promise<RType> promise(std::allocator_arg, PoolAllocator<RType>());
+            results.push_back(promise.get_future());
+            tasks.push_back(makeTask(std::move(promise), func, *first));
+        }
+        pushBatch(tasks, results);
+        return results;
+    };
+    //批量提交一组无参的可调用对象,返回值与callables一一对应
+    template<typename Range>
+    auto submitBulk(Range&& callables) -> std::vector<std::future<decltype((*std::begin(callables))())>>
+    {
+        using RType = decltype((*std::begin(callables))());
+        std::vector<std::future<RType>> results;
+        std::vector<Task> tasks;
+        for (auto&& func : callables)
+        {
+            std::promise<RType> promise(std::allocator_arg, PoolAllocator<RType>());
+            results.push_back(promise.get_future());
+            // 右值的容器可以把可调用对象移进任务里,左值容器则拷贝
+            if constexpr (std::is_lvalue_reference<Range>::value)
+                tasks.push_back(makeTask(std::move(promise), func));
+            else
+                tasks.push_back(makeTask(std::move(promise), std::move(func)));
+        }
+        pushBatch(tasks, results);
+        return results;
+    };
+    //并行for: 对[begin, end)中的每个下标调用body(i),全部完成后返回
+    //区间被递归二分成任务,空闲线程可以窃取其中一半;工作线程调用时也参与执行而不是阻塞等待,
+    //其他线程调用时执行第一块后睡眠等待
+    //grain是每个任务至少处理的下标数量,为0时根据线程数量自动选择
+    template<typename Index,typename Func>
+    void parallelFor(Index begin,Index end,Index grain,Func&& body)
+    {
+        if (!(begin < end))
+            return;
+        size_t n = (size_t)(end - begin);
+        size_t g = grainSize(n, (size_t)grain);
+        size_t chunks = (n + g - 1) / g;
+        auto leaf = [&](size_t c)
+        {
+            Index b = begin + (Index)(c * g);
+            Index e = c + 1 == chunks ? end : b + (Index)g;
+            for (Index i = b; i < e; ++i)
+                body(i);
+        };
+        forkJoin(chunks, leaf);
+    };
+    template<typename Index,typename Func>
+    void parallelFor(Index begin,Index end,Func&& body)
+    {
+        parallelFor(begin, end, Index(0), std::forward<Func>(body));
+    };
+    //并行归约: func(b, e, identity)计算[b, e)的部分结果,reduce(x, y)按区间顺序合并部分结果
+    template<typename Index,typename T,typename Func,typename Reduce>
+    T parallelReduce(Index begin,Index end,Index grain,T identity,Func&& func,Reduce&& reduce)
+    {
+        if (!(begin < end))
+            return identity;
+        size_t n = (size_t)(end - begin);
+        size_t g = grainSize(n, (size_t)grain);
+        size_t chunks = (n + g - 1) / g;
+        // 每块一个结果,避免vector<bool>之类的按位存储在并发写时出错
+        struct Partial { T value; };
+        std::vector<Partial> partials(chunks, Partial{ identity });
+        auto leaf = [&](size_t c)
+        {
+            Index b = begin + (Index)(c * g);
+            Index e = c + 1 == chunks ? end : b + (Index)g;
+            partials[c].value = func(b, e, identity);
+        };
+        forkJoin(chunks, leaf);
+        T result = identity;
+        for (Partial& p : partials)
+            result = reduce(result, p.value);
+        return result;
+    };
+    //并行transform: *(dFirst + i) = op(*(first + i)),要求随机访问迭代器
+    template<typename InputIt,typename OutputIt,typename UnaryOp>
+    OutputIt parallelTransform(InputIt first,InputIt last,OutputIt dFirst,UnaryOp&& op)
+    {
+        auto n = std::distance(first, last);
+        using Diff = decltype(n);
+        parallelFor(Diff(0), n, Diff(0), [&](Diff i) { dFirst[i] = op(first[i]); });
+        return dFirst + n;
+    };
+    //并行排序: 各段并行std::sort,再逐轮两两并行归并
+    template<typename RandomIt,typename Compare = std::less<>>
+    void parallelSort(RandomIt first,RandomIt last,Compare comp = Compare())
+    {
+        size_t n = (size_t)std::distance(first, last);
+        size_t threads = (size_t)std::max(curThreadSize_.load() + 1, 1);
+        if (n < PARALLEL_SORT_MIN_SIZE || threads == 1)
+        {
+            std::sort(first, last, comp);
+            return;
+        }
+        size_t parts = 1;
+        while (parts < threads * 2 && n / (parts * 2) >= PARALLEL_SORT_MIN_SIZE / 2)
+            parts <<= 1;
+        std::vector<size_t> bounds(parts + 1);
+        for (size_t i = 0; i <= parts; i++)
+            bounds[i] = n * i / parts;
+        auto sortPart = [&](size_t c) { std::sort(first + bounds[c], first + bounds[c + 1], comp); };
+        forkJoin(parts, sortPart);
+        for (size_t width = 1; width < parts; width *= 2)
+        {
+            auto mergePair = [&](size_t m)
+            {
+                size_t lo = bounds[2 * m * width];
+                size_t mid = bounds[(2 * m + 1) * width];
+                size_t hi = bounds[(2 * m + 2) * width];
+                std::inplace_merge(first + lo, first + mid, first + hi, comp);
+            };
+            forkJoin(parts / (2 * width), mergePair);
+        }
+    };
+    //提交会长时间阻塞的任务(文件/网络I/O、sleep等),由单独的阻塞线程执行,不占用计算线程
+    //没有空闲的阻塞线程时创建新线程,最多BLOCKING_THREAD_MAX_SIZE个,排队不受任务队列上限限制
+    template<typename Func,typename... Args>
+    auto submitBlocking(Func&& func,Args&&... args) -> std::future<decltype(func(args...))>
+    {
+        using RType = decltype(func(args...));
+        std::promise<RType> promise(std::allocator_arg, PoolAllocator<RType>());
+        std::future<RType> result = promise.get_future();
+        Task task = makeTask(std::move(promise), std::forward<Func>(func), std::forward<Args>(args)...);
+        if (!pushBlocking(task))
+            return rejectedFuture<RType>();
+        return result;
+    };
+    //按执行器提交任务,EXECUTOR_BLOCKING等同于submitBlocking
+    //pool.submitTask(Executor::EXECUTOR_BLOCKING, readFile, path);
+    template<typename Func,typename... Args>
+    auto submitTask(Executor executor,Func&& func,Args&&... args) -> std::future<decltype(func(args...))>
+    {
+        if (executor == Executor::EXECUTOR_BLOCKING)
+            return submitBlocking(std::forward<Func>(func), std::forward<Args>(args)...);
+        return submitTask(std::forward<Func>(func), std::forward<Args>(args)...);
+    };
+    //设置阻塞执行器的线程数量上限和线程空闲退出的时间
+    void setBlockingConfig(size_t maxThreads,
+        std::chrono::milliseconds idleTime = std::chrono::seconds(BLOCKING_THREAD_IDLE_TIME))
+    {
+        std::unique_lock<std::mutex> lock(blockingMtx_);
+        maxBlockingThreads_ = std::max<size_t>(1, maxThreads);
+        blockingIdleTime_ = idleTime;
+    };
+    //开启任务跟踪,每个工作线程保留最近capacity个任务的入队、出队、开始和结束时间,用writeTrace导出
+    //需要在start之前调用;没有开启时每个任务只多一次分支判断
+    void enableTracing(size_t capacity = TRACE_BUFFER_SIZE)
+    {
+        if (poolState())
+            return;
+        tracing_ = capacity > 0;
+        traceCapacity_ = capacity;
+    };
+    //给当前正在执行的任务设置跟踪标签,作为trace中任务区间的名字,tag需要是字符串常量等静态存储的字符串
+    //没有开启跟踪或不在工作线程中调用时什么也不做
+    static void traceTag(const char* tag)
+    {
+        if (curPool_ != nullptr && curPool_->tracing_)
+            curPool_->slots_[curIndex_]->traceTag = tag;
+    };
+    //把跟踪记录导出为Chrome trace-event格式的JSON,可以用Perfetto或chrome://tracing打开
+    //每个任务是所在工作线程上的一个区间,参数中有排队时间;有入队时间的任务另有一个从入队到出队的异步区间
+    //运行中也可以调用,正在写入的记录会被跳过
+    void writeTrace(std::ostream& out) const
+    {
+        out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+        const char* sep = "\n";
+        char buf[256];
+        unsigned long asyncId = 0;
+        std::vector<TraceBuffer::Record> records;
+        for (size_t i = 0; i < slots_.size(); i++)
+        {
+            if (!slots_[i]->trace)
+                continue;
+            records.clear();
+            slots_[i]->trace->snapshot(records);
+            if (records.empty())
+                continue;
+            snprintf(buf, sizeof(buf),
+                "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%zu,\"args\":{\"name\":\"worker %zu\"}}",
+                sep, i, i);
+            out << buf;
+            sep = ",\n";
+            for (const TraceBuffer::Record& r : records)
+            {
+                out << sep << "{\"name\":";
+                writeJsonString(out, r.tag != nullptr ? r.tag : "task");
+                snprintf(buf, sizeof(buf),
+                    ",\"cat\":\"task\",\"ph\":\"X\",\"pid\":1,\"tid\":%zu,\"ts\":%.3f,\"dur\":%.3f,"
+                    "\"args\":{\"wait_us\":%.3f,\"start_delay_us\":%.3f}}",
+                    i, traceUs(r.start), (r.end - r.start) / 1000.0,
+                    r.enqueue != 0 ? (r.dequeue - r.enqueue) / 1000.0 : 0.0, (r.start - r.dequeue) / 1000.0);
+                out << buf;
+                if (r.enqueue == 0)
+                    continue;
+                asyncId++;
+                snprintf(buf, sizeof(buf),
+                    ",\n{\"name\":\"queued\",\"cat\":\"queue\",\"ph\":\"b\",\"pid\":1,\"tid\":%zu,\"id\":%lu,\"ts\":%.3f}"
+                    ",\n{\"name\":\"queued\",\"cat\":\"queue\",\"ph\":\"e\",\"pid\":1,\"tid\":%zu,\"id\":%lu,\"ts\":%.3f}",
+                    i, asyncId, traceUs(r.enqueue), i, asyncId, traceUs(r.dequeue));
+                out << buf;
+            }
+        }
+        out << "\n]}\n";
+    };
+    //把跟踪记录写入文件,文件打不开时返回false
+    bool writeTrace(const std::string& path) const
+    {
+        std::ofstream out(path);
+        if (!out)
+            return false;
+        writeTrace(out);
+        return (bool)out;
+    };
+    //当前工作线程的arena,在任务中分配临时内存: std::pmr::vector<int> buf(ThreadPool::currentArena());
+    //内存在任务返回后自动回收;不在工作线程中调用时返回默认的memory_resource
+    static std::pmr::memory_resource* currentArena()
+    {
+        if (curPool_ == nullptr)
+            return std::pmr::get_default_resource();
+        return &curPool_->slots_[curIndex_]->arena;
+    };
+    //提交可取消的任务,返回future以及可以取消任务的句柄
+    //func的第一个参数可以是StopToken,用于在执行过程中检查是否请求了停止
+    //auto [future, handle] = pool.submitCancellable([](StopToken st, int n) { while (!st.stopRequested()) ... }, 10);
+    template<typename Func,typename... Args>
+    auto submitCancellable(Func&& func,Args&&... args) -> CancellableFuture<typename CancellableResult<Func, Args...>::type>
+    {
+        return submitCancellableUntil(0, std::forward<Func>(func), std::forward<Args>(args)...);
+    };
+    //提交可取消的任务,排队超过timeout还没有开始执行的任务出队时被丢弃,future得到TaskTimeoutError
+    template<typename Rep,typename Period,typename Func,typename... Args>
+    auto submitWithTimeout(std::chrono::duration<Rep,Period> timeout,Func&& func,Args&&... args)
+        -> CancellableFuture<typename CancellableResult<Func, Args...>::type>
+    {
+        int64_t expireAt = nowTicks() + std::chrono::duration_cast<std::chrono::nanoseconds>(timeout).count();
+        return submitCancellableUntil(expireAt, std::forward<Func>(func), std::forward<Args>(args)...);
+    };
+    //delay之后把任务放入任务队列,到期之前不占用任务队列也不唤醒工作线程,到期的任务按高优先级执行
+    //返回future以及可以在到期前取消任务的句柄,func的第一个参数可以是StopToken
+    //auto [future, handle] = pool.submitAfter(std::chrono::milliseconds(200), retry, req);
+    template<typename Rep,typename Period,typename Func,typename... Args>
+    auto submitAfter(std::chrono::duration<Rep,Period> delay,Func&& func,Args&&... args)
+        -> CancellableFuture<typename CancellableResult<Func, Args...>::type>
+    {
+        int64_t due = nowTicks() + std::chrono::duration_cast<std::chrono::nanoseconds>(delay).count();
+        return submitTimer(due, std::forward<Func>(func), std::forward<Args>(args)...);
+    };
+    //在when时刻把任务放入任务队列,其他时钟的时间点按当前的差值换算到steady_clock
+    template<typename Clock,typename Duration,typename Func,typename... Args>
+    auto submitAt(std::chrono::time_point<Clock,Duration> when,Func&& func,Args&&... args)
+        -> CancellableFuture<typename CancellableResult<Func, Args...>::type>
+    {
+        return submitAfter(when - Clock::now(), std::forward<Func>(func), std::forward<Args>(args)...);
+    };
+    //每隔period执行一次任务,第一次在period之后;上一次执行结束后才安排下一次,错过的周期直接跳过
+    //返回的句柄cancel()后不再触发,正在执行的一次可以通过StopToken得知;func抛出异常时停止
+    template<typename Rep,typename Period,typename Func,typename... Args>
+    CancelHandle submitEvery(std::chrono::duration<Rep,Period> period,Func&& func,Args&&... args)
+    {
+        auto state = std::allocate_shared<PeriodicTaskState>(PoolAllocator<PeriodicTaskState>(), cancelEpoch_);
+        TimerNode* node = newTimer();
+        node->period = std::max<int64_t>(1, std::chrono::duration_cast<std::chrono::nanoseconds>(period).count());
+        node->due = nowTicks() + node->period;
+        node->state = state;
+        node->task = Task([state, func = std::forward<Func>(func), args = std::make_tuple(std::forward<Args>(args)...)]() mutable
+        {
+            if constexpr (CancellableResult<Func, Args...>::takesToken)
+                std::apply([&](auto&... a) { func(StopToken(state), a...); }, args);
+            else
+                std::apply(func, args);
+        });
+        if (!acceptingTasks() || !addTimer(node))
+        {
+            rejected_++;
+            state->abort(std::make_exception_ptr(TaskRejectedError()));
+            deleteTimer(node);
+        }
+        return CancelHandle(state);
+    };
+    //移除所有还在排队的任务(包括阻塞执行器和还没有到期的定时任务),并通过StopToken请求正在执行的可取消任务停止,返回移除的任务数量
+    //被移除的普通任务的future得到broken_promise,可取消任务的future得到TaskCancelledError
+    //移除期间被工作线程取走的可取消任务也不会执行,普通任务则可能执行
+    size_t cancelAll()
+    {
+        cancelEpoch_->fetch_add(1);
+        size_t removed = 0;
+        Task task;
+        int64_t enqueueTime;
+        for (int lane = LANE_HIGH; lane < laneCount(); lane++)
+        {
+            while (tryPopLane(lane, task, enqueueTime))
+            {
+                // 销毁任务时可能调度后续任务(例如then),它们也会在这里被移除
+                task = Task();
+                removed++;
+            }
+        }
+        // 其他线程的本地队列只能从顶部窃取
+        Task* p = nullptr;
+        for (auto& w : workers_)
+        {
+            while (w->steal(p))
+            {
+                deleteTask(p);
+                removed++;
+            }
+        }
+        // 阻塞执行器中排队的任务,在锁外销毁
+        std::deque<Task> blocking;
+        {
+            std::unique_lock<std::mutex> lock(blockingMtx_);
+            blocking.swap(blockingQue_);
+        }
+        removed += blocking.size();
+        // 还没有到期的定时任务
+        removed += clearTimers(false);
+        cancelled_ += (long)removed;
+        notifyNotFull();
+        return removed;
+    };
+    //提交任务,返回支持then/whenAll/whenAny的PoolFuture,后续任务在前驱完成时直接调度到线程池,不阻塞任何线程
+    template<typename Func,typename... Args>
+    auto submitAsync(Func&& func,Args&&... args) -> PoolFuture<decltype(func(args...))>;
+    //在线程池中执行func(Channel<T>& out)逐个产生结果,返回接收结果的通道,结果不需要全部放进一个容器里一起返回
+    //func返回后通道关闭,抛出的异常在接收方取完已有数据后由receive重新抛出;接收方处理不过来时func中的send会等待
+    //auto ch = pool.submitStream<int>([](Channel<int>& out) { for (int i = 0; i < n; i++) out.send(i); });
+    //for (int v : ch) ...
+    template<typename T, typename Func>
+    Channel<T> submitStream(Func&& func, size_t capacity = CHANNEL_DEFAULT_SIZE);
+    //创建一个串行执行器,提交到同一个strand的任务按提交顺序依次执行,不会同时执行
+    //Strand conn = pool.strand(); conn.submit([&] { session.onRead(buf); });
+    Strand strand();
+    //按key串行执行: 同一个key的任务按提交顺序依次执行,不会同时执行,不同key的任务并行执行
+    //key按哈希分配到STRAND_KEYED_COUNT个strand中的一个,分到同一个strand的不同key之间也按提交顺序执行
+    //pool.submitKeyed(accountId, [=] { apply(accountId, delta); });
+    template<typename Key, typename Func, typename... Args>
+    auto submitKeyed(const Key& key, Func&& func, Args&&... args) -> std::future<decltype(func(args...))>
+    {
+        std::call_once(keyedOnce_, [this]() { keyedStrands_ = std::make_unique<StrandQueue[]>(STRAND_KEYED_COUNT); });
+        // std::hash对整数是恒等映射,乘以黄金分割常数后取高位,连续的key也能分散开
+        uint64_t hash = (uint64_t)std::hash<Key>()(key) * 0x9E3779B97F4A7C15ull;
+        StrandQueue* strand = &keyedStrands_[(size_t)(hash >> 32) & (STRAND_KEYED_COUNT - 1)];
+        return submitStrand(strand, nullptr, std::forward<Func>(func), std::forward<Args>(args)...);
+    };
+#ifdef THREADPOOL_COROUTINE
+    //co_await pool.schedule()把当前协程挂起,由线程池的工作线程恢复执行
+    ScheduleAwaiter schedule();
+    //在线程池上启动协程,协程结束时返回的PoolFuture就绪,调用方不需要是协程
+    template<typename T>
+    PoolFuture<T> submitCoroutine(CoTask<T> task);
+#endif
+    //设置cached模式下线程数量上限
+    void setMaxThreadSisze_(size_t count)
+    {
+        if (poolState())
+            return;
+        if (PoolMode_ == PoolMode::MODE_CACHED)
+        {
+            maxThreadSisze_ = count;
+        }
+    };
+    //设置工作线程的CPU绑定,设置后线程按NUMA节点分组,每个节点有自己的任务队列
+    void setAffinity(const AffinityConfig& config)
+    {
+        if (poolState())
+            return;
+        affinity_ = config;
+    };
+    //工作线程分组的NUMA节点数量,没有设置绑定或只有一个节点时为1
+    int nodeCount() const
+    {
+        return std::max<int>(1, (int)nodeQues_.size());
+    };
+    //设置cached模式下线程数量控制器的参数
+    void setElasticConfig(const ElasticConfig& config)
+    {
+        if (poolState())
+            return;
+        elastic_ = config;
+    };
+    
+private:
+    template<typename T>
+    friend class PoolFuture;
+    template<typename T>
+    friend class FutureState;
+    friend class TaskGraph;
+    friend class TaskGroup;
+    friend class Pipeline;
+    friend class Strand;
+    friend class BlockingScope;
+    template<typename T>
+    friend class Channel;
+#ifdef THREADPOOL_COROUTINE
+    friend class ScheduleAwaiter;
+    template<typename T>
+    friend class PoolFutureAwaiter;
+#endif
+    using Task = UniqueFunction<void()>;
+    // 任务队列: 高/普通/后台三个优先级各一条无锁队列,再加一条按截止时间排序的队列
+    enum
+    {
+        LANE_HIGH = (int)TaskPriority::PRIORITY_HIGH,
+        LANE_NORMAL = (int)TaskPriority::PRIORITY_NORMAL,
+        LANE_BACKGROUND = (int)TaskPriority::PRIORITY_BACKGROUND,
+        LANE_DEADLINE,
+        LANE_COUNT,
+    };
+    // 队列中的任务,入队时间不为0的任务出队时统计排队时间,截止时间只用于截止时间队列 单位:纳秒
+    struct QueuedTask
+    {
+        Task task;
+        int64_t enqueueTime = 0;
+        int64_t deadline = 0;
+    };
+    // 一条任务队列以及它的统计计数
+    // 无锁队列的入队/出队数量直接取队列的位置,只有采样的任务才更新排队时间计数,避免每个任务都写共享计数
+    struct TaskLane
+    {
+        std::unique_ptr<MPMCQueue<QueuedTask>> que; // 截止时间队列为空,使用deadlineQue_
+        long submitted = 0;                         // 只用于截止时间队列 由deadlineMtx_保护
+        long dequeued = 0;
+        alignas(CACHE_LINE_SIZE) std::atomic_long aged{0};
+        std::atomic_long sampled{0};
+        std::atomic<int64_t> waitTotal{0};
+        std::atomic<int64_t> waitMax{0};
+    };
+    enum class PushResult
+    {
+        PUSHED,         // 任务已放入任务队列
+        CALLER_RUN,     // 需要由提交线程自己执行
+        REJECTED,       // 任务被拒绝
+    };
+    // 把用户函数和参数包装成void()任务,执行结果或异常写入promise
+    // 参数按值保存,和std::bind一样以左值传给用户函数
+    template<typename RType, typename Func, typename... Args>
+    static Task makeTask(std::promise<RType> promise, Func&& func, Args&&... args)
+    {
+        return Task([promise = std::move(promise),
+                     func = std::forward<Func>(func),
+                     args = std::make_tuple(std::forward<Args>(args)...)]() mutable
+        {
+            try
+            {
+                if constexpr (std::is_void<RType>::value)
+                {
+                    std::apply(func, args);
+                    promise.set_value();
+                }
+                else
+                {
+                    promise.set_value(std::apply(func, args));
+                }
+            }
+            catch (...)
+            {
+                promise.set_exception(std::current_exception());
+            }
+        });
+    };
+    // 可取消任务: 出队时检查是否已经取消或超时,没有执行就被销毁时future得到TaskCancelledError
+    template<typename RType, typename Func, typename... Args>
+    struct CancellableTask
+    {
+        ThreadPool* pool;
+        std::shared_ptr<CancelTaskState<RType>> state;
+        int64_t expireAt;   // 为0表示没有超时时间 单位:纳秒
+        Func func;
+        std::tuple<Args...> args;
+        template<typename F, typename... A>
+        CancellableTask(ThreadPool* p, std::shared_ptr<CancelTaskState<RType>> s, int64_t expire, F&& f, A&&... a)
+            : pool(p)
+            , state(std::move(s))
+            , expireAt(expire)
+            , func(std::forward<F>(f))
+            , args(std::forward<A>(a)...)
+            {}
+        CancellableTask(CancellableTask&&) = default;
+        ~CancellableTask()
+        {
+            if (state)
+                state->abort(std::make_exception_ptr(TaskCancelledError()));
+        }
+        void operator()()
+        {
+            std::shared_ptr<CancelTaskState<RType>> s = std::move(state);
+            if (expireAt != 0 && nowTicks() > expireAt)
+            {
+                if (s->abort(std::make_exception_ptr(TaskTimeoutError())))
+                    pool->cancelled_++;
+                return;
+            }
+            // 提交之后调用过cancelAll的任务即使被工作线程抢先取出也不再执行
+            if (s->stopRequested())
+                s->abort(std::make_exception_ptr(TaskCancelledError()));
+            if (!s->start())
+            {
+                pool->cancelled_++;
+                return;
+            }
+            try
+            {
+                if constexpr (std::is_void<RType>::value)
+                {
+                    invoke(s);
+                    s->promise.set_value();
+                }
+                else
+                {
+                    s->promise.set_value(invoke(s));
+                }
+            }
+            catch (...)
+            {
+                s->promise.set_exception(std::current_exception());
+            }
+        }
+        RType invoke(const std::shared_ptr<CancelTaskState<RType>>& s)
+        {
+            if constexpr (CancellableResult<Func, Args...>::takesToken)
+                return std::apply([&](Args&... a) -> RType { return func(StopToken(s), a...); }, args);
+            else
+                return std::apply(func, args);
+        }
+    };
+    template<typename Func,typename... Args>
+    auto submitCancellableUntil(int64_t expireAt,Func&& func,Args&&... args) -> CancellableFuture<typename CancellableResult<Func, Args...>::type>
+    {
+        using RType = typename CancellableResult<Func, Args...>::type;
+        auto state = std::allocate_shared<CancelTaskState<RType>>(PoolAllocator<CancelTaskState<RType>>(), cancelEpoch_);
+        CancellableFuture<RType> result{ state->promise.get_future(), CancelHandle(state) };
+        Task task(CancellableTask<RType, std::decay_t<Func>, std::decay_t<Args>...>(
+            this, state, expireAt, std::forward<Func>(func), std::forward<Args>(args)...));
+        if (PoolMode_ == PoolMode::MODE_WORK_STEALING && curPool_ == this)
+        {
+            workers_[curIndex_]->push(newTask(std::move(task)));
+            wakeSleepers(1);
+            return result;
+        }
+        switch (pushTask(task, queFullPolicy_))
+        {
+        case PushResult::PUSHED:
+            break;
+        case PushResult::CALLER_RUN:
+            task();
+            break;
+        case PushResult::REJECTED:
+            state->abort(std::make_exception_ptr(TaskRejectedError()));
+            break;
+        }
+        return result;
+    };
+    // 时间轮中的定时任务,due为到期时间,period不为0的是周期任务 单位:纳秒
+    struct TimerNode
+    {
+        TimerNode* next = nullptr;
+        uint64_t expire = 0;    // 到期的tick
+        int64_t due = 0;
+        int64_t period = 0;
+        Task task;              // 一次性任务是CancellableTask,周期任务是用户函数
+        std::shared_ptr<CancelState> state;
+    };
+    // 周期任务的一次执行,没有执行就被销毁时释放定时器
+    struct PeriodicRun
+    {
+        ThreadPool* pool;
+        TimerNode* node;
+        PeriodicRun(ThreadPool* p, TimerNode* n) : pool(p), node(n) {}
+        PeriodicRun(PeriodicRun&& other) noexcept : pool(other.pool), node(other.node) { other.node = nullptr; }
+        ~PeriodicRun()
+        {
+            if (node != nullptr)
+                deleteTimer(node);
+        }
+        void operator()()
+        {
+            TimerNode* n = node;
+            node = nullptr;
+            pool->runPeriodic(n);
+        }
+    };
+    template<typename Func,typename... Args>
+    auto submitTimer(int64_t due,Func&& func,Args&&... args) -> CancellableFuture<typename CancellableResult<Func, Args...>::type>
+    {
+        using RType = typename CancellableResult<Func, Args...>::type;
+        auto state = std::allocate_shared<CancelTaskState<RType>>(PoolAllocator<CancelTaskState<RType>>(), cancelEpoch_);
+        CancellableFuture<RType> result{ state->promise.get_future(), CancelHandle(state) };
+        TimerNode* node = newTimer();
+        node->due = due;
+        node->state = state;
+        node->task = Task(CancellableTask<RType, std::decay_t<Func>, std::decay_t<Args>...>(
+            this, state, 0, std::forward<Func>(func), std::forward<Args>(args)...));
+        if (!acceptingTasks() || !addTimer(node))
+        {
+            rejected_++;
+            state->abort(std::make_exception_ptr(TaskRejectedError()));
+            deleteTimer(node);
+        }
+        return result;
+    };
+    static TimerNode* newTimer()
+    {
+        TimerNode* p = PoolAllocator<TimerNode>().allocate(1);
+        return new (p) TimerNode();
+    };
+    static void deleteTimer(TimerNode* p)
+    {
+        p->~TimerNode();
+        PoolAllocator<TimerNode>().deallocate(p, 1);
+    };
+    // 时间对应的tick,到期时间向上取整、当前时间向下取整,保证不会提前触发
+    uint64_t timerTick(int64_t ns, bool roundUp) const
+    {
+        int64_t offset = ns - timerBase_;
+        if (offset <= 0)
+            return 0;
+        return (uint64_t)((offset + (roundUp ? TIMER_TICK_US * 1000 - 1 : 0)) / (TIMER_TICK_US * 1000));
+    };
+    std::chrono::steady_clock::time_point timerTime(uint64_t tick) const
+    {
+        return std::chrono::steady_clock::time_point(std::chrono::nanoseconds(timerBase_ + (int64_t)tick * TIMER_TICK_US * 1000));
+    };
+    // 放入时间轮,第一次使用时启动定时器线程;比定时器线程等待的时间更早到期时唤醒它
+    bool addTimer(TimerNode* node)
+    {
+        std::unique_lock<std::mutex> lock(timerMtx_);
+        if (timerStop_)
+            return false;
+        node->expire = timerTick(node->due, true);
+        timerWheel_.insert(node);
+        if (!timer_.joinable())
+            timer_ = std::thread(&ThreadPool::timerFunc, this);
+        if (node->expire < timerWakeAt_)
+        {
+            timerWakeAt_ = node->expire;
+            timerCond_.notify_one();
+        }
+        return true;
+    };
+    // 取出并释放所有还没有触发的定时任务,返回数量;stop为true时停止定时器线程
+    size_t clearTimers(bool stop)
+    {
+        TimerNode* list = nullptr;
+        std::vector<Task> overflow;
+        {
+            std::unique_lock<std::mutex> lock(timerMtx_);
+            if (stop)
+                timerStop_ = true;
+            list = timerWheel_.takeAll();
+            overflow.swap(timerOverflow_);
+            timerCond_.notify_all();
+        }
+        if (stop && timer_.joinable() && timer_.get_id() != std::this_thread::get_id())
+            timer_.join();
+        // 一次性任务的future得到TaskCancelledError
+        size_t removed = overflow.size();
+        while (list != nullptr)
+        {
+            TimerNode* node = list;
+            list = node->next;
+            node->state->abort(std::make_exception_ptr(TaskCancelledError()));
+            deleteTimer(node);
+            removed++;
+        }
+        return removed;
+    };
+    // 定时器线程: 睡眠到下一个到期的tick,把到期的任务放入高优先级任务队列
+    void timerFunc()
+    {
+        std::unique_lock<std::mutex> lock(timerMtx_);
+        while (!timerStop_)
+        {
+            uint64_t now = timerTick(nowTicks(), false);
+            TimerNode* expired = timerWheel_.advance(now);
+            if (expired != nullptr || !timerOverflow_.empty())
+            {
+                std::vector<Task> retry;
+                retry.swap(timerOverflow_);
+                // 处理期间放入的定时器不需要唤醒本线程
+                timerWakeAt_ = 0;
+                lock.unlock();
+                fireTimers(expired, retry);
+                lock.lock();
+                for (Task& task : retry)
+                    timerOverflow_.push_back(std::move(task));
+                continue;
+            }
+            // 任务队列满时下一个tick重试
+            uint64_t next = timerWheel_.nextExpire();
+            if (!timerOverflow_.empty())
+                next = std::min(next, now + 1);
+            timerWakeAt_ = next;
+            if (next == TimerWheel<TimerNode>::NONE)
+                timerCond_.wait(lock, [&]() -> bool { return timerStop_ || timerWakeAt_ != next; });
+            else
+                timerCond_.wait_until(lock, timerTime(next), [&]() -> bool { return timerStop_ || timerWakeAt_ != next; });
+        }
+    };
+    // 把到期的定时任务放入任务队列,队列满时留在retry中
+    void fireTimers(TimerNode* list, std::vector<Task>& retry)
+    {
+        std::vector<Task> failed;
+        for (Task& task : retry)
+        {
+            if (!pushTimerTask(task))
+                failed.push_back(std::move(task));
+        }
+        while (list != nullptr)
+        {
+            TimerNode* node = list;
+            list = node->next;
+            // 提交之后调用过cancelAll的定时任务也不再触发
+            if (node->state->stopRequested())
+                node->state->abort(std::make_exception_ptr(TaskCancelledError()));
+            if (node->state->status() == CancelState::CANCELLED)
+            {
+                cancelled_++;
+                deleteTimer(node);
+                continue;
+            }
+            timersFired_++;
+            Task task;
+            if (node->period == 0)
+            {
+                task = std::move(node->task);
+                deleteTimer(node);
+            }
+            else
+            {
+                task = Task(PeriodicRun(this, node));
+            }
+            if (!pushTimerTask(task))
+                failed.push_back(std::move(task));
+        }
+        retry.swap(failed);
+    };
+    bool pushTimerTask(Task& task)
+    {
+        if (!tryPushLane(LANE_HIGH, task, nowTicks()))
+            return false;
+        onTasksPushed(1);
+        return true;
+    };
+    // 执行一次周期任务,然后按原来的相位放回时间轮
+    void runPeriodic(TimerNode* node)
+    {
+        if (node->state->stopRequested())
+            node->state->abort(std::make_exception_ptr(TaskCancelledError()));
+        if (node->state->status() == CancelState::CANCELLED)
+        {
+            cancelled_++;
+            deleteTimer(node);
+            return;
+        }
+        try
+        {
+            node->task();
+        }
+        catch (...)
+        {
+            node->state->abort(std::current_exception());
+            deleteTimer(node);
+            return;
+        }
+        int64_t now = nowTicks();
+        node->due += node->period;
+        if (node->due <= now)
+            node->due += ((now - node->due) / node->period + 1) * node->period;
+        if (!addTimer(node))
+            deleteTimer(node);
+    };
+    // 一次分治计算的共享状态,保存在发起线程的栈上
+    struct ForkJoinContext
+    {
+        WaitCount pending;                  // 还没有结束的区间任务数量
+        std::atomic_bool failed{false};
+        std::exception_ptr error;           // 第一个失败的异常,只由把failed置为true的线程写
+        void setError(std::exception_ptr e)
+        {
+            if (!failed.exchange(true))
+                error = e;
+        }
+    };
+    // 处理[lo, hi)块的任务,如果没有执行就被销毁(例如被DISCARD_OLDEST丢弃)也会结束计数,避免发起线程永远等待
+    template<typename Leaf>
+    struct RangeTask
+    {
+        ThreadPool* pool;
+        ForkJoinContext* ctx;
+        Leaf* leaf;
+        size_t lo;
+        size_t hi;
+        RangeTask(ThreadPool* p, ForkJoinContext* c, Leaf* l, size_t b, size_t e)
+            : pool(p), ctx(c), leaf(l), lo(b), hi(e)
+            {}
+        RangeTask(RangeTask&& other) noexcept
+            : pool(other.pool), ctx(std::exchange(other.ctx, nullptr)), leaf(other.leaf), lo(other.lo), hi(other.hi)
+            {}
+        RangeTask(const RangeTask&) = delete;
+        ~RangeTask()
+        {
+            if (ctx != nullptr)
+            {
+                ctx->setError(std::make_exception_ptr(TaskRejectedError()));
+                ctx->pending.countDown();
+            }
+        }
+        void operator()()
+        {
+            pool->runRange(*std::exchange(ctx, nullptr), *leaf, lo, hi);
+        }
+    };
+    // 对[0, count)块执行leaf(c),调用线程先执行并分裂根区间,然后等待全部完成
+    template<typename Leaf>
+    void forkJoin(size_t count, Leaf& leaf)
+    {
+        if (count == 0)
+            return;
+        ForkJoinContext ctx;
+        ctx.pending.store(1);
+        runRange(ctx, leaf, 0, count);
+        // 工作线程帮忙执行任务;其他线程只执行自己的第一块,之后睡眠等待,不执行线程池中无关的任务
+        if (curPool_ == this)
+            helpWhile([&]() -> bool { return !ctx.pending.done(); });
+        else
+        {
+            while (!ctx.pending.done())
+                ctx.pending.wait(ctx.pending.generation());
+        }
+        if (ctx.error)
+            std::rethrow_exception(ctx.error);
+    };
+    // 不断把右半部分分裂成新任务交给其他线程,自己继续处理左半部分,直到只剩一块
+    template<typename Leaf>
+    void runRange(ForkJoinContext& ctx, Leaf& leaf, size_t lo, size_t hi)
+    {
+        while (hi - lo > 1 && !ctx.failed.load(std::memory_order_relaxed))
+        {
+            size_t mid = lo + (hi - lo) / 2;
+            ctx.pending.add(1);
+            spawnTask(RangeTask<Leaf>(this, &ctx, &leaf, mid, hi));
+            hi = mid;
+        }
+        if (!ctx.failed.load(std::memory_order_relaxed))
+        {
+            try
+            {
+                leaf(lo);
+            }
+            catch (...)
+            {
+                ctx.setError(std::current_exception());
+            }
+        }
+        // 这是最后一次访问ctx,之后发起线程可能已经返回
+        ctx.pending.countDown();
+    };
+    // 放入内部子任务: 工作窃取模式的工作线程放入本地队列,否则放入任务队列,队列满时直接在当前线程执行
+    void spawnTask(Task task)
+    {
+        if (!trySpawnTask(task))
+            task();
+    };
+    // 同spawnTask,队列满时返回false,task留给调用方处理
+    bool trySpawnTask(Task& task)
+    {
+        if (PoolMode_ == PoolMode::MODE_WORK_STEALING && curPool_ == this)
+        {
+            workers_[curIndex_]->push(newTask(std::move(task)));
+            wakeSleepers(1);
+            return true;
+        }
+        if (tryPushLane(LANE_NORMAL, task, sampleTicks()))
+        {
+            onTasksPushed(1);
+            return true;
+        }
+        return false;
+    };
+    // 提交到strand: 任务放入strand自己的队列,strand原来没有任务时才向线程池放入执行任务
+    // keep为空表示strand由线程池持有(submitKeyed),否则执行任务共同持有strand
+    template<typename Func, typename... Args>
+    auto submitStrand(StrandQueue* strand, const std::shared_ptr<StrandQueue>& keep, Func&& func, Args&&... args)
+        -> std::future<decltype(func(args...))>
+    {
+        using RType = decltype(func(args...));
+        if (!acceptingTasks())
+        {
+            rejected_++;
+            return rejectedFuture<RType>();
+        }
+        std::promise<RType> promise(std::allocator_arg, PoolAllocator<RType>());
+        std::future<RType> result = promise.get_future();
+        if (strand->push(makeTask(std::move(promise), std::forward<Func>(func), std::forward<Args>(args)...)))
+            scheduleStrand(strand, keep);
+        return result;
+    };
+    // strand的执行任务,持有strand的执行权;没有执行就被销毁(例如被cancelAll移除)时丢弃strand中的任务,
+    // 它们的future得到broken_promise,之后提交的任务重新调度
+    struct StrandRunner
+    {
+        ThreadPool* pool;
+        StrandQueue* strand;
+        std::shared_ptr<StrandQueue> keep;
+        StrandRunner(ThreadPool* p, StrandQueue* s, std::shared_ptr<StrandQueue> k) : pool(p), strand(s), keep(std::move(k)) {}
+        StrandRunner(StrandRunner&& other) noexcept
+            : pool(other.pool), strand(std::exchange(other.strand, nullptr)), keep(std::move(other.keep)) {}
+        ~StrandRunner()
+        {
+            if (strand != nullptr)
+                strand->discard();
+        }
+        // 交出执行权,之后销毁不再丢弃strand中的任务
+        void release() { strand = nullptr; }
+        void operator()() { pool->runStrand(std::exchange(strand, nullptr), keep); }
+    };
+    void scheduleStrand(StrandQueue* strand, std::shared_ptr<StrandQueue> keep)
+    {
+        spawnTask(StrandRunner(this, strand, std::move(keep)));
+    };
+    // 每次最多连续执行STRAND_BATCH个任务,还有任务时重新排队,让其他任务也有机会执行
+    // 任务队列已满时取回执行权在当前线程继续执行,不递归
+    void runStrand(StrandQueue* strand, std::shared_ptr<StrandQueue>& keep)
+    {
+        for (;;)
+        {
+            size_t n = std::min<size_t>(strand->pending(), STRAND_BATCH);
+            for (size_t i = 0; i < n; i++)
+            {
+                Task task;
+                strand->pop(task);
+                task();
+            }
+            if (!strand->finish(n))
+                return;
+            Task next = StrandRunner(this, strand, keep);
+            if (trySpawnTask(next))
+                return;
+            next.target<StrandRunner>()->release();
+        }
+    };
+    // 等待期间在调用线程上执行排队中的任务,没有任务可做时自旋后让出CPU
+    // 只在本线程池的工作线程中调用,其他线程不应该执行与自己无关的任务
+    template<typename Pred>
+    void helpWhile(Pred&& pred)
+    {
+        int idle = 0;
+        while (pred())
+        {
+            if (runPendingTask())
+                idle = 0;
+            else if (++idle < IDLE_SPIN_MIN)
+                cpuRelax();
+            else
+                std::this_thread::yield();
+        }
+    };
+    // 工作线程取出一个排队中的任务执行
+    bool runPendingTask()
+    {
+        Task task;
+        if (!getTask(curIndex_, task))
+            return false;
+        runTask(*slots_[curIndex_], task);
+        return true;
+    };
+    // 在调用线程上执行任务,工作线程上执行时计入统计并回退arena
+    void runHere(Task& task)
+    {
+        if (curPool_ == this)
+            runTask(*slots_[curIndex_], task);
+        else
+            task();
+    };
+    size_t grainSize(size_t n, size_t grain)
+    {
+        if (grain > 0)
+            return grain;
+        size_t threads = (size_t)std::max(curThreadSize_.load() + 1, 1);
+        return std::max<size_t>(1, n / (threads * PARALLEL_CHUNKS_PER_THREAD));
+    };
+    // 工作窃取队列里保存的任务节点,从内存池分配
+    static Task* newTask(Task&& task)
+    {
+        Task* p = PoolAllocator<Task>().allocate(1);
+        return new (p) Task(std::move(task));
+    };
+    static void deleteTask(Task* p)
+    {
+        p->~Task();
+        PoolAllocator<Task>().deallocate(p, 1);
+    };
+    // 按照满队列策略把任务放入lane对应的任务队列
+    // 只有返回PUSHED时task才会被移走(DISCARD_OLDEST策略下新任务也可能被直接丢弃),CALLER_RUN和REJECTED时由调用方继续处理task
+    PushResult pushTask(Task& task, QueueFullPolicy policy, int lane = LANE_NORMAL, int64_t deadline = 0)
+    {
+        if (!acceptingTasks())
+        {
+            rejected_++;
+            return PushResult::REJECTED;
+        }
+        // 高优先级、后台和截止时间任务每个都记录入队时间,普通优先级和节点任务按采样记录
+        int64_t enqueueTime = lane == LANE_NORMAL || lane >= LANE_COUNT ? sampleTicks() : nowTicks();
+        if (!tryPushLane(lane, task, enqueueTime, deadline))
+        {
+            switch (policy)
+            {
+            case QueueFullPolicy::REJECT:
+                rejected_++;
+                return PushResult::REJECTED;
+            case QueueFullPolicy::CALLER_RUNS:
+                return PushResult::CALLER_RUN;
+            case QueueFullPolicy::DISCARD_OLDEST:
+                // 丢弃的任务析构时会销毁其中的promise,它的future会得到broken_promise异常
+                // 截止时间队列丢弃截止时间最晚、最不紧急的任务,新任务本身截止时间最晚时丢弃新任务
+                if (lane == LANE_DEADLINE)
+                {
+                    if (!pushDeadlineDiscardLatest(task, enqueueTime, deadline))
+                    {
+                        task = nullptr;
+                        discarded_++;
+                        return PushResult::PUSHED;
+                    }
+                    break;
+                }
+                while (!tryPushLane(lane, task, enqueueTime, deadline))
+                {
+                    Task oldest;
+                    int64_t oldestTime;
+                    if (tryPopLane(lane, oldest, oldestTime))
+                        discarded_++;
+                }
+                break;
+            case QueueFullPolicy::BLOCK:
+            case QueueFullPolicy::BLOCK_TIMEOUT:
+            {
+                auto waitUntil = std::chrono::steady_clock::now() + submitTimeout_;
+                std::unique_lock<std::mutex> lock(taskQueMtx_);
+                fullWaiters_++;
+                for (;;)
+                {
+                    // 与notifyNotFull中的fence配对,避免错过消费者的通知
+                    std::atomic_thread_fence(std::memory_order_seq_cst);
+                    if (tryPushLane(lane, task, enqueueTime, deadline))
+                        break;
+                    if (policy == QueueFullPolicy::BLOCK)
+                    {
+                        notFull_.wait(lock);
+                    }
+                    else if (notFull_.wait_until(lock, waitUntil) == std::cv_status::timeout)
+                    {
+                        // 表示等待超时仍然没有空位
+                        if (tryPushLane(lane, task, enqueueTime, deadline))
+                            break;
+                        fullWaiters_--;
+                        rejected_++;
+                        return PushResult::REJECTED;
+                    }
+                }
+                fullWaiters_--;
+                break;
+            }
+            }
+        }
+        onTasksPushed(1, lane >= LANE_COUNT ? lane - LANE_COUNT : -1);
+        return PushResult::PUSHED;
+    };
+    // 把一批任务放入任务队列,被拒绝的任务对应的future替换为带TaskRejectedError的future
+    template<typename RType>
+    void pushBatch(std::vector<Task>& tasks, std::vector<std::future<RType>>& results)
+    {
+        size_t count = tasks.size();
+        if (count == 0)
+            return;
+        if (PoolMode_ == PoolMode::MODE_WORK_STEALING && curPool_ == this)
+        {
+            for (Task& task : tasks)
+                workers_[curIndex_]->push(newTask(std::move(task)));
+            wakeSleepers(count);
+            return;
+        }
+        if (!acceptingTasks())
+        {
+            for (auto& result : results)
+                result = rejectedFuture<RType>();
+            rejected_ += (long)count;
+            return;
+        }
+        std::vector<QueuedTask> items;
+        items.reserve(count);
+        for (Task& task : tasks)
+            items.push_back(QueuedTask{ std::move(task), sampleTicks() });
+        TaskLane& lane = lanes_[LANE_NORMAL];
+        size_t done = 0;
+        size_t queued = 0; // 已经放入队列但还没有通知的任务数量
+        while (done < count)
+        {
+            size_t n = lane.que->tryPushBulk(&items[done], count - done);
+            if (n > 0)
+            {
+                done += n;
+                queued += n;
+                continue;
+            }
+            // 队列满了,先让线程开始处理已经放入的任务,再按满队列策略处理下一个任务
+            if (queued > 0)
+            {
+                onTasksPushed(queued);
+                queued = 0;
+            }
+            switch (pushTask(items[done].task, queFullPolicy_))
+            {
+            case PushResult::PUSHED:
+                break;
+            case PushResult::CALLER_RUN:
+                items[done].task();
+                break;
+            case PushResult::REJECTED:
+                results[done] = rejectedFuture<RType>();
+                break;
+            }
+            done++;
+        }
+        if (queued > 0)
+            onTasksPushed(queued);
+    };
+    // 任务放入任务队列之后: 更新任务数量,唤醒睡眠的线程,cached模式下出现积压时唤醒控制器
+    // node不为-1时优先唤醒该节点的线程
+    void onTasksPushed(size_t count, int node = -1)
+    {
+        // 因为新放了任务，所以任务队列肯定不满 ,因此可以通过notEmpty通知，进行分配执行任务
+        if (node < 0 || !wakeNodeSleeper(node))
+            wakeSleepers(count);
+
+        // 与superviseFunc中的检查配对: 要么控制器看到新增的任务,要么这里看到控制器在睡眠
+        if (superviseIdle_ && hasBacklog())
+        {
+            {
+                std::unique_lock<std::mutex> lock(superviseMtx_);
+                superviseIdle_ = false;
+            }
+            superviseCond_.notify_one();
+        }
+    };
+    // shutdown之后只接受线程池内部提交的任务
+    bool acceptingTasks() const
+    {
+        return !shutdown_.load(std::memory_order_relaxed) || curPool_ == this;
+    };
+    long executedCount() const
+    {
+        long executed = blockingExecuted_;
+        for (auto& slot : slots_)
+            executed += slot->counters.executed.load(std::memory_order_relaxed);
+        return executed;
+    };
+    // join并删除已经退出的线程
+    void reapThreads()
+    {
+        std::vector<std::unique_ptr<Thread>> exited;
+        {
+            std::unique_lock<std::mutex> lock(taskQueMtx_);
+            for (int threadId : exitedThreads_)
+            {
+                auto it = threads_.find(threadId);
+                exited.push_back(std::move(it->second));
+                threads_.erase(it);
+            }
+            exitedThreads_.clear();
+        }
+        for (auto& t : exited)
+            t->join();
+    };
+    // 放入阻塞执行器的任务队列,没有足够的空闲阻塞线程时创建新线程
+    bool pushBlocking(Task& task)
+    {
+        if (!acceptingTasks())
+        {
+            rejected_++;
+            return false;
+        }
+        reapBlocking();
+        Thread* created = nullptr;
+        {
+            std::unique_lock<std::mutex> lock(blockingMtx_);
+            if (blockingStop_)
+            {
+                rejected_++;
+                return false;
+            }
+            blockingQue_.push_back(std::move(task));
+            size_t running = blockingThreads_.size() - blockingExited_.size();
+            if ((size_t)blockingIdle_ < blockingQue_.size() && running < maxBlockingThreads_)
+            {
+                auto ptr = std::make_unique<Thread>(std::bind(&ThreadPool::blockingFunc, this, std::placeholders::_1));
+                created = ptr.get();
+                blockingThreads_.emplace(ptr->getThreadId(), std::move(ptr));
+            }
+        }
+        // 线程对象只会在线程退出后被删除,在锁外启动线程
+        if (created != nullptr)
+            created->start();
+        else
+            blockingCond_.notify_one();
+        return true;
+    };
+    // 阻塞执行器的线程函数,空闲超过blockingIdleTime_或者执行器停止并且没有排队任务时退出
+    void blockingFunc(int threadid)
+    {
+        std::unique_lock<std::mutex> lock(blockingMtx_);
+        for (;;)
+        {
+            if (blockingQue_.empty())
+            {
+                if (blockingStop_)
+                    break;
+                blockingIdle_++;
+                bool woken = blockingCond_.wait_for(lock, blockingIdleTime_,
+                    [&]() -> bool { return !blockingQue_.empty() || blockingStop_; });
+                blockingIdle_--;
+                if (!woken)
+                    break;
+                continue;
+            }
+            {
+                Task task = std::move(blockingQue_.front());
+                blockingQue_.pop_front();
+                lock.unlock();
+                // 任务对象在锁外执行和销毁
+                task();
+            }
+            blockingExecuted_++;
+            lock.lock();
+        }
+        // 线程不能join自己,由下一次提交或shutdown回收
+        blockingExited_.push_back(threadid);
+        blockingExit_.notify_all();
+    };
+    // 停止阻塞执行器,线程执行完排队的任务后退出,wait为true时最多等待timeout
+    void stopBlocking(bool wait, std::chrono::milliseconds timeout)
+    {
+        std::unique_lock<std::mutex> lock(blockingMtx_);
+        blockingStop_ = true;
+        blockingCond_.notify_all();
+        if (!wait)
+            return;
+        auto allExited = [&]()->bool{return blockingExited_.size() == blockingThreads_.size();};
+        if (timeout == std::chrono::milliseconds::max())
+            blockingExit_.wait(lock, allExited);
+        else
+            blockingExit_.wait_for(lock, timeout, allExited);
+    };
+    // join并删除已经退出的阻塞线程
+    void reapBlocking()
+    {
+        std::vector<std::unique_ptr<Thread>> exited;
+        {
+            std::unique_lock<std::mutex> lock(blockingMtx_);
+            for (int threadId : blockingExited_)
+            {
+                auto it = blockingThreads_.find(threadId);
+                exited.push_back(std::move(it->second));
+                blockingThreads_.erase(it);
+            }
+            blockingExited_.clear();
+        }
+        for (auto& t : exited)
+            t->join();
+    };
+    // 工作线程进入阻塞区域: 阻塞的线程不计入有效线程数量,有效线程少于初始数量时增加一个补偿线程
+    // 返回是否进行了补偿,嵌套的阻塞区域只在最外层计数
+    bool enterBlocking()
+    {
+        WorkerSlot& self = *slots_[curIndex_];
+        if (self.blockingDepth++ > 0)
+            return false;
+        int blocked = ++blockedCount_;
+        if (growThreads(1, (int)initThreadSize_ + blocked) == 0)
+            return false;
+        compensations_++;
+        return true;
+    };
+    // 离开阻塞区域,补偿过的线程由下一个空闲的线程退出
+    void leaveBlocking(bool compensated)
+    {
+        WorkerSlot& self = *slots_[curIndex_];
+        if (--self.blockingDepth > 0)
+            return;
+        blockedCount_--;
+        if (!compensated)
+            return;
+        {
+            std::unique_lock<std::mutex> lock(taskQueMtx_);
+            retireCount_++;
+        }
+        wakeSleepers(1);
+    };
+    // 任务数量多于空闲线程数量,并且线程数量未达到上限
+    // 只在cached模式的控制器睡眠时由提交路径调用,排队数量和忙碌线程数量都是读取时汇总
+    bool hasBacklog()
+    {
+        if (curThreadSize_ >= (int)maxThreadSisze_)
+            return false;
+        long queued = 0;
+        for (int i = LANE_HIGH; i < laneCount(); i++)
+            queued += (long)laneDepth(i);
+        return queued > curThreadSize_ - busyThreads();
+    };
+    // 正在执行任务的工作线程数量,由各线程的running标志汇总
+    int busyThreads() const
+    {
+        int busy = 0;
+        for (auto& slot : slots_)
+            busy += slot->counters.running.load(std::memory_order_relaxed) ? 1 : 0;
+        return busy;
+    };
+    template<typename RType>
+    static std::future<RType> rejectedFuture()
+    {
+        std::promise<RType> promise;
+        promise.set_exception(std::make_exception_ptr(TaskRejectedError()));
+        return promise.get_future();
+    };
+    // 从任务队列取出一个任务: 先取截止时间最早的任务,再依次取高/普通/后台优先级的任务
+    // 每TASK_AGING_INTERVAL次反过来从后台队列开始取,保证低优先级任务也能持续执行
+    bool popTask(Task& task)
+    {
+        static thread_local unsigned popCount = 0;
+        int64_t enqueueTime = 0;
+        int lane = -1;
+        if (++popCount % TASK_AGING_INTERVAL == 0)
+        {
+            for (int i = LANE_BACKGROUND; i >= LANE_HIGH && lane < 0; i--)
+            {
+                if (tryPopLane(i, task, enqueueTime))
+                    lane = i;
+            }
+            if (lane < 0 && tryPopLane(LANE_DEADLINE, task, enqueueTime))
+                lane = LANE_DEADLINE;
+            else if (lane > LANE_HIGH && higherLaneBusy(lane))
+                lanes_[lane].aged.fetch_add(1, std::memory_order_relaxed);
+        }
+        else
+        {
+            if (tryPopLane(LANE_DEADLINE, task, enqueueTime))
+                lane = LANE_DEADLINE;
+            for (int i = LANE_HIGH; i <= LANE_BACKGROUND && lane < 0; i++)
+            {
+                if (tryPopLane(i, task, enqueueTime))
+                    lane = i;
+            }
+        }
+        if (lane < 0)
+            return false;
+        if (enqueueTime != 0)
+        {
+            int64_t wait = recordWait(lanes_[lane], enqueueTime);
+            if (curPool_ == this)
+            {
+                addSample(slots_[curIndex_]->counters.waitHist, wait);
+                if (tracing_)
+                    stampTrace(*slots_[curIndex_], enqueueTime, enqueueTime + wait);
+            }
+        }
+        notifyNotFull();
+        return true;
+    };
+    static int64_t nowTicks()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    };
+    // 每TASK_WAIT_SAMPLE个任务返回一次当前时间,其余返回0表示不采样;开启跟踪时每个任务都记录
+    int64_t sampleTicks() const
+    {
+        static thread_local unsigned sampleCount = 0;
+        return tracing_ || ++sampleCount % TASK_WAIT_SAMPLE == 0 ? nowTicks() : 0;
+    };
+    // 放入指定的任务队列,队列满时返回false,此时task不会被移走
+    // 任务直接在队列槽位上构造,入队和出队都只移动一次任务对象
+    bool tryPushLane(int lane, Task& task, int64_t enqueueTime, int64_t deadline = 0)
+    {
+        if (lane >= LANE_COUNT)
+            return nodeQues_[lane - LANE_COUNT]->tryEmplace(std::move(task), enqueueTime);
+        if (lane != LANE_DEADLINE)
+        {
+            if (!lanes_[lane].que->tryEmplace(std::move(task), enqueueTime))
+                return false;
+        }
+        else
+        {
+            std::unique_lock<std::mutex> lock(deadlineMtx_);
+            if (deadlineQue_.size() >= (size_t)taskQueMaxSize_)
+                return false;
+            deadlineQue_.push_back(QueuedTask{ std::move(task), enqueueTime, deadline });
+            std::push_heap(deadlineQue_.begin(), deadlineQue_.end(), laterDeadline);
+            deadlineSize_.store(deadlineQue_.size(), std::memory_order_relaxed);
+            lanes_[LANE_DEADLINE].submitted++;
+        }
+        return true;
+    };
+    bool tryPopLane(int lane, Task& task, int64_t& enqueueTime)
+    {
+        if (lane != LANE_DEADLINE)
+        {
+            MPMCQueue<QueuedTask>& que = lane >= LANE_COUNT ? *nodeQues_[lane - LANE_COUNT] : *lanes_[lane].que;
+            return que.tryConsume([&](QueuedTask& item)
+            {
+                task = std::move(item.task);
+                enqueueTime = item.enqueueTime;
+            });
+        }
+        if (deadlineSize_.load(std::memory_order_relaxed) == 0)
+            return false;
+        std::unique_lock<std::mutex> lock(deadlineMtx_);
+        if (deadlineQue_.empty())
+            return false;
+        std::pop_heap(deadlineQue_.begin(), deadlineQue_.end(), laterDeadline);
+        task = std::move(deadlineQue_.back().task);
+        enqueueTime = deadlineQue_.back().enqueueTime;
+        deadlineQue_.pop_back();
+        deadlineSize_.store(deadlineQue_.size(), std::memory_order_relaxed);
+        lanes_[LANE_DEADLINE].dequeued++;
+        return true;
+    };
+    // 截止时间队列已满时用新任务替换截止时间最晚的任务,返回false表示新任务的截止时间不早于队列中所有任务,没有放入
+    bool pushDeadlineDiscardLatest(Task& task, int64_t enqueueTime, int64_t deadline)
+    {
+        Task victim;
+        {
+            std::unique_lock<std::mutex> lock(deadlineMtx_);
+            if (deadlineQue_.size() < (size_t)taskQueMaxSize_)
+            {
+                deadlineQue_.push_back(QueuedTask{ std::move(task), enqueueTime, deadline });
+                std::push_heap(deadlineQue_.begin(), deadlineQue_.end(), laterDeadline);
+                deadlineSize_.store(deadlineQue_.size(), std::memory_order_relaxed);
+                lanes_[LANE_DEADLINE].submitted++;
+                return true;
+            }
+            if (deadlineQue_.empty())
+                return false;
+            // 小顶堆中截止时间最晚的任务在后一半(叶子节点)中
+            size_t latest = deadlineQue_.size() / 2;
+            for (size_t i = latest + 1; i < deadlineQue_.size(); i++)
+            {
+                if (deadlineQue_[i].deadline > deadlineQue_[latest].deadline)
+                    latest = i;
+            }
+            if (deadline >= deadlineQue_[latest].deadline)
+                return false;
+            victim = std::move(deadlineQue_[latest].task);
+            deadlineQue_[latest] = QueuedTask{ std::move(task), enqueueTime, deadline };
+            // 堆的前缀仍然是堆,截止时间变早只需要向上调整
+            std::push_heap(deadlineQue_.begin(), deadlineQue_.begin() + latest + 1, laterDeadline);
+            lanes_[LANE_DEADLINE].submitted++;
+            lanes_[LANE_DEADLINE].dequeued++;
+        }
+        // 被替换的任务在锁外析构
+        discarded_++;
+        return true;
+    };
+    // 截止时间队列是按截止时间排列的小顶堆
+    static bool laterDeadline(const QueuedTask& a, const QueuedTask& b)
+    {
+        return a.deadline > b.deadline;
+    };
+    size_t laneDepth(int lane) const
+    {
+        if (lane >= LANE_COUNT)
+            return nodeQues_[lane - LANE_COUNT]->size();
+        if (lane == LANE_DEADLINE)
+            return deadlineSize_.load(std::memory_order_relaxed);
+        return lanes_[lane].que->size();
+    };
+    // 比lane优先级更高的队列中是否还有任务
+    bool higherLaneBusy(int lane) const
+    {
+        if (laneDepth(LANE_DEADLINE) > 0)
+            return true;
+        for (int i = LANE_HIGH; i < lane; i++)
+        {
+            if (laneDepth(i) > 0)
+                return true;
+        }
+        return false;
+    };
+    bool hasQueuedTask() const
+    {
+        return !lanes_[LANE_NORMAL].que->empty() || higherLaneBusy(LANE_NORMAL) || !lanes_[LANE_BACKGROUND].que->empty()
+            || hasNodeTask();
+    };
+    // 优先级队列、截止时间队列以及各节点队列的数量,节点队列的下标从LANE_COUNT开始
+    int laneCount() const
+    {
+        return LANE_COUNT + (int)nodeQues_.size();
+    };
+    bool hasNodeTask() const
+    {
+        for (auto& que : nodeQues_)
+        {
+            if (!que->empty())
+                return true;
+        }
+        return false;
+    };
+    // 从节点队列取任务,节点任务按普通优先级处理,只采样排队时间直方图
+    bool popNodeTask(int node, Task& task)
+    {
+        int64_t enqueueTime = 0;
+        if (!tryPopLane(LANE_COUNT + node, task, enqueueTime))
+            return false;
+        if (enqueueTime != 0 && curPool_ == this)
+        {
+            int64_t now = nowTicks();
+            addSample(slots_[curIndex_]->counters.waitHist, now - enqueueTime);
+            if (tracing_)
+                stampTrace(*slots_[curIndex_], enqueueTime, now);
+        }
+        notifyNotFull();
+        return true;
+    };
+    // 本节点没有任务时帮其他节点执行,node为-1表示调用线程不属于任何节点
+    bool popRemoteNodeTask(int node, Task& task)
+    {
+        for (int i = 0; i < (int)nodeQues_.size(); i++)
+        {
+            if (i != node && !nodeQues_[i]->empty() && popNodeTask(i, task))
+                return true;
+        }
+        return false;
+    };
+    // 把工作线程按NUMA节点分组,记录每个槽位绑定的CPU,只在start中调用
+    void placeWorkers()
+    {
+        if (affinity_.policy == AffinityPolicy::AFFINITY_NONE)
+            return;
+        nodes_ = CpuTopology::detect();
+        int nodeCount = (int)nodes_.size();
+        for (int i = 0; i < (int)slots_.size(); i++)
+        {
+            WorkerSlot& slot = *slots_[i];
+            if (affinity_.policy == AffinityPolicy::AFFINITY_CUSTOM)
+            {
+                if (affinity_.cpuSets.empty())
+                    break;
+                slot.cpus = affinity_.cpuSets[i % affinity_.cpuSets.size()];
+                // 按第一个CPU所在的节点分组
+                slot.node = 0;
+                for (int n = 0; n < nodeCount && !slot.cpus.empty(); n++)
+                {
+                    const std::vector<int>& cpus = nodes_[n].cpus;
+                    if (std::find(cpus.begin(), cpus.end(), slot.cpus[0]) != cpus.end())
+                        slot.node = n;
+                }
+                continue;
+            }
+            // 线程轮流分配到各节点,使每个节点的线程数量相差不超过1
+            slot.node = i % nodeCount;
+            const std::vector<int>& cpus = nodes_[slot.node].cpus;
+            if (affinity_.policy == AffinityPolicy::AFFINITY_CORE)
+                slot.cpus = { cpus[(i / nodeCount) % cpus.size()] };
+            else
+                slot.cpus = cpus;
+        }
+        // 只有一个节点时不需要节点队列
+        if (nodeCount > 1)
+        {
+            for (int n = 0; n < nodeCount; n++)
+                nodeQues_.emplace_back(std::make_unique<MPMCQueue<QueuedTask>>(taskQueMaxSize_));
+        }
+    };
+    // NUMA节点编号对应的节点队列下标,没有对应的节点队列时返回-1
+    int nodeIndex(int id) const
+    {
+        for (int n = 0; n < (int)nodeQues_.size(); n++)
+        {
+            if (nodes_[n].id == id)
+                return n;
+        }
+        return -1;
+    };
+    static int64_t recordWait(TaskLane& lane, int64_t enqueueTime)
+    {
+        int64_t wait = nowTicks() - enqueueTime;
+        lane.sampled.fetch_add(1, std::memory_order_relaxed);
+        lane.waitTotal.fetch_add(wait, std::memory_order_relaxed);
+        int64_t max = lane.waitMax.load(std::memory_order_relaxed);
+        while (wait > max && !lane.waitMax.compare_exchange_weak(max, wait, std::memory_order_relaxed))
+            ;
+        return wait;
+    };
+    LaneStats laneStatsOf(int lane)
+    {
+        TaskLane& l = lanes_[lane];
+        LaneStats stats;
+        stats.depth = laneDepth(lane);
+        if (lane == LANE_DEADLINE)
+        {
+            std::unique_lock<std::mutex> lock(deadlineMtx_);
+            stats.submitted = l.submitted;
+            stats.dequeued = l.dequeued;
+        }
+        else
+        {
+            stats.submitted = (long)l.que->pushedCount();
+            stats.dequeued = (long)l.que->poppedCount();
+        }
+        stats.aged = l.aged.load(std::memory_order_relaxed);
+        stats.sampled = l.sampled.load(std::memory_order_relaxed);
+        stats.avgWaitUs = stats.sampled > 0 ? l.waitTotal.load(std::memory_order_relaxed) / 1000.0 / stats.sampled : 0;
+        stats.maxWaitUs = l.waitMax.load(std::memory_order_relaxed) / 1000.0;
+        return stats;
+    };
+    // 按优先级或截止时间提交,任务总是放入对应的任务队列,不放入工作线程的本地队列
+    template<typename Func,typename... Args>
+    auto submitToLane(int lane,int64_t deadline,Func&& func,Args&&... args) -> std::future<decltype(func(args...))>
+    {
+        using RType = decltype(func(args...));
+        std::promise<RType> promise(std::allocator_arg, PoolAllocator<RType>());
+        std::future<RType> result = promise.get_future();
+        Task task = makeTask(std::move(promise), std::forward<Func>(func), std::forward<Args>(args)...);
+        switch (pushTask(task, queFullPolicy_, lane, deadline))
+        {
+        case PushResult::PUSHED:
+            break;
+        case PushResult::CALLER_RUN:
+            task();
+            break;
+        case PushResult::REJECTED:
+            return rejectedFuture<RType>();
+        }
+        return result;
+    };
+    // 取出任务之后,如果有提交线程在等待空位则通知它们
+    void notifyNotFull()
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (fullWaiters_.load(std::memory_order_relaxed) > 0)
+        {
+            std::unique_lock<std::mutex> lock(taskQueMtx_);
+            notFull_.notify_all();
+        }
+    };
+    // 工作线程的统计计数,只有占用槽位的线程写入,stats()随时读取
+    // 单写者不需要原子的读改写,用relaxed的load+store更新,热路径上没有lock前缀指令和缓存行竞争
+    struct WorkerCounters
+    {
+        std::atomic_long executed{0};
+        std::atomic_long stolen{0};
+        std::atomic<int64_t> busyNs{0};
+        std::atomic<int64_t> idleNs{0};
+        std::atomic<int64_t> busySince{0};  // 当前忙碌时间段的开始时间,0表示不在忙碌
+        std::atomic<int64_t> idleSince{0};  // 当前睡眠时间段的开始时间,0表示不在睡眠
+        std::atomic_bool running{false};    // 正在执行任务,代替每个任务都要修改的全局空闲线程计数
+        std::atomic_long parks{0};
+        std::atomic_long spuriousWakeups{0};
+        unsigned sampleCount = 0;
+        std::atomic_long waitHist[STATS_HIST_BUCKETS] = {};
+        std::atomic_long execHist[STATS_HIST_BUCKETS] = {};
+    };
+    // 工作线程的私有状态,独占缓存行
+    // 统计计数和Parker分开放,其他线程唤醒本线程时不会和计数更新互相干扰
+    struct alignas(CACHE_LINE_SIZE) WorkerSlot
+    {
+        Parker parker;
+        std::atomic_bool idle{false};       // 已登记为空闲线程,正在或准备睡眠
+        std::atomic_bool inStack{false};    // 槽位下标是否在空闲栈中
+        int spinLimit = IDLE_SPIN_MIN;      // 自适应的自旋次数,只有本线程访问
+        int node = 0;                       // 所属NUMA节点在nodes_中的下标,启动后不再修改
+        std::vector<int> cpus;              // 绑定的CPU,为空表示不绑定
+        TaskArena arena;                    // 任务使用的arena,只有本线程访问
+        int blockingDepth = 0;              // 嵌套的阻塞区域层数,只有本线程访问
+        int64_t traceEnqueue = 0;           // 下一个要执行的任务的入队和出队时间,开启跟踪时由取任务的函数填写
+        int64_t traceDequeue = 0;
+        const char* traceTag = nullptr;     // 正在执行的任务设置的跟踪标签
+        std::unique_ptr<TraceBuffer> trace; // 开启跟踪时的任务记录
+        alignas(CACHE_LINE_SIZE) WorkerCounters counters;
+    };
+    template<typename T>
+    static void bump(std::atomic<T>& counter, T n = 1)
+    {
+        counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    };
+    static void addSample(std::atomic_long* hist, int64_t ns)
+    {
+        int bucket = 0;
+        while (bucket < STATS_HIST_BUCKETS - 1 && (ns >> (bucket + 1)) > 0)
+            bucket++;
+        bump(hist[bucket], 1L);
+    };
+    // 在工作线程上执行任务并更新本线程的计数,每TASK_WAIT_SAMPLE个任务采样一次执行时间
+    void runTask(WorkerSlot& self, Task& task)
+    {
+        WorkerCounters& counters = self.counters;
+        // 任务结束后回退arena,嵌套执行的任务只回退自己的分配
+        TaskArena::Mark mark = self.arena.mark();
+        if (tracing_)
+        {
+            runTraced(self, task);
+        }
+        else if (++counters.sampleCount % TASK_WAIT_SAMPLE == 0)
+        {
+            int64_t begin = nowTicks();
+            task();
+            addSample(counters.execHist, nowTicks() - begin);
+        }
+        else
+        {
+            task();
+        }
+        if (self.arena.usedSince(mark))
+            self.arena.rewind(mark);
+        bump(counters.executed, 1L);
+    };
+    // 开启跟踪时执行任务,记录入队、出队、开始和结束时间以及任务设置的标签
+    // 任务中嵌套执行其他任务时各自记录,外层任务的标签在嵌套任务结束后恢复
+    void runTraced(WorkerSlot& self, Task& task)
+    {
+        int64_t enqueue = self.traceEnqueue;
+        int64_t dequeue = self.traceDequeue;
+        self.traceEnqueue = 0;
+        self.traceDequeue = 0;
+        const char* outerTag = self.traceTag;
+        self.traceTag = nullptr;
+        int64_t begin = nowTicks();
+        task();
+        int64_t end = nowTicks();
+        addSample(self.counters.execHist, end - begin);
+        self.trace->record(TraceBuffer::Record{ enqueue, enqueue != 0 ? dequeue : begin, begin, end, self.traceTag });
+        self.traceTag = outerTag;
+    };
+    static void stampTrace(WorkerSlot& self, int64_t enqueue, int64_t dequeue)
+    {
+        self.traceEnqueue = enqueue;
+        self.traceDequeue = dequeue;
+    };
+    double traceUs(int64_t ticks) const
+    {
+        return (ticks - traceBase_) / 1000.0;
+    };
+    static void writeJsonString(std::ostream& out, const char* s)
+    {
+        out << '"';
+        for (; *s != '\0'; s++)
+        {
+            unsigned char c = (unsigned char)*s;
+            if (c == '"' || c == '\\')
+                out << '\\' << (char)c;
+            else if (c < 0x20)
+            {
+                char buf[8];
+                snprintf(buf, sizeof(buf), "\\u%04x", c);
+                out << buf;
+            }
+            else
+                out << (char)c;
+        }
+        out << '"';
+    };
+    enum class ParkResult
+    {
+        HAS_TASK,   // 登记空闲后发现有任务,没有睡眠
+        WOKEN,      // 被唤醒
+    };
+    // slot是线程占用的槽位下标,工作窃取模式下也是本地队列在workers_中的下标
+    void threadFunc(int threadid, int slot)
+    {
+        curPool_ = this;
+        curIndex_ = slot;
+        WorkerSlot& self = *slots_[slot];
+        if (!self.cpus.empty())
+            CpuTopology::pinCurrentThread(self.cpus);
+        WorkerCounters& counters = self.counters;
+        counters.busySince.store(nowTicks(), std::memory_order_relaxed);
+        bool woken = false;
+        for (;;)
+        {
+            Task task;
+            // 取任务不需要加锁,取不到时先自旋一会儿再睡眠
+            if (getTask(slot, task) || spinForTask(self, slot, task))
+            {
+                woken = false;
+                counters.running.store(true, std::memory_order_relaxed);
+                // 当前线程负责执行任务
+                runTask(self, task);//执行function<void()>
+                counters.running.store(false, std::memory_order_relaxed);
+                continue;
+            }
+            // cached模式下控制器要求回收线程,由没有任务的线程退出
+            if (retireCount_.load(std::memory_order_relaxed) > 0 && tryRetire())
+            {
+                exitThread(threadid, slot);
+                return;
+            }
+            if (woken)
+            {
+                bump(counters.spuriousWakeups, 1L);
+                woken = false;
+            }
+            // 线程池已经析构并且没有剩余任务,线程退出
+            if (!isRuning_)
+            {
+                exitThread(threadid, slot);
+                return;
+            }
+
+            // 只在睡眠前后读取时间,忙碌时间和睡眠时间的统计不增加执行任务的开销
+            int64_t parkBegin = nowTicks();
+            bump(counters.busyNs, parkBegin - counters.busySince.load(std::memory_order_relaxed));
+            counters.busySince.store(0, std::memory_order_relaxed);
+            counters.idleSince.store(parkBegin, std::memory_order_relaxed);
+            ParkResult parked = parkWorker(self, slot);
+            int64_t parkEnd = nowTicks();
+            bump(counters.idleNs, parkEnd - parkBegin);
+            counters.idleSince.store(0, std::memory_order_relaxed);
+            counters.busySince.store(parkEnd, std::memory_order_relaxed);
+            woken = parked == ParkResult::WOKEN;
+        }
+    };
+    // 领取一个回收名额,不在阻塞区域中的线程数量不会低于初始线程数量
+    bool tryRetire()
+    {
+        std::unique_lock<std::mutex> lock(taskQueMtx_);
+        if (retireCount_ == 0 || !isRuning_)
+            return false;
+        // 回收后线程不够用时放弃这些名额
+        if (curThreadSize_ - blockedCount_ <= (int)initThreadSize_)
+        {
+            retireCount_ = 0;
+            return false;
+        }
+        // 回收线程--记录线程数量相关的变量修改,线程对象在exitThread中从线程列表中删除
+        retireCount_--;
+        curThreadSize_--;
+        return true;
+    };
+    // cached模式的线程数量控制器
+    // 每个周期测量任务的排队时间和线程利用率,连续过载时增加线程,连续空闲时回收线程
+    // 线程数量为初始值并且没有积压时睡眠,直到onTasksPushed发现积压
+    void superviseFunc()
+    {
+        int overTicks = 0;
+        int underTicks = 0;
+        bool reset = true;
+        int64_t lastTime = 0;
+        int64_t lastBusy = 0;
+        long lastExecuted = 0;
+        long lastSampled = 0;
+        int64_t lastWaitTotal = 0;
+        for (;;)
+        {
+            {
+                std::unique_lock<std::mutex> lock(superviseMtx_);
+                if (curThreadSize_ <= (int)initThreadSize_ && overTicks == 0)
+                {
+                    superviseIdle_ = true;
+                    if (!hasBacklog())
+                    {
+                        retireCount_ = 0;
+                        superviseCond_.wait(lock, [&]() -> bool { return !superviseIdle_ || !isRuning_; });
+                        reset = true;
+                    }
+                    superviseIdle_ = false;
+                }
+                // 刚开始测量时先记录一次起点
+                if (!reset)
+                    superviseCond_.wait_for(lock, elastic_.interval, [&]() -> bool { return !isRuning_; });
+                if (!isRuning_)
+                    return;
+            }
+            reapThreads();
+            // 周期内的增量: 工作线程的忙碌时间和执行任务数量,各任务队列采样的排队时间
+            int64_t now = nowTicks();
+            int64_t busy = 0;
+            long executed = 0;
+            for (auto& slot : slots_)
+            {
+                const WorkerCounters& c = slot->counters;
+                busy += c.busyNs.load(std::memory_order_relaxed);
+                int64_t busySince = c.busySince.load(std::memory_order_relaxed);
+                if (busySince != 0)
+                    busy += std::max<int64_t>(0, now - busySince);
+                executed += c.executed.load(std::memory_order_relaxed);
+            }
+            long sampled = 0;
+            int64_t waitTotal = 0;
+            size_t depth = 0;
+            for (int i = LANE_HIGH; i < LANE_COUNT; i++)
+            {
+                sampled += lanes_[i].sampled.load(std::memory_order_relaxed);
+                waitTotal += lanes_[i].waitTotal.load(std::memory_order_relaxed);
+            }
+            for (int i = LANE_HIGH; i < laneCount(); i++)
+                depth += laneDepth(i);
+            if (reset)
+            {
+                reset = false;
+                lastTime = now;
+                lastBusy = busy;
+                lastExecuted = executed;
+                lastSampled = sampled;
+                lastWaitTotal = waitTotal;
+                continue;
+            }
+            int64_t elapsed = std::max<int64_t>(1, now - lastTime);
+            // 采样的排队时间只反映已经出队的任务,再用Little定律按队列长度/出队速率估计还在排队的任务
+            double waitNs = sampled > lastSampled ? (double)(waitTotal - lastWaitTotal) / (sampled - lastSampled) : 0;
+            if (depth > 0)
+                waitNs = std::max(waitNs, (double)depth * elapsed / std::max<long>(1, executed - lastExecuted));
+            double util = (double)(busy - lastBusy) / elapsed / std::max(1, curThreadSize_.load());
+            lastTime = now;
+            lastBusy = busy;
+            lastExecuted = executed;
+            lastSampled = sampled;
+            lastWaitTotal = waitTotal;
+            {
+                std::unique_lock<std::mutex> lock(superviseMtx_);
+                queueWaitUs_ = waitNs / 1000;
+                utilization_ = std::min(util, 1.0);
+            }
+
+            // 提交线程在等待队列空位也算过载
+            bool overloaded = (depth > 0 && waitNs > elastic_.growWait.count() * 1000.0) || fullWaiters_ > 0;
+            if (overloaded && curThreadSize_ < (int)maxThreadSisze_)
+            {
+                underTicks = 0;
+                if (++overTicks >= elastic_.growTicks)
+                {
+                    overTicks = 0;
+                    growThreads(elastic_.growStep, (int)maxThreadSisze_);
+                }
+            }
+            else if (depth == 0 && util < elastic_.shrinkUtil && curThreadSize_ > (int)initThreadSize_)
+            {
+                overTicks = 0;
+                if (++underTicks >= elastic_.shrinkTicks)
+                {
+                    underTicks = 0;
+                    // 唤醒一个睡眠的线程让它退出,没有睡眠的线程时由下一个空闲的线程退出
+                    retireCount_++;
+                    wakeSleepers(1);
+                }
+            }
+            else
+            {
+                overTicks = 0;
+                underTicks = 0;
+            }
+        }
+    };
+    // 最多增加count个线程,线程数量不超过limit,返回增加的数量(包括取消回收的名额)
+    // 由控制器线程和进入阻塞区域的工作线程调用
+    int growThreads(int count, int limit)
+    {
+        reapThreads();
+        std::vector<Thread*> created;
+        int grown = 0;
+        {
+            std::unique_lock<std::mutex> lock(taskQueMtx_);
+            // 还有等待回收的名额时先取消回收
+            while (count > 0 && retireCount_ > 0)
+            {
+                retireCount_--;
+                count--;
+                grown++;
+            }
+            while (count > 0 && isRuning_ && curThreadSize_ < limit && !freeSlots_.empty())
+            {
+                std::cout << ">>> create new thread..." << std::endl;
+                int slot = freeSlots_.back();
+                freeSlots_.pop_back();
+                // c++11 提供make_shared c++14 提供make_unique
+                auto ptr = std::make_unique<Thread>(std::bind(&ThreadPool::threadFunc, this, std::placeholders::_1, slot));
+                created.push_back(ptr.get());
+                int threadId= ptr->getThreadId();
+                threads_.emplace(threadId,std::move(ptr));
+                curThreadSize_++;
+                threadsCreated_++;
+                count--;
+                grown++;
+            }
+        }
+        // 线程对象只会在线程退出后被删除,在锁外启动线程
+        for (Thread* t : created)
+            t->start();
+        return grown;
+    };
+    bool getTask(int slot, Task& task)
+    {
+        if (PoolMode_ == PoolMode::MODE_WORK_STEALING)
+            return takeTask(slot, task);
+        int node = nodeQues_.empty() ? -1 : slots_[slot]->node;
+        return (node >= 0 && popNodeTask(node, task)) || popTask(task) || popRemoteNodeTask(node, task);
+    };
+    bool hasTask()
+    {
+        return hasQueuedTask()
+            || (PoolMode_ == PoolMode::MODE_WORK_STEALING && hasStealableTask());
+    };
+    // 睡眠前的自适应自旋: 自旋期间拿到任务就加倍下次的自旋次数,否则减半
+    bool spinForTask(WorkerSlot& self, int slot, Task& task)
+    {
+        for (int i = 0; i < self.spinLimit; i++)
+        {
+            cpuRelax();
+            if (hasTask() && getTask(slot, task))
+            {
+                self.spinLimit = std::min(self.spinLimit * 2, IDLE_SPIN_MAX);
+                return true;
+            }
+        }
+        self.spinLimit = std::max(self.spinLimit / 2, IDLE_SPIN_MIN);
+        return false;
+    };
+    // 登记为空闲线程并睡眠,直到被提交任务的线程或控制器定向唤醒
+    ParkResult parkWorker(WorkerSlot& self, int slot)
+    {
+        self.idle.store(true);
+        idleCount_++;
+        if (!self.inStack.exchange(true))
+            idleStack_->push(slot);
+        // 与wakeSleepers中的fence配对,保证要么提交方看到我们在空闲栈中,要么这里看到新放入的任务
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (hasTask() || !isRuning_)
+        {
+            if (cancelIdle(self))
+                return ParkResult::HAS_TASK;
+            // 提交线程已经选中了我们,消耗掉它发出的唤醒
+            self.parker.park();
+            return ParkResult::HAS_TASK;
+        }
+        bump(self.counters.parks, 1L);
+        self.parker.park();
+        return ParkResult::WOKEN;
+    };
+    // 把线程从空闲状态改回忙碌状态,返回false表示已经被提交线程选中并即将唤醒
+    bool cancelIdle(WorkerSlot& self)
+    {
+        bool expected = true;
+        if (!self.idle.compare_exchange_strong(expected, false))
+            return false;
+        idleCount_--;
+        return true;
+    };
+    void exitThread(int threadid, int slot)
+    {
+        slots_[slot]->arena.release();
+        WorkerCounters& counters = slots_[slot]->counters;
+        bump(counters.busyNs, nowTicks() - counters.busySince.load(std::memory_order_relaxed));
+        counters.busySince.store(0, std::memory_order_relaxed);
+        threadsDestroyed_++;
+        // 线程不能join自己,线程对象由控制器或shutdown回收
+        std::unique_lock<std::mutex> lock(taskQueMtx_);
+        exitedThreads_.push_back(threadid);
+        freeSlots_.push_back(slot);
+        recycle_.notify_all();
+    };
+    // 依次从本地队列、本节点队列、注入队列、随机的其他线程、其他节点队列获取任务
+    bool takeTask(int index, Task& task)
+    {
+        Task* p = nullptr;
+        if (workers_[index]->pop(p))
+        {
+            task = std::move(*p);
+            deleteTask(p);
+            return true;
+        }
+        int node = nodeQues_.empty() ? -1 : slots_[index]->node;
+        if (node >= 0 && popNodeTask(node, task))
+            return true;
+        if (popTask(task))
+            return true;
+        return stealTask(index, task) || popRemoteNodeTask(node, task);
+    };
+    // 从其他线程的本地队列窃取一个任务,index为-1表示调用线程不是工作线程
+    bool stealTask(int index, Task& task)
+    {
+        Task* p = nullptr;
+        int n = (int)workers_.size();
+        if (n == 0)
+            return false;
+        // 从随机位置开始遍历其他线程,避免所有空闲线程都去窃取同一个victim
+        // 线程按节点分组时先窃取同一节点的线程,再跨节点窃取
+        int start = (int)(nextRandom() % (uint32_t)n);
+        int node = index >= 0 && !nodeQues_.empty() ? slots_[index]->node : -1;
+        for (int pass = 0; pass < (node >= 0 ? 2 : 1); pass++)
+        {
+            for (int k = 0; k < n; k++)
+            {
+                int victim = (start + k) % n;
+                if (victim == index)
+                    continue;
+                if (node >= 0 && (slots_[victim]->node == node) != (pass == 0))
+                    continue;
+                if (workers_[victim]->steal(p))
+                {
+                    task = std::move(*p);
+                    deleteTask(p);
+                    if (index >= 0)
+                        bump(slots_[index]->counters.stolen, 1L);
+                    return true;
+                }
+            }
+        }
+        return false;
+    };
+    bool hasStealableTask()
+    {
+        for (auto& w : workers_)
+        {
+            if (!w->empty())
+                return true;
+        }
+        return false;
+    };
+    // 放入count个任务之后,从空闲栈中定向唤醒min(count, 空闲线程数)个线程
+    void wakeSleepers(size_t count)
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        size_t woken = 0;
+        while (woken < count && idleCount_.load(std::memory_order_relaxed) > 0)
+        {
+            int index = idleStack_->pop();
+            if (index < 0)
+                break;
+            WorkerSlot& slot = *slots_[index];
+            slot.inStack.store(false);
+            // 栈中可能有已经回到忙碌状态的线程,跳过它们
+            if (cancelIdle(slot))
+            {
+                slot.parker.unpark();
+                unparks_++;
+                woken++;
+            }
+        }
+    };
+    // 唤醒一个属于node的睡眠线程,没有时返回false
+    bool wakeNodeSleeper(int node)
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (idleCount_.load(std::memory_order_relaxed) == 0)
+            return false;
+        for (auto& slot : slots_)
+        {
+            // 不从空闲栈中删除,wakeSleepers遇到已经唤醒的线程会跳过
+            if (slot->node == node && cancelIdle(*slot))
+            {
+                slot->parker.unpark();
+                unparks_++;
+                return true;
+            }
+        }
+        return false;
+    };
+    static uint32_t nextRandom()
+    {
+        // xorshift32, 每个线程一份状态
+        static thread_local uint32_t state = (uint32_t)std::hash<std::thread::id>()(std::this_thread::get_id()) | 1u;
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return state;
+    };
+    bool poolState()
+    {
+         return isRuning_;
+    };
+    // 成员按访问方式分组,每组从新的缓存行开始,避免伪共享:
+    // 每个任务都会修改的计数放在各工作线程的WorkerSlot中,读取时汇总;下面的全局变量只在慢路径上修改
+
+    // 启动后只读或很少修改,每次提交/取任务都要读取
+    alignas(CACHE_LINE_SIZE) PoolMode PoolMode_;   //当前线程池的工作模式
+    std::atomic_bool isRuning_;
+    std::atomic_bool shutdown_{false};  //调用过shutdown,不再接受外部提交的任务
+    std::atomic_bool superviseIdle_{false};          //控制器正在等待出现积压
+    size_t initThreadSize_; //初始的线程数量
+    size_t maxThreadSisze_; //线程池线程数量上限
+    int taskQueMaxSize_; //任务队列最大上限
+    QueueFullPolicy queFullPolicy_;             //任务队列满时的处理策略
+    std::chrono::milliseconds submitTimeout_;   //BLOCK_TIMEOUT策略的等待时间
+    std::unique_ptr<StrandQueue[]> keyedStrands_;    //submitKeyed使用的strand,第一次调用时创建,在各任务队列之后销毁
+    std::once_flag keyedOnce_;
+    std::vector<std::unique_ptr<WorkStealingDeque<Task*>>> workers_; //工作窃取模式下每个线程的本地队列
+    std::vector<std::unique_ptr<WorkerSlot>> slots_; //每个线程的私有状态,按槽位下标访问
+    std::vector<std::unique_ptr<MPMCQueue<QueuedTask>>> nodeQues_; //各节点的任务队列,只有一个节点时为空
+    std::unique_ptr<IdleStack> idleStack_;           //空闲线程栈
+    AffinityConfig affinity_;                        //工作线程的CPU绑定方式
+    std::vector<NumaNode> nodes_;                    //线程分组使用的NUMA节点
+    std::shared_ptr<std::atomic_ulong> cancelEpoch_ = std::make_shared<std::atomic_ulong>(0); //cancelAll的调用次数,与可取消任务共享
+    ElasticConfig elastic_;                          //cached模式线程数量控制器的参数
+    int64_t timerBase_ = nowTicks();                 //定时器tick 0对应的时间 单位:纳秒
+    bool tracing_ = false;                           //是否开启任务跟踪
+    size_t traceCapacity_ = 0;                       //每个工作线程保留的跟踪记录数量
+    int64_t traceBase_ = 0;                          //跟踪时间的起点,导出时时间戳相对于它 单位:纳秒
+
+    TaskLane lanes_[LANE_COUNT];            //各优先级的任务队列(无锁有界队列)和截止时间队列的统计,各自对齐到缓存行
+
+    // 截止时间队列
+    alignas(CACHE_LINE_SIZE) std::atomic<size_t> deadlineSize_{0};    //截止时间队列中的任务数量,不加锁判断是否为空
+    std::mutex deadlineMtx_;
+    std::vector<QueuedTask> deadlineQue_;   //截止时间队列 由deadlineMtx_保护
+
+    // 线程睡眠/唤醒: 线程睡眠时修改,提交任务时读取
+    alignas(CACHE_LINE_SIZE) std::atomic_int idleCount_;                      //已登记为空闲的线程数量
+    std::atomic_long unparks_;
+
+    // 线程的创建/退出以及队列满时等待的提交线程,每次取任务时读取fullWaiters_
+    alignas(CACHE_LINE_SIZE) std::atomic_int fullWaiters_;               //正在等待队列空位的提交线程数量
+    std::atomic_int curThreadSize_;//记录当前线程池中线程总数量
+    std::atomic_int retireCount_{0};                 //等待回收的线程数量 由taskQueMtx_保护修改
+    std::atomic_int blockedCount_{0};                //处于阻塞区域中的工作线程数量
+    std::mutex taskQueMtx_;     //只保护threads_以及线程的睡眠/唤醒,不再保护任务队列
+    std::condition_variable notFull_;   //表示任务队列不满
+    std::condition_variable recycle_;   //线程池析构回收子线程资源
+    //std::vector<std::unique_ptr<Thread>> threads_; 线程数组
+    std::unordered_map<int,std::unique_ptr<Thread>>threads_;
+    std::vector<int> exitedThreads_;    //已经退出等待join的线程id 由taskQueMtx_保护
+    std::vector<int> freeSlots_;                     //cached模式下可用于新线程的槽位 由taskQueMtx_保护
+
+    // 只在拒绝、丢弃、取消以及线程数量变化时修改的统计计数
+    alignas(CACHE_LINE_SIZE) std::atomic_long rejected_{0};
+    std::atomic_long discarded_{0};
+    std::atomic_long cancelled_{0};
+    std::atomic_long threadsCreated_{0};
+    std::atomic_long threadsDestroyed_{0};
+    std::atomic_long compensations_{0};
+    std::atomic_long timersFired_{0};
+
+    // cached模式的线程数量控制器
+    alignas(CACHE_LINE_SIZE) std::mutex superviseMtx_;
+    std::condition_variable superviseCond_;
+    std::thread supervisor_;                         //cached模式的线程数量控制器
+    double queueWaitUs_ = 0;                         //控制器最近一次的测量结果 由superviseMtx_保护
+    double utilization_ = 0;
+
+    // 阻塞执行器
+    alignas(CACHE_LINE_SIZE) std::mutex blockingMtx_;
+    std::condition_variable blockingCond_;           //阻塞执行器有新任务或停止
+    std::condition_variable blockingExit_;           //阻塞线程退出
+    std::deque<Task> blockingQue_;                   //阻塞执行器的任务队列 由blockingMtx_保护
+    std::unordered_map<int,std::unique_ptr<Thread>> blockingThreads_; //阻塞执行器的线程 由blockingMtx_保护
+    std::vector<int> blockingExited_;                //已经退出等待join的阻塞线程id 由blockingMtx_保护
+    int blockingIdle_ = 0;                           //等待任务的阻塞线程数量 由blockingMtx_保护
+    bool blockingStop_ = false;                      //阻塞执行器已停止 由blockingMtx_保护
+    size_t maxBlockingThreads_ = BLOCKING_THREAD_MAX_SIZE;
+    std::chrono::milliseconds blockingIdleTime_{std::chrono::seconds(BLOCKING_THREAD_IDLE_TIME)};
+    std::atomic_long blockingExecuted_{0};
+
+    // 定时器
+    alignas(CACHE_LINE_SIZE) std::mutex timerMtx_;
+    std::condition_variable timerCond_;
+    std::thread timer_;                              //定时器线程,第一次提交定时任务时启动
+    TimerWheel<TimerNode> timerWheel_;               //定时任务 由timerMtx_保护
+    std::vector<Task> timerOverflow_;                //到期时任务队列已满,等待重试的任务 由timerMtx_保护
+    uint64_t timerWakeAt_ = 0;                       //定时器线程等待到的tick,为0表示没有在等待 由timerMtx_保护
+    bool timerStop_ = false;                         //由timerMtx_保护
+
+    static thread_local ThreadPool* curPool_; //当前线程所属的线程池
+    static thread_local int curIndex_;        //当前线程在workers_中的下标
+};
+
+thread_local ThreadPool* ThreadPool::curPool_ = nullptr;
+thread_local int ThreadPool::curIndex_ = -1;
+
+// 标记工作线程中会长时间阻塞的代码段,阻塞期间线程池增加一个临时线程代替当前线程执行任务,
+// 离开后由一个空闲线程退出;不在工作线程中使用时不做任何事
+// { BlockingScope scope; data = readFile(path); }
+class BlockingScope
+{
+public:
+    BlockingScope()
+    : pool_(ThreadPool::curPool_)
+    , compensated_(pool_ != nullptr && pool_->enterBlocking())
+    {}
+    ~BlockingScope()
+    {
+        if (pool_ != nullptr)
+            pool_->leaveBlocking(compensated_);
+    }
+    BlockingScope(const BlockingScope&) = delete;
+    BlockingScope& operator=(const BlockingScope&) = delete;
+private:
+    ThreadPool* pool_;
+    bool compensated_;
+};
+
+///////////////////////   PoolFuture   ///////////////////////////////
+
+// PoolFuture<void>内部保存的占位值
+struct VoidValue {};
+
+// PoolFuture的共享状态: 结果或异常,以及就绪时要执行的回调
+template<typename T>
+class FutureState : public std::enable_shared_from_this<FutureState<T>>
+{
+public:
+    using Value = std::conditional_t<std::is_void<T>::value, VoidValue, T>;
+    using Callback = UniqueFunction<void(FutureState&)>;
+
+    explicit FutureState(ThreadPool* pool)
+        : pool_(pool)
+        , ready_(false)
+        {}
+    template<typename... V>
+    void setValue(V&&... v)
+    {
+        {
+            std::unique_lock<std::mutex> lock(mtx_);
+            if (ready_)
+                return;
+            value_.emplace(std::forward<V>(v)...);
+            ready_.store(true, std::memory_order_release);
+        }
+        finish();
+    }
+    void setError(std::exception_ptr e)
+    {
+        {
+            std::unique_lock<std::mutex> lock(mtx_);
+            if (ready_)
+                return;
+            error_ = e;
+            ready_.store(true, std::memory_order_release);
+        }
+        finish();
+    }
+    bool isReady() const { return ready_.load(std::memory_order_acquire); }
+    // 线程池的线程等待时帮忙执行其他任务,避免固定线程数的线程池死锁;其他线程阻塞等待
+    void wait()
+    {
+        if (isReady())
+            return;
+        if (pool_ != nullptr && ThreadPool::curPool_ == pool_)
+        {
+            pool_->helpWhile([&]() -> bool { return !isReady(); });
+            return;
+        }
+        std::unique_lock<std::mutex> lock(mtx_);
+        cond_.wait(lock, [&]() -> bool { return ready_.load(std::memory_order_relaxed); });
+    }
+    // 就绪后调用,取走结果或者抛出异常
+    Value take()
+    {
+        if (error_)
+            std::rethrow_exception(error_);
+        return std::move(*value_);
+    }
+    std::exception_ptr error() const { return error_; }
+    // 就绪时在完成它的线程上调用cb,已经就绪则立即在当前线程调用
+    void onReady(Callback cb)
+    {
+        {
+            std::unique_lock<std::mutex> lock(mtx_);
+            if (!ready_)
+            {
+                callbacks_.push_back(std::move(cb));
+                return;
+            }
+        }
+        cb(*this);
+    }
+    ThreadPool* pool() const { return pool_; }
+private:
+    void finish()
+    {
+        std::vector<Callback> callbacks;
+        {
+            std::unique_lock<std::mutex> lock(mtx_);
+            callbacks.swap(callbacks_);
+        }
+        cond_.notify_all();
+        for (Callback& cb : callbacks)
+            cb(*this);
+    }
+    ThreadPool* pool_;
+    std::mutex mtx_;
+    std::condition_variable cond_;
+    std::atomic_bool ready_;
+    std::optional<Value> value_;
+    std::exception_ptr error_;
+    std::vector<Callback> callbacks_;
+};
+
+template<typename T>
+using FutureStatePtr = std::shared_ptr<FutureState<T>>;
+
+template<typename T>
+FutureStatePtr<T> makeFutureState(ThreadPool* pool)
+{
+    return std::allocate_shared<FutureState<T>>(PoolAllocator<FutureState<T>>(), pool);
+}
+
+// 执行func并把结果写入state,如果任务没有执行就被销毁,state得到broken_promise异常
+template<typename T, typename Func>
+class AsyncTask
+{
+public:
+    AsyncTask(FutureStatePtr<T> state, Func func)
+        : state_(std::move(state))
+        , func_(std::move(func))
+        {}
+    AsyncTask(AsyncTask&&) = default;
+    ~AsyncTask()
+    {
+        if (state_)
+            state_->setError(std::make_exception_ptr(std::future_error(std::future_errc::broken_promise)));
+    }
+    void operator()()
+    {
+        FutureStatePtr<T> state = std::move(state_);
+        try
+        {
+            if constexpr (std::is_void<T>::value)
+            {
+                func_();
+                state->setValue();
+            }
+            else
+            {
+                state->setValue(func_());
+            }
+        }
+        catch (...)
+        {
+            state->setError(std::current_exception());
+        }
+    }
+private:
+    FutureStatePtr<T> state_;
+    Func func_;
+};
+template<typename T, typename Func>
+AsyncTask<T, std::decay_t<Func>> makeAsyncTask(FutureStatePtr<T> state, Func&& func)
+{
+    return AsyncTask<T, std::decay_t<Func>>(std::move(state), std::forward<Func>(func));
+}
+
+// 线程池感知的future,只能移动
+// then注册的后续任务在结果就绪时直接调度到线程池;get在线程池线程上调用时会帮忙执行其他任务
+template<typename T>
+class PoolFuture
+{
+public:
+    PoolFuture() = default;
+    explicit PoolFuture(FutureStatePtr<T> state)
+        : state_(std::move(state))
+        {}
+    PoolFuture(PoolFuture&&) = default;
+    PoolFuture& operator=(PoolFuture&&) = default;
+    PoolFuture(const PoolFuture&) = delete;
+    PoolFuture& operator=(const PoolFuture&) = delete;
+
+    bool valid() const { return state_ != nullptr; }
+    bool isReady() const { return state_ && state_->isReady(); }
+    void wait() const { state_->wait(); }
+    // 等待并取走结果,之后future不再有效
+    T get()
+    {
+        FutureStatePtr<T> state = std::move(state_);
+        state->wait();
+        if constexpr (std::is_void<T>::value)
+            state->take();
+        else
+            return state->take();
+    }
+    // 结果就绪后把func(value)作为新任务调度到线程池,返回func结果的future
+    // 前驱失败时不调用func,异常直接传递给返回的future;调用后本future不再有效
+    template<typename Func>
+    auto then(Func&& func)
+    {
+        using U = typename ThenResult<Func>::type;
+        FutureStatePtr<T> state = std::move(state_);
+        ThreadPool* pool = state->pool();
+        FutureStatePtr<U> next = makeFutureState<U>(pool);
+        state->onReady([next, func = std::forward<Func>(func)](FutureState<T>& prev) mutable
+        {
+            auto task = makeAsyncTask(std::move(next),
+                [prev = prev.shared_from_this(), func = std::move(func)]() mutable -> U
+                {
+                    if constexpr (std::is_void<T>::value)
+                    {
+                        prev->take();
+                        return func();
+                    }
+                    else
+                    {
+                        return func(prev->take());
+                    }
+                });
+            if (prev.pool() != nullptr)
+                prev.pool()->spawnTask(std::move(task));
+            else
+                task();
+        });
+        return PoolFuture<U>(std::move(next));
+    }
+private:
+    template<typename Func, bool = std::is_void<T>::value>
+    struct ThenResult { using type = std::invoke_result_t<Func>; };
+    template<typename Func>
+    struct ThenResult<Func, false> { using type = std::invoke_result_t<Func, T>; };
+
+    template<typename U>
+    friend class PoolFuture;
+    template<typename U>
+    friend FutureState<U>* futureStateOf(PoolFuture<U>& f);
+
+    FutureStatePtr<T> state_;
+};
+
+template<typename T>
+FutureState<T>* futureStateOf(PoolFuture<T>& f)
+{
+    return f.state_.get();
+}
+
+template<typename T>
+auto makeReadyFuture(T&& value)
+{
+    auto state = makeFutureState<std::decay_t<T>>(nullptr);
+    state->setValue(std::forward<T>(value));
+    return PoolFuture<std::decay_t<T>>(std::move(state));
+}
+
+// 所有future都就绪后就绪,结果是已经就绪的future集合(包括失败的)
+template<typename T>
+PoolFuture<std::vector<PoolFuture<T>>> whenAll(std::vector<PoolFuture<T>> futures)
+{
+    using Result = std::vector<PoolFuture<T>>;
+    ThreadPool* pool = futures.empty() ? nullptr : futureStateOf(futures[0])->pool();
+    FutureStatePtr<Result> out = makeFutureState<Result>(pool);
+    if (futures.empty())
+    {
+        out->setValue(std::move(futures));
+        return PoolFuture<Result>(std::move(out));
+    }
+    struct Context
+    {
+        Result futures;
+        std::atomic<size_t> remaining;
+        FutureStatePtr<Result> out;
+    };
+    // 先取出状态指针再注册回调,最后一个回调会移走ctx->futures
+    std::vector<FutureState<T>*> states;
+    for (PoolFuture<T>& f : futures)
+        states.push_back(futureStateOf(f));
+    auto ctx = std::allocate_shared<Context>(PoolAllocator<Context>());
+    ctx->remaining.store(futures.size());
+    ctx->futures = std::move(futures);
+    ctx->out = out;
+    for (FutureState<T>* s : states)
+    {
+        s->onReady([ctx](FutureState<T>&)
+        {
+            if (ctx->remaining.fetch_sub(1) == 1)
+                ctx->out->setValue(std::move(ctx->futures));
+        });
+    }
+    return PoolFuture<Result>(std::move(out));
+}
+
+template<typename... Ts>
+PoolFuture<std::tuple<PoolFuture<Ts>...>> whenAll(PoolFuture<Ts>&&... futures)
+{
+    using Result = std::tuple<PoolFuture<Ts>...>;
+    struct Context
+    {
+        Result futures;
+        std::atomic<size_t> remaining;
+        FutureStatePtr<Result> out;
+    };
+    ThreadPool* pool = nullptr;
+    ((pool = pool != nullptr ? pool : futureStateOf(futures)->pool()), ...);
+    FutureStatePtr<Result> out = makeFutureState<Result>(pool);
+    auto states = std::make_tuple(futureStateOf(futures)...);
+    auto ctx = std::allocate_shared<Context>(PoolAllocator<Context>());
+    ctx->remaining.store(sizeof...(Ts));
+    ctx->futures = Result(std::move(futures)...);
+    ctx->out = out;
+    std::apply([&](auto*... s)
+    {
+        (s->onReady([ctx](auto&)
+        {
+            if (ctx->remaining.fetch_sub(1) == 1)
+                ctx->out->setValue(std::move(ctx->futures));
+        }), ...);
+    }, states);
+    return PoolFuture<Result>(std::move(out));
+}
+
+// whenAny的结果: 第一个就绪的future的下标以及全部future
+template<typename Sequence>
+struct WhenAnyResult
+{
+    size_t index;
+    Sequence futures;
+};
+
+// 任意一个future就绪后就绪
+template<typename T>
+PoolFuture<WhenAnyResult<std::vector<PoolFuture<T>>>> whenAny(std::vector<PoolFuture<T>> futures)
+{
+    using Result = WhenAnyResult<std::vector<PoolFuture<T>>>;
+    ThreadPool* pool = futures.empty() ? nullptr : futureStateOf(futures[0])->pool();
+    FutureStatePtr<Result> out = makeFutureState<Result>(pool);
+    if (futures.empty())
+    {
+        out->setValue(Result{ (size_t)-1, std::move(futures) });
+        return PoolFuture<Result>(std::move(out));
+    }
+    struct Context
+    {
+        std::vector<PoolFuture<T>> futures;
+        std::atomic_bool fired{false};
+        FutureStatePtr<Result> out;
+    };
+    std::vector<FutureState<T>*> states;
+    for (PoolFuture<T>& f : futures)
+        states.push_back(futureStateOf(f));
+    auto ctx = std::allocate_shared<Context>(PoolAllocator<Context>());
+    ctx->futures = std::move(futures);
+    ctx->out = out;
+    for (size_t i = 0; i < states.size(); i++)
+    {
+        states[i]->onReady([ctx, i](FutureState<T>&)
+        {
+            if (!ctx->fired.exchange(true))
+                ctx->out->setValue(Result{ i, std::move(ctx->futures) });
+        });
+    }
+    return PoolFuture<Result>(std::move(out));
+}
+
+template<typename Func,typename... Args>
+auto ThreadPool::submitAsync(Func&& func,Args&&... args) -> PoolFuture<decltype(func(args...))>
+{
+    using RType = decltype(func(args...));
+    FutureStatePtr<RType> state = makeFutureState<RType>(this);
+    PoolFuture<RType> result(state);
+    Task task = makeAsyncTask(std::move(state),
+        [func = std::forward<Func>(func), args = std::make_tuple(std::forward<Args>(args)...)]() mutable -> RType
+        {
+            return std::apply(func, args);
+        });
+    if (PoolMode_ == PoolMode::MODE_WORK_STEALING && curPool_ == this)
+    {
+        workers_[curIndex_]->push(newTask(std::move(task)));
+        wakeSleepers(1);
+        return result;
+    }
+    switch (pushTask(task, queFullPolicy_))
+    {
+    case PushResult::PUSHED:
+        break;
+    case PushResult::CALLER_RUN:
+        task();
+        break;
+    case PushResult::REJECTED:
+        futureStateOf(result)->setError(std::make_exception_ptr(TaskRejectedError()));
+        break;
+    }
+    return result;
+}
+
+///////////////////////   TaskGraph   ///////////////////////////////
+
+// 任务依赖图: a.precede(b)表示b在a完成之后执行
+// run()把所有没有前驱的节点调度到线程池,每个节点完成时调度前驱都已完成的后继,整个过程没有线程阻塞
+// 图中不能有环;运行期间不能修改图,图对象必须活到run返回的future就绪
+class TaskGraph
+{
+    struct NodeData;
+public:
+    class Node
+    {
+    public:
+        Node() : node_(nullptr) {}
+        // 本节点在other之前执行
+        Node& precede(Node other)
+        {
+            node_->successors.push_back(other.node_);
+            other.node_->predecessors++;
+            return *this;
+        }
+        // 本节点在other之后执行
+        Node& succeed(Node other)
+        {
+            other.precede(*this);
+            return *this;
+        }
+    private:
+        friend class TaskGraph;
+        explicit Node(NodeData* node) : node_(node) {}
+        NodeData* node_;
+    };
+
+    explicit TaskGraph(ThreadPool& pool)
+        : pool_(pool)
+        , unfinished_(0)
+        , failed_(false)
+        {}
+    TaskGraph(const TaskGraph&) = delete;
+    TaskGraph& operator=(const TaskGraph&) = delete;
+
+    template<typename Func>
+    Node emplace(Func&& func)
+    {
+        nodes_.push_back(std::make_unique<NodeData>());
+        nodes_.back()->func = std::forward<Func>(func);
+        return Node(nodes_.back().get());
+    }
+    // 执行整个图,所有节点完成后返回的future就绪;某个节点抛出异常后其余节点不再执行,future得到该异常
+    PoolFuture<void> run()
+    {
+        done_ = makeFutureState<void>(&pool_);
+        PoolFuture<void> result(done_);
+        if (nodes_.empty())
+        {
+            done_->setValue();
+            return result;
+        }
+        failed_ = false;
+        error_ = nullptr;
+        unfinished_.store(nodes_.size());
+        for (auto& n : nodes_)
+            n->remaining.store(n->predecessors);
+        for (auto& n : nodes_)
+        {
+            if (n->predecessors == 0)
+                schedule(n.get());
+        }
+        return result;
+    }
+private:
+    struct NodeData
+    {
+        UniqueFunction<void()> func;
+        std::vector<NodeData*> successors;
+        int predecessors = 0;
+        std::atomic_int remaining{0};
+    };
+    // 节点任务,如果没有执行就被销毁则按失败处理,保证图能结束
+    struct NodeTask
+    {
+        TaskGraph* graph;
+        NodeData* node;
+        NodeTask(TaskGraph* g, NodeData* n) : graph(g), node(n) {}
+        NodeTask(NodeTask&& other) noexcept : graph(other.graph), node(std::exchange(other.node, nullptr)) {}
+        ~NodeTask()
+        {
+            if (node != nullptr)
+            {
+                graph->fail(std::make_exception_ptr(TaskRejectedError()));
+                graph->finish(node);
+            }
+        }
+        void operator()() { graph->execute(std::exchange(node, nullptr)); }
+    };
+    void schedule(NodeData* node)
+    {
+        pool_.spawnTask(NodeTask(this, node));
+    }
+    void execute(NodeData* node)
+    {
+        if (!failed_.load(std::memory_order_relaxed))
+        {
+            try
+            {
+                node->func();
+            }
+            catch (...)
+            {
+                fail(std::current_exception());
+            }
+        }
+        finish(node);
+    }
+    void fail(std::exception_ptr e)
+    {
+        if (!failed_.exchange(true))
+            error_ = e;
+    }
+    void finish(NodeData* node)
+    {
+        for (NodeData* succ : node->successors)
+        {
+            if (succ->remaining.fetch_sub(1, std::memory_order_acq_rel) == 1)
+                schedule(succ);
+        }
+        if (unfinished_.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        {
+            // 最后一个节点完成,先取出done_,setValue之后图可能立即被销毁
+            FutureStatePtr<void> done = done_;
+            if (error_)
+                done->setError(error_);
+            else
+                done->setValue();
+        }
+    }
+    ThreadPool& pool_;
+    std::vector<std::unique_ptr<NodeData>> nodes_;
+    std::atomic<size_t> unfinished_;
+    std::atomic_bool failed_;
+    std::exception_ptr error_;
+    FutureStatePtr<void> done_;
+};
+
+///////////////////////   TaskGroup   ///////////////////////////////
+
+// 一组子任务: spawn提交,wait等待全部完成
+// wait在调用线程上执行本组还没有开始的任务;本组任务都在其他线程上执行时,工作线程帮线程池执行其他任务,
+// 因此固定线程数量的线程池中嵌套使用(在子任务中再创建TaskGroup并wait)也不会死锁,其他线程则睡眠等待
+// 不会执行线程池中与本组无关的任务
+// 第一个抛出的异常由wait重新抛出,同时取消本组还没有开始的任务;析构时等待全部完成并忽略异常
+// 多个线程可以同时wait(包括与析构并发),全部任务完成后一起返回
+// TaskGroup group(pool); for (...) group.spawn([&] { ... }); group.wait();
+class TaskGroup
+{
+public:
+    explicit TaskGroup(ThreadPool& pool)
+        : pool_(pool)
+        , state_(std::allocate_shared<State>(PoolAllocator<State>()))
+        {}
+    TaskGroup(const TaskGroup&) = delete;
+    TaskGroup& operator=(const TaskGroup&) = delete;
+    ~TaskGroup()
+    {
+        try
+        {
+            wait();
+        }
+        catch (...)
+        {
+        }
+    }
+    // 可以在任意线程(包括本组的子任务中)调用
+    template<typename Func>
+    void spawn(Func&& func)
+    {
+        state_->pending.add(1);
+        {
+            std::unique_lock<std::mutex> lock(state_->mtx);
+            state_->tasks.emplace_back(std::forward<Func>(func));
+        }
+        // 线程池中只放一个领取任务的凭证,任务本身留在组内,wait可以直接取走执行
+        pool_.spawnTask(Runner{ state_ });
+    }
+    // 等待本组所有任务完成,之后可以继续spawn
+    void wait()
+    {
+        // 持有状态,与析构中的wait并发时析构先返回也不影响本次等待
+        std::shared_ptr<State> keep = state_;
+        State& s = *keep;
+        bool worker = ThreadPool::curPool_ == &pool_;
+        int idle = 0;
+        while (!s.pending.done())
+        {
+            // 先取得唤醒代数再检查组内任务,之后被丢弃的凭证的唤醒不会错过
+            unsigned long gen = s.pending.generation();
+            ThreadPool::Task task;
+            if (s.pop(task, true))
+            {
+                ThreadPool::Task run([&s, &task]() { s.run(task); });
+                pool_.runHere(run);
+                idle = 0;
+            }
+            else if (!worker)
+                s.pending.wait(gen);
+            else if (pool_.runPendingTask())
+                idle = 0;
+            else if (++idle < IDLE_SPIN_MIN)
+                cpuRelax();
+            else
+                std::this_thread::yield();
+        }
+        // 多个线程同时wait时异常只由其中一个重新抛出
+        std::exception_ptr error;
+        {
+            std::unique_lock<std::mutex> lock(s.mtx);
+            error = std::exchange(s.error, nullptr);
+            s.failed.store(false);
+            s.cancelled.store(false);
+        }
+        if (error)
+            std::rethrow_exception(error);
+    }
+    // 本组还没有开始的任务不再执行,正在执行的任务可以通过cancelled()检查后提前返回
+    void cancel()
+    {
+        state_->cancelled.store(true);
+    }
+    bool cancelled() const
+    {
+        return state_->cancelled.load(std::memory_order_relaxed);
+    }
+private:
+    struct State
+    {
+        std::mutex mtx;
+        std::deque<ThreadPool::Task> tasks;     // 还没有开始的任务 由mtx保护
+        WaitCount pending;                      // 还没有结束的任务数量
+        std::atomic_bool cancelled{false};
+        std::atomic_bool failed{false};
+        std::exception_ptr error;               // 第一个失败的异常,只由把failed置为true的线程写 由mtx保护
+
+        // 等待方从尾部取最近提交的任务,工作线程从头部取
+        bool pop(ThreadPool::Task& task, bool back)
+        {
+            std::unique_lock<std::mutex> lock(mtx);
+            if (tasks.empty())
+                return false;
+            if (back)
+            {
+                task = std::move(tasks.back());
+                tasks.pop_back();
+            }
+            else
+            {
+                task = std::move(tasks.front());
+                tasks.pop_front();
+            }
+            return true;
+        }
+        void run(ThreadPool::Task& task)
+        {
+            if (!cancelled.load(std::memory_order_relaxed))
+            {
+                try
+                {
+                    task();
+                }
+                catch (...)
+                {
+                    if (!failed.exchange(true))
+                    {
+                        std::unique_lock<std::mutex> lock(mtx);
+                        error = std::current_exception();
+                    }
+                    cancelled.store(true);
+                }
+            }
+            // 先销毁闭包再结束计数,wait返回后闭包引用的对象可能已经销毁
+            task = ThreadPool::Task();
+            pending.countDown();
+        }
+    };
+    // 线程池中的凭证: 取出本组的一个任务执行,任务已经被wait取走时什么也不做
+    // 凭证被丢弃(例如cancelAll)时任务仍然留在组内,唤醒睡眠中的wait来执行
+    struct Runner
+    {
+        std::shared_ptr<State> state;
+        explicit Runner(std::shared_ptr<State> s) : state(std::move(s)) {}
+        Runner(Runner&&) noexcept = default;
+        ~Runner()
+        {
+            if (state)
+                state->pending.wake();
+        }
+        void operator()()
+        {
+            std::shared_ptr<State> s = std::move(state);
+            ThreadPool::Task task;
+            if (s->pop(task, false))
+                s->run(task);
+        }
+    };
+    ThreadPool& pool_;
+    std::shared_ptr<State> state_;
+};
+
+///////////////////////   Pipeline   ///////////////////////////////
+
+template<typename T>
+class PipelineBuilder;
+
+// 多阶段流水线: 源阶段逐个产生数据,每个数据依次经过各个阶段,前一阶段的返回值移动给下一阶段
+// 同时在流水线中的数据不超过maxTokens个(每个数据占用一个令牌),源阶段在没有空闲令牌时暂停,内存占用有上界
+// 令牌的数据存放在运行时一次分配的缓冲区中,阶段之间原地移动,每个数据不需要堆分配
+// 串行阶段被占用时到达的数据在该阶段排队,不占用线程,前一个数据离开时把下一个调度到线程池
+// Pipeline pipeline(pool, 16);
+// pipeline.source([&]() -> std::optional<std::string> { ... })
+//     .stage(StageMode::STAGE_PARALLEL, [](std::string line) { return parse(line); })
+//     .stage(StageMode::STAGE_SERIAL_IN_ORDER, [&](Record r) { write(r); });
+// pipeline.run().get();
+// 运行期间不能修改流水线,流水线对象必须活到run返回的future就绪
+class Pipeline
+{
+public:
+    explicit Pipeline(ThreadPool& pool, size_t maxTokens = PIPELINE_MAX_TOKENS)
+        : pool_(pool)
+        , maxTokens_(std::max<size_t>(1, maxTokens))
+        , live_(0)
+        , failed_(false)
+        {}
+    Pipeline(const Pipeline&) = delete;
+    Pipeline& operator=(const Pipeline&) = delete;
+    ~Pipeline()
+    {
+        freeStorage();
+    }
+
+    // 设置源阶段: func()返回std::optional<T>,返回空表示没有更多数据;源阶段串行执行
+    template<typename Func>
+    auto source(Func&& func)
+    {
+        using T = typename std::invoke_result_t<std::decay_t<Func>&>::value_type;
+        stages_.clear();
+        slotSize_ = 1;
+        slotAlign_ = alignof(std::max_align_t);
+        addStage<void, T>(StageMode::STAGE_SERIAL_OUT_OF_ORDER, std::forward<Func>(func));
+        return PipelineBuilder<T>(*this);
+    }
+    // 执行流水线,源阶段结束且所有数据都走完后返回的future就绪
+    // 某个阶段抛出异常后源阶段不再产生数据,已经在流水线中的数据跳过剩余阶段,future得到该异常
+    PoolFuture<void> run()
+    {
+        done_ = makeFutureState<void>(&pool_);
+        PoolFuture<void> result(done_);
+        if (stages_.empty())
+        {
+            done_->setValue();
+            return result;
+        }
+        freeStorage();
+        stride_ = (slotSize_ + slotAlign_ - 1) / slotAlign_ * slotAlign_;
+        storage_ = static_cast<char*>(::operator new(stride_ * maxTokens_, std::align_val_t(slotAlign_)));
+        tokens_.assign(maxTokens_, Token());
+        for (auto& s : stages_)
+        {
+            s->busy = false;
+            s->nextSeq = 0;
+            s->head = 0;
+            s->count = 0;
+            s->waiting.assign(maxTokens_, -1);
+        }
+        exhausted_ = false;
+        failed_ = false;
+        error_ = nullptr;
+        produced_ = 0;
+        live_.store(maxTokens_);
+        // 第一个令牌进入源阶段,其余令牌在源阶段排队
+        StageBase& src = *stages_[0];
+        src.busy = true;
+        for (size_t i = 1; i < maxTokens_; i++)
+            src.waiting[src.count++] = (int)i;
+        schedule(0);
+        return result;
+    }
+    // 源阶段不再产生数据,已经在流水线中的数据跳过剩余阶段
+    void cancel()
+    {
+        failed_.store(true);
+    }
+private:
+    template<typename T>
+    friend class PipelineBuilder;
+
+    struct StageBase
+    {
+        explicit StageBase(StageMode mode) : mode(mode) {}
+        virtual ~StageBase() = default;
+        // 处理storage中的输入并在原处构造输出,输入总是被销毁;源阶段没有输入,返回false表示没有更多数据
+        virtual bool process(void* storage) = 0;
+        virtual void discardInput(void* storage) = 0;
+        virtual void discardOutput(void* storage) = 0;
+        virtual bool hasOutput() const = 0;
+
+        StageMode mode;
+        // 串行阶段的状态 由mtx保护
+        std::mutex mtx;
+        bool busy = false;              // 有令牌正在执行本阶段
+        size_t nextSeq = 0;             // 按顺序执行时下一个可以进入的数据序号
+        std::vector<int> waiting;       // 排队的令牌: 按顺序执行时以序号对令牌数取模为下标,-1表示空;否则是环形FIFO
+        size_t head = 0;
+        size_t count = 0;
+    };
+    template<typename In, typename Out, typename Func>
+    struct Stage : StageBase
+    {
+        Stage(StageMode mode, Func f) : StageBase(mode), func(std::move(f)) {}
+        bool process(void* storage) override
+        {
+            if constexpr (std::is_void<In>::value)
+            {
+                std::optional<Out> value = func();
+                if (!value)
+                    return false;
+                new (storage) Out(std::move(*value));
+            }
+            else
+            {
+                In* in = std::launder(static_cast<In*>(storage));
+                if constexpr (std::is_void<Out>::value)
+                {
+                    try
+                    {
+                        func(std::move(*in));
+                    }
+                    catch (...)
+                    {
+                        in->~In();
+                        throw;
+                    }
+                    in->~In();
+                }
+                else
+                {
+                    std::optional<Out> out;
+                    try
+                    {
+                        out.emplace(func(std::move(*in)));
+                    }
+                    catch (...)
+                    {
+                        in->~In();
+                        throw;
+                    }
+                    in->~In();
+                    new (storage) Out(std::move(*out));
+                }
+            }
+            return true;
+        }
+        void discardInput(void* storage) override
+        {
+            if constexpr (!std::is_void<In>::value)
+                std::launder(static_cast<In*>(storage))->~In();
+        }
+        void discardOutput(void* storage) override
+        {
+            if constexpr (!std::is_void<Out>::value)
+                std::launder(static_cast<Out*>(storage))->~Out();
+        }
+        bool hasOutput() const override { return !std::is_void<Out>::value; }
+        Func func;
+    };
+    // 令牌: 一个在流水线中的数据,只被持有它的线程访问
+    struct Token
+    {
+        size_t seq = 0;         // 源阶段产生的顺序
+        size_t stage = 0;       // 下一个要执行的阶段
+        bool empty = true;      // 缓冲区中没有数据(失败的数据继续占着序号往后走,保证按顺序阶段不会卡住)
+    };
+    // 令牌任务,如果没有执行就被销毁(例如被cancelAll移除)则按失败处理并在当前线程把令牌走完,保证流水线能结束
+    struct TokenTask
+    {
+        Pipeline* pipeline;
+        int token;
+        TokenTask(Pipeline* p, int t) : pipeline(p), token(t) {}
+        TokenTask(TokenTask&& other) noexcept : pipeline(other.pipeline), token(std::exchange(other.token, -1)) {}
+        ~TokenTask()
+        {
+            if (token >= 0)
+            {
+                pipeline->fail(std::make_exception_ptr(TaskRejectedError()));
+                pipeline->advance(token);
+            }
+        }
+        void operator()() { pipeline->advance(std::exchange(token, -1)); }
+    };
+
+    template<typename In, typename Out, typename Func>
+    void addStage(StageMode mode, Func&& func)
+    {
+        stages_.push_back(std::make_unique<Stage<In, Out, std::decay_t<Func>>>(mode, std::forward<Func>(func)));
+        if constexpr (!std::is_void<Out>::value)
+        {
+            slotSize_ = std::max(slotSize_, sizeof(Out));
+            slotAlign_ = std::max(slotAlign_, alignof(Out));
+        }
+    }
+    void* slot(int token) { return storage_ + stride_ * token; }
+    void freeStorage()
+    {
+        if (storage_ != nullptr)
+            ::operator delete(storage_, std::align_val_t(slotAlign_));
+        storage_ = nullptr;
+    }
+    void schedule(int token)
+    {
+        pool_.spawnTask(TokenTask(this, token));
+    }
+    void fail(std::exception_ptr e)
+    {
+        if (!failed_.exchange(true))
+            error_ = e;
+    }
+    // 令牌退出,最后一个令牌退出时流水线结束,之后不能再访问本对象
+    void retire(size_t count = 1)
+    {
+        if (live_.fetch_sub(count, std::memory_order_acq_rel) != count)
+            return;
+        FutureStatePtr<void> done = std::move(done_);
+        if (error_)
+            done->setError(error_);
+        else
+            done->setValue();
+    }
+    // 令牌从当前阶段开始往后执行,已经占有当前串行阶段(由离开该阶段的令牌转交)
+    // 遇到被占用的串行阶段时排队后返回,由离开该阶段的令牌重新调度
+    void advance(int token)
+    {
+        Token& t = tokens_[token];
+        bool owned = true;
+        for (;;)
+        {
+            if (t.stage == stages_.size())
+            {
+                // 数据走完了所有阶段,令牌回到源阶段取下一个数据
+                if (!t.empty)
+                    stages_.back()->discardOutput(slot(token));
+                t.empty = true;
+                t.stage = 0;
+                owned = false;
+            }
+            StageBase& s = *stages_[t.stage];
+            bool serial = s.mode != StageMode::STAGE_PARALLEL;
+            if (serial && !owned && !enter(s, t, token))
+                return;
+            owned = false;
+            bool more = execute(s, t, token);
+            if (serial)
+            {
+                int next = leave(s, t, more);
+                if (next >= 0)
+                    schedule(next);
+            }
+            if (!more)
+            {
+                retire();
+                return;
+            }
+            t.stage++;
+        }
+    }
+    // 进入串行阶段,阶段被占用或者还没有轮到该数据时排队并返回false;源阶段已经结束时令牌直接退出
+    bool enter(StageBase& s, Token& t, int token)
+    {
+        std::unique_lock<std::mutex> lock(s.mtx);
+        if (t.stage == 0 && exhausted_)
+        {
+            lock.unlock();
+            retire();
+            return false;
+        }
+        bool inOrder = s.mode == StageMode::STAGE_SERIAL_IN_ORDER;
+        if (!s.busy && (!inOrder || t.seq == s.nextSeq))
+        {
+            s.busy = true;
+            return true;
+        }
+        if (inOrder)
+            s.waiting[t.seq % maxTokens_] = token;
+        else
+            s.waiting[(s.head + s.count++) % maxTokens_] = token;
+        return false;
+    }
+    // 离开串行阶段,返回可以进入该阶段的下一个令牌(阶段的占有权直接转交给它),没有时返回-1
+    // 源阶段结束时排队的令牌全部退出
+    int leave(StageBase& s, Token& t, bool more)
+    {
+        std::unique_lock<std::mutex> lock(s.mtx);
+        int next = -1;
+        if (t.stage == 0 && !more)
+        {
+            exhausted_ = true;
+            size_t queued = s.count;
+            s.count = 0;
+            s.busy = false;
+            lock.unlock();
+            // 当前令牌还没有退出,这里不会结束流水线
+            if (queued > 0)
+                retire(queued);
+            return -1;
+        }
+        if (s.mode == StageMode::STAGE_SERIAL_IN_ORDER)
+        {
+            s.nextSeq++;
+            int& w = s.waiting[s.nextSeq % maxTokens_];
+            next = std::exchange(w, -1);
+        }
+        else if (s.count > 0)
+        {
+            next = s.waiting[s.head];
+            s.head = (s.head + 1) % maxTokens_;
+            s.count--;
+        }
+        if (next < 0)
+            s.busy = false;
+        return next;
+    }
+    // 执行一个阶段,源阶段返回false表示没有更多数据
+    bool execute(StageBase& s, Token& t, int token)
+    {
+        void* p = slot(token);
+        if (t.stage == 0)
+        {
+            if (failed_.load(std::memory_order_relaxed))
+                return false;
+            try
+            {
+                if (!s.process(p))
+                    return false;
+            }
+            catch (...)
+            {
+                fail(std::current_exception());
+                return false;
+            }
+            t.seq = produced_++;
+            t.empty = false;
+            return true;
+        }
+        if (t.empty)
+            return true;
+        if (failed_.load(std::memory_order_relaxed))
+        {
+            s.discardInput(p);
+            t.empty = true;
+            return true;
+        }
+        try
+        {
+            s.process(p);
+            t.empty = !s.hasOutput();
+        }
+        catch (...)
+        {
+            t.empty = true;
+            fail(std::current_exception());
+        }
+        return true;
+    }
+
+    ThreadPool& pool_;
+    size_t maxTokens_;
+    std::vector<std::unique_ptr<StageBase>> stages_;
+    size_t slotSize_ = 1;               // 各阶段输出类型的最大大小和对齐
+    size_t slotAlign_ = alignof(std::max_align_t);
+    size_t stride_ = 0;
+    char* storage_ = nullptr;           // 所有令牌的数据缓冲区
+    std::vector<Token> tokens_;
+    bool exhausted_ = false;            // 源阶段已经结束 由源阶段的mtx保护
+    size_t produced_ = 0;               // 源阶段产生的数据数量,只被占有源阶段的令牌访问
+    std::atomic<size_t> live_;          // 还没有退出的令牌数量
+    std::atomic_bool failed_;
+    std::exception_ptr error_;          // 第一个失败的异常,只由把failed_置为true的线程写
+    FutureStatePtr<void> done_;
+};
+
+// 流水线的构建器,T是上一阶段的输出类型
+template<typename T>
+class PipelineBuilder
+{
+public:
+    explicit PipelineBuilder(Pipeline& pipeline) : pipeline_(pipeline) {}
+    // 添加一个阶段: func(T)的返回值交给下一阶段,最后一个阶段通常返回void
+    template<typename Func>
+    auto stage(StageMode mode, Func&& func)
+    {
+        using U = std::invoke_result_t<std::decay_t<Func>&, T&&>;
+        pipeline_.addStage<T, U>(mode, std::forward<Func>(func));
+        return PipelineBuilder<U>(pipeline_);
+    }
+private:
+    Pipeline& pipeline_;
+};
 
-    //启动线程
-    void start()
+///////////////////////   Strand   ///////////////////////////////
+
+// 串行执行器: 同一个strand的任务按提交顺序依次执行,不会同时执行,只由该strand访问的数据不需要加锁
+// 任务先放入strand自己的无锁队列,strand由空变为非空时才向线程池放入一个执行任务,没有任务的strand不占用线程池;
+// 执行任务在工作线程上连续执行一批后重新排队,任务之间没有等待,不会有工作线程因为某个strand阻塞
+// 可以拷贝,拷贝共享同一个队列;strand销毁后已提交的任务仍然会执行
+// Strand s = pool.strand(); s.submit([&] { log.append(line); });
+class Strand
+{
+public:
+    explicit Strand(ThreadPool& pool)
+        : pool_(&pool)
+        , queue_(std::make_shared<StrandQueue>())
+        {}
+    template<typename Func, typename... Args>
+    auto submit(Func&& func, Args&&... args) -> std::future<decltype(func(args...))>
     {
-        // 创建一个线程并执行线程函数
-        std::thread t(func_,threadId_);
-        // 这里一定要做detach操作,否则出了函数作用域thread t 对象析构,正在执行线程函数func的线程会出现core dump错误
-        t.detach();
-    };
+        return pool_->submitStrand(queue_.get(), queue_, std::forward<Func>(func), std::forward<Args>(args)...);
+    }
+    // 已提交还没有执行完的任务数量,执行完的任务每批扣除一次,因此future就绪后可能还没有扣除
+    size_t pending() const
+    {
+        return queue_->pending();
+    }
+private:
+    ThreadPool* pool_;
+    std::shared_ptr<StrandQueue> queue_;
+};
 
-    //获取线程id
-    int getThreadId(){return threadId_;};
+inline Strand ThreadPool::strand()
+{
+    return Strand(*this);
+}
+
+///////////////////////   协程   ///////////////////////////////
+#ifdef THREADPOOL_COROUTINE
+
+// 恢复协程的任务,如果没有执行就被销毁(例如被DISCARD_OLDEST丢弃)则在销毁它的线程上恢复,协程不会永远挂起
+class ResumeTask
+{
+public:
+    explicit ResumeTask(std::coroutine_handle<> h) : h_(h) {}
+    ResumeTask(ResumeTask&& other) noexcept : h_(std::exchange(other.h_, nullptr)) {}
+    ~ResumeTask()
+    {
+        if (h_)
+            h_.resume();
+    }
+    void operator()() { std::exchange(h_, nullptr).resume(); }
 private:
-    ThreadFunc func_;
-    static int generateId_;
-    int threadId_; 
+    std::coroutine_handle<> h_;
 };
-int Thread::generateId_ = 0;
-class ThreadPool
+
+// co_await pool.schedule()的等待对象
+class ScheduleAwaiter
 {
 public:
-    ThreadPool()
-    : initThreadSize_(0)
-    , isRuning_(false)
-    , maxThreadSisze_(THREAD_MAX_SIZE)
-    , taskSize_(0)
-    , curThreadSize_(0)
-    , freeThreadSize_(0)
-    , taskQueMaxSize_(TASK_MAX_SIZE)
-    , PoolMode_(PoolMode::MODE_FIXED) 
-    {};
-    ~ThreadPool()
+    explicit ScheduleAwaiter(ThreadPool& pool) : pool_(pool) {}
+    bool await_ready() const noexcept { return false; }
+    // 队列满时spawnTask会在当前线程直接恢复协程,之后不能再访问本对象
+    void await_suspend(std::coroutine_handle<> h) { pool_.spawnTask(ResumeTask(h)); }
+    void await_resume() const noexcept {}
+private:
+    ThreadPool& pool_;
+};
+
+inline ScheduleAwaiter ThreadPool::schedule()
+{
+    return ScheduleAwaiter(*this);
+}
+
+// 协程帧从小对象内存池分配
+struct CoroutineFrame
+{
+    static void* operator new(size_t size) { return SmallObjectPool::allocate(size); }
+    static void operator delete(void* p, size_t size) { SmallObjectPool::deallocate(p, size); }
+};
+
+class CoTaskPromiseBase : public CoroutineFrame
+{
+public:
+    // 结束时对称转移到等待本协程的协程,不经过任务队列,也不会加深调用栈
+    struct FinalAwaiter
     {
-        isRuning_ = false;
-        std::unique_lock<std::mutex>lock(taskQueMtx_);
-        notEmpty_.notify_all();
-        recycle_.wait(lock,[&]()->bool{return threads_.size() == 0;});
+        bool await_ready() const noexcept { return false; }
+        template<typename Promise>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> h) noexcept
+        {
+            std::coroutine_handle<> next = h.promise().continuation_;
+            return next ? next : std::noop_coroutine();
+        }
+        void await_resume() const noexcept {}
     };
-    ThreadPool(const ThreadPool&) = delete;
-    ThreadPool& operator=(const ThreadPool&) = delete;
-    void setMode(PoolMode mode)
+    // 协程创建后不立即执行,被co_await或submitCoroutine时才开始
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    FinalAwaiter final_suspend() noexcept { return {}; }
+    void unhandled_exception() { error_ = std::current_exception(); }
+
+    std::coroutine_handle<> continuation_;
+    std::exception_ptr error_;
+};
+
+template<typename T>
+class CoTaskPromise : public CoTaskPromiseBase
+{
+public:
+    template<typename V>
+    void return_value(V&& v) { value_.emplace(std::forward<V>(v)); }
+    T take()
     {
-        if (poolState())
-            return;
-        PoolMode_ = mode;
-    }; 
-    //设置线程池的工作模式
-    //处理器核心数作为线程数量
-    void start(int size = std::thread::hardware_concurrency())
+        if (error_)
+            std::rethrow_exception(error_);
+        return std::move(*value_);
+    }
+private:
+    std::optional<T> value_;
+};
+
+template<>
+class CoTaskPromise<void> : public CoTaskPromiseBase
+{
+public:
+    void return_void() {}
+    void take()
     {
-        // 设置线程的运行状态
-        isRuning_ = true;
+        if (error_)
+            std::rethrow_exception(error_);
+    }
+};
 
-        // 记录初始化线程个数
-        initThreadSize_ = size;
-        // 空闲线程个数
-        freeThreadSize_ = size;
-        // 创建线程
-        for (int i = 0; i < initThreadSize_; i++)
-        {
-            // c++11 提供make_shared c++14 提供make_unique
-            auto ptr = std::make_unique<Thread>(std::bind(&ThreadPool::threadFunc, this,std::placeholders::_1));
-            int thtreadId = ptr->getThreadId();
-            // unique_ptr 删除了拷贝构造函数 只保留了移动构造函数 因此需要使用move做资源转移
+// 可等待的协程返回类型,只能移动
+// co_await task在当前线程开始执行task,task结束时在完成它的线程上恢复等待方
+// task内部co_await pool.schedule()或PoolFuture之后,等待方也就在线程池上恢复
+template<typename T>
+class CoTask
+{
+public:
+    struct promise_type : CoTaskPromise<T>
+    {
+        CoTask get_return_object() { return CoTask(std::coroutine_handle<promise_type>::from_promise(*this)); }
+    };
+    using Handle = std::coroutine_handle<promise_type>;
 
-            threads_.emplace(thtreadId,std::move(ptr));
+    CoTask(CoTask&& other) noexcept : h_(std::exchange(other.h_, nullptr)) {}
+    CoTask& operator=(CoTask&& other) noexcept
+    {
+        if (this != &other)
+        {
+            if (h_)
+                h_.destroy();
+            h_ = std::exchange(other.h_, nullptr);
         }
-        // 启动线程
-        for (int i = 0; i < initThreadSize_; i++)
+        return *this;
+    }
+    ~CoTask()
+    {
+        if (h_)
+            h_.destroy();
+    }
+
+    struct Awaiter
+    {
+        Handle h;
+        bool await_ready() const noexcept { return h.done(); }
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<> caller) noexcept
         {
-            std::cout<<"start:"<<i<<std::endl;
-            threads_[i]->start();
-            curThreadSize_++;
+            h.promise().continuation_ = caller;
+            return h;
         }
-    } //开启线程池
-    //设置任务队列任务上限值
-    void settaskQueMaxSize_(int taskQueMaxSize_)
+        T await_resume() { return h.promise().take(); }
+    };
+    Awaiter operator co_await() noexcept { return Awaiter{ h_ }; }
+private:
+    explicit CoTask(Handle h) : h_(h) {}
+    Handle h_;
+};
+
+// 结束后自动销毁协程帧的协程,只用于submitCoroutine
+struct DetachedCoroutine
+{
+    struct promise_type : CoroutineFrame
     {
-        if (poolState())
-            return;
-        taskQueMaxSize_ = taskQueMaxSize_;
+        DetachedCoroutine get_return_object() noexcept { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() noexcept {}
+        void unhandled_exception() noexcept { std::terminate(); }
     };
-    //给线程池提交任务
-    //使用可变参模板编程,让submitTask可以接收任意任务函数和任意数量的参数
-    //pool.submitTask(sum1,10,20);
-    //返回值 future<x> 使用decltype来推导类型
-    template<typename Func,typename... Args>
-    auto submitTask(Func&& func,Args&&... args) -> std::future<decltype(func(args...))>
+};
+
+template<typename T>
+DetachedCoroutine runCoroutine(ThreadPool& pool, CoTask<T> task, FutureStatePtr<T> state)
+{
+    co_await pool.schedule();
+    try
     {
-        using RType = decltype(func(args...));
-        auto task = std::make_shared<std::packaged_task<RType()>>(
-            std::bind(std::forward<Func>(func),std::forward<Args>(args)...));
-        std::future<RType> result = task->get_future();
+        if constexpr (std::is_void<T>::value)
+        {
+            co_await task;
+            state->setValue();
+        }
+        else
+        {
+            state->setValue(co_await task);
+        }
+    }
+    catch (...)
+    {
+        state->setError(std::current_exception());
+    }
+}
 
-        // 获取锁
-        std::unique_lock<std::mutex> lock(taskQueMtx_);
+template<typename T>
+PoolFuture<T> ThreadPool::submitCoroutine(CoTask<T> task)
+{
+    FutureStatePtr<T> state = makeFutureState<T>(this);
+    PoolFuture<T> result(state);
+    runCoroutine(*this, std::move(task), std::move(state));
+    return result;
+}
 
-        // wait 是条件不满足就一直等待
-        // wait_for是条件满足返回true向下执行，条件不满足但是到达定时时间之后会返回false
-        // wait_until
-        if (!notFull_.wait_for(lock, std::chrono::seconds(1), [&]() -> bool
-                            { return taskQue_.size() < (size_t)taskQueMaxSize_; }))
+// co_await PoolFuture: 结果就绪时把等待的协程调度到future所属的线程池上恢复,不阻塞任何线程
+template<typename T>
+class PoolFutureAwaiter
+{
+public:
+    explicit PoolFutureAwaiter(PoolFuture<T>& f)
+        : state_(futureStateOf(f)->shared_from_this())
+        {}
+    bool await_ready() const noexcept { return state_->isReady(); }
+    void await_suspend(std::coroutine_handle<> h)
+    {
+        state_->onReady([h](FutureState<T>& s)
         {
-            // 表示notFull_等待1s仍然没有满足 tashQue_.size() < tashQueMaxSize_ 的条件
-            std::cerr << "tash queue is full, submit tash fail." << std::endl;
+            if (s.pool() != nullptr)
+                s.pool()->spawnTask(ResumeTask(h));
+            else
+                h.resume();
+        });
+    }
+    T await_resume()
+    {
+        if constexpr (std::is_void<T>::value)
+            state_->take();
+        else
+            return state_->take();
+    }
+private:
+    FutureStatePtr<T> state_;
+};
 
-            auto task = std::make_shared<std::packaged_task<RType()>>(
-                []()->RType{ return RType(); }
-            );
-            (*task)();
-            return task->get_future();
-        };
+template<typename T>
+PoolFutureAwaiter<T> operator co_await(PoolFuture<T>&& f)
+{
+    return PoolFutureAwaiter<T>(f);
+}
 
-        // 放入任务
+#endif // THREADPOOL_COROUTINE
 
-        //taskQue_.push(sp);
-        //十分经典的处理！！！因为我们在定义taskQue时并不知道任务函数对象的返回值会是什么所以我们使用了void中间层
-        //在实际传递的时候通过lambda表达式来传递真正要执行的函数对象
-        taskQue_.emplace([task](){ (*task)();  });
-        
-        taskSize_++;
+///////////////////////   Channel   ///////////////////////////////
 
-        // 因为新放了任务，所以任务队列肯定不满 ,因此可以通过notEmpty通知，进行分配执行任务
-        notEmpty_.notify_all();
+// 有界多生产者多消费者通道,在线程池的任务之间流式传递数据,内存中最多capacity个元素(容量向上取整为2的幂)
+// 通道不空不满时send/receive只访问无锁队列;需要等待时登记到等待列表,数据到达或出现空位时唤醒一个等待方:
+// co_await ch.asyncReceive()的协程和forEach的消费任务被重新调度到线程池,等待期间不占用任何线程;
+// 工作线程中调用receive/send(包括range-for)时先帮线程池执行其他任务,没有任务可做时同其他线程一样登记后睡眠,
+// 睡眠期间线程池补偿一个线程;在线程池中消费通道而不占用线程应使用forEach或co_await
+// close之后send返回false,receive取完剩余数据后返回空;Channel是共享句柄,拷贝后指向同一个通道
+template<typename T>
+class Channel
+{
+    struct State;
+public:
+    explicit Channel(size_t capacity = CHANNEL_DEFAULT_SIZE)
+        : state_(std::make_shared<State>(capacity, nullptr))
+        {}
+    // 等待的协程和forEach的消费任务调度到pool上执行
+    explicit Channel(ThreadPool& pool, size_t capacity = CHANNEL_DEFAULT_SIZE)
+        : state_(std::make_shared<State>(capacity, &pool))
+        {}
 
-        // 如果线程池的模式为cache(该模式适用于解决任务数量多且快的状态) && 任务数量多余线程池的线程数量 && 线程池中线程数量未达到上限
-        if (PoolMode_ == PoolMode::MODE_CACHED && taskSize_ > freeThreadSize_ && curThreadSize_ < maxThreadSisze_)
+    // 通道满或已关闭时返回false,此时value不会被移走
+    template<typename U>
+    bool trySend(U&& value)
+    {
+        return state_->trySend(std::forward<U>(value));
+    }
+    // 通道满时等待,通道已关闭返回false
+    template<typename U>
+    bool send(U&& value)
+    {
+        State& s = *state_;
+        T item(std::forward<U>(value));
+        while (!s.trySend(std::move(item)))
         {
-            std::cout << ">>> create new thread..." << std::endl;
-            // c++11 提供make_shared c++14 提供make_unique
-            auto ptr = std::make_unique<Thread>(std::bind(&ThreadPool::threadFunc, this,std::placeholders::_1));
-            int threadId= ptr->getThreadId();
-            threads_.emplace(threadId,std::move(ptr));
-            threads_[threadId]->start();
-            curThreadSize_++;
-            freeThreadSize_++;
+            if (s.closed.load(std::memory_order_acquire))
+                return false;
+            s.block(s.senders, s.sendWaiting, [&s]() { return s.writable(); });
+        }
+        return true;
+    }
+    // 通道空时返回空
+    std::optional<T> tryReceive()
+    {
+        std::optional<T> out;
+        state_->tryReceive(out);
+        return out;
+    }
+    // 通道空时等待;通道关闭且没有剩余数据时返回空,如果是以异常关闭的则重新抛出该异常
+    std::optional<T> receive()
+    {
+        State& s = *state_;
+        std::optional<T> out;
+        while (!s.tryReceive(out))
+        {
+            if (s.closed.load(std::memory_order_acquire))
+            {
+                // 关闭之前放入的数据
+                if (s.tryReceive(out))
+                    break;
+                if (s.error)
+                    std::rethrow_exception(s.error);
+                return out;
+            }
+            s.block(s.receivers, s.recvWaiting, [&s]() { return s.readable(); });
         }
+        return out;
+    }
+    // 关闭通道并唤醒所有等待方,error不为空时接收方取完数据后得到该异常
+    void close(std::exception_ptr error = nullptr)
+    {
+        state_->close(std::move(error));
+    }
+    bool closed() const { return state_->closed.load(std::memory_order_acquire); }
+    // 近似值
+    size_t size() const { return state_->que.size(); }
+    size_t capacity() const { return state_->que.capacity(); }
+
+    // 每收到一个数据调用一次func(T),通道关闭且取完数据后返回的future就绪,func抛出的异常也由future得到,
+    // 同时以该异常关闭通道,之后send返回false,不会再有数据交给func
+    // 通道空时不占用任何线程,数据到达后消费任务才被调度到线程池;同一时间只有一个线程调用func,按接收顺序调用
+    template<typename Func>
+    PoolFuture<void> forEach(Func&& func)
+    {
+        FutureStatePtr<void> done = makeFutureState<void>(state_->pool);
+        PoolFuture<void> result(done);
+        auto consumer = std::allocate_shared<Consumer<std::decay_t<Func>>>(PoolAllocator<Consumer<std::decay_t<Func>>>(),
+            state_, std::forward<Func>(func), std::move(done));
+        consumer->schedule();
         return result;
+    }
+
+#ifdef THREADPOOL_COROUTINE
+    class ReceiveAwaiter;
+    class SendAwaiter;
+    // co_await ch.asyncReceive()得到std::optional<T>,通道空时挂起协程,数据到达后在线程池上恢复
+    ReceiveAwaiter asyncReceive() { return ReceiveAwaiter(state_); }
+    // co_await ch.asyncSend(v)得到是否放入成功,通道满时挂起协程,出现空位后在线程池上恢复
+    SendAwaiter asyncSend(T value) { return SendAwaiter(state_, std::move(value)); }
+#endif
+
+    // for (T& v : ch)依次receive直到通道关闭
+    class iterator
+    {
+    public:
+        using iterator_category = std::input_iterator_tag;
+        using value_type = T;
+        using difference_type = std::ptrdiff_t;
+        using pointer = T*;
+        using reference = T&;
+        iterator() = default;
+        explicit iterator(Channel* channel) : channel_(channel) { ++*this; }
+        T& operator*() { return *value_; }
+        T* operator->() { return &*value_; }
+        iterator& operator++()
+        {
+            value_ = channel_->receive();
+            if (!value_)
+                channel_ = nullptr;
+            return *this;
+        }
+        bool operator==(const iterator& other) const { return channel_ == other.channel_; }
+        bool operator!=(const iterator& other) const { return channel_ != other.channel_; }
+    private:
+        Channel* channel_ = nullptr;
+        std::optional<T> value_;
     };
-    void setMaxThreadSisze_(size_t count);
-    
+    iterator begin() { return iterator(this); }
+    iterator end() { return iterator(); }
+
 private:
-    void threadFunc(int threadid)
+    struct State
     {
-        auto lastTime = std::chrono::high_resolution_clock().now();
-        for (;;)
+        using Wake = UniqueFunction<void()>;
+        State(size_t capacity, ThreadPool* pool)
+            : que(capacity)
+            , pool(pool)
+            {}
+
+        MPMCQueue<T> que;
+        ThreadPool* pool;
+        std::atomic_bool closed{false};
+        std::atomic_int recvWaiting{0};     // receivers的长度,不加锁判断是否需要唤醒
+        std::atomic_int sendWaiting{0};
+        std::mutex mtx;
+        std::deque<Wake> receivers;         // 等待数据的一方 由mtx保护
+        std::deque<Wake> senders;           // 等待空位的一方 由mtx保护
+        std::exception_ptr error;           // 关闭时的异常,在closed置为true之前写入
+
+        template<typename U>
+        bool trySend(U&& value)
         {
-            // 先获取锁
-            Task task;
+            if (closed.load(std::memory_order_acquire) || !que.tryEmplace(std::forward<U>(value)))
+                return false;
+            wakeOne(receivers, recvWaiting);
+            return true;
+        }
+        bool tryReceive(std::optional<T>& out)
+        {
+            if (!que.tryConsume([&](T& data) { out.emplace(std::move(data)); }))
+                return false;
+            wakeOne(senders, sendWaiting);
+            return true;
+        }
+        bool readable() const { return !que.empty() || closed.load(std::memory_order_acquire); }
+        bool writable() const { return que.size() < que.capacity() || closed.load(std::memory_order_acquire); }
+
+        // 放入/取出数据之后检查等待方,和wait中先登记再检查条件配对,两边至少有一方能看到对方,不会漏掉唤醒
+        void wakeOne(std::deque<Wake>& waiters, std::atomic_int& count)
+        {
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (count.load(std::memory_order_relaxed) == 0)
+                return;
+            Wake wake;
             {
-                std::unique_lock<std::mutex> lock(taskQueMtx_);
+                std::unique_lock<std::mutex> lock(mtx);
+                if (waiters.empty())
+                    return;
+                wake = std::move(waiters.front());
+                waiters.pop_front();
+                count.fetch_sub(1, std::memory_order_relaxed);
+            }
+            wake();
+        }
+        // 登记一个只调用一次的唤醒函数,登记后条件已经满足则唤醒一个等待方(不一定是自己,被唤醒的一方会重新检查)
+        // 已经关闭时直接调用wake
+        template<typename Ready>
+        void wait(std::deque<Wake>& waiters, std::atomic_int& count, Wake wake, Ready&& ready)
+        {
+            {
+                std::unique_lock<std::mutex> lock(mtx);
+                if (!closed.load(std::memory_order_relaxed))
+                {
+                    waiters.push_back(std::move(wake));
+                    count.fetch_add(1, std::memory_order_relaxed);
+                }
+            }
+            if (wake)
+            {
+                wake();
+                return;
+            }
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (ready())
+                wakeOne(waiters, count);
+        }
+        // 等待ready成立: 工作线程先帮线程池执行排队的任务(生产者可能就在其中),没有任务可做并且自旋一段时间后
+        // 和其他线程一样登记后睡眠,睡眠期间用BlockingScope让线程池补偿一个线程,本线程等待不会让其他任务得不到执行
+        template<typename Ready>
+        void block(std::deque<Wake>& waiters, std::atomic_int& count, Ready&& ready)
+        {
+            ThreadPool* cur = ThreadPool::curPool_;
+            if (cur == nullptr)
+            {
+                sleep(waiters, count, ready);
+                return;
+            }
+            int idle = 0;
+            while (!ready())
+            {
+                if (cur->runPendingTask())
+                    idle = 0;
+                else if (++idle < IDLE_SPIN_MIN)
+                    cpuRelax();
+                else if (idle < 2 * IDLE_SPIN_MIN)
+                    std::this_thread::yield();
+                else
+                {
+                    BlockingScope scope;
+                    sleep(waiters, count, ready);
+                    idle = 0;
+                }
+            }
+        }
+        template<typename Ready>
+        void sleep(std::deque<Wake>& waiters, std::atomic_int& count, Ready& ready)
+        {
+            auto parker = std::make_shared<Parker>();
+            wait(waiters, count, [parker]() { parker->unpark(); }, ready);
+            parker->park();
+        }
+        void close(std::exception_ptr e)
+        {
+            std::deque<Wake> r;
+            std::deque<Wake> s;
+            {
+                std::unique_lock<std::mutex> lock(mtx);
+                if (closed.load(std::memory_order_relaxed))
+                    return;
+                error = std::move(e);
+                closed.store(true, std::memory_order_release);
+                r.swap(receivers);
+                s.swap(senders);
+                recvWaiting.store(0, std::memory_order_relaxed);
+                sendWaiting.store(0, std::memory_order_relaxed);
+            }
+            for (Wake& w : r)
+                w();
+            for (Wake& w : s)
+                w();
+        }
+        // 在pool上执行func,没有线程池时在当前线程执行
+        template<typename Func>
+        void dispatch(Func&& func)
+        {
+            if (pool != nullptr)
+                pool->spawnTask(std::forward<Func>(func));
+            else
+                func();
+        }
+    };
 
-                // cached模式下，有可能创建了很多线程，但空闲时间超过60s,应该把超过initThteadSize数量的线程进行回收掉
-            
-            while(taskQue_.size() ==0)
+    // forEach的消费者: 取完当前的数据后登记等待,被唤醒时把自己调度到线程池
+    template<typename Func>
+    struct Consumer : std::enable_shared_from_this<Consumer<Func>>
+    {
+        Consumer(std::shared_ptr<State> state, Func func, FutureStatePtr<void> done)
+            : state(std::move(state))
+            , func(std::move(func))
+            , done(std::move(done))
+            {}
+        void schedule()
+        {
+            state->dispatch([self = this->shared_from_this()]() { self->drain(); });
+        }
+        void drain()
+        {
+            State& s = *state;
+            std::optional<T> item;
+            for (int i = 0; i < CHANNEL_DRAIN_BATCH; i++)
             {
-                    if(!isRuning_)
-                    {
-                        threads_.erase(threadid);
-                        recycle_.notify_all();
-                        return ;
-                    }
-                    if (curThreadSize_ > initThreadSize_)
+                if (!s.tryReceive(item))
+                {
+                    if (!s.closed.load(std::memory_order_acquire))
                     {
-                        
-                            // 每一秒返回一次 如何区分是超时返回？还是有任务执行返回？
-                        if (std::cv_status::timeout ==
-                            notEmpty_.wait_for(lock, std::chrono::seconds(1)))
-                        {
-                            auto now = std::chrono::high_resolution_clock().now();
-                            auto dur = std::chrono::duration_cast<std::chrono::seconds>(now - lastTime);
-                            if (dur.count() > THREAD_MAX_FREE_TIME)
-                            {
-                                // 回收线程--记录线程数量相关的变量修改 && 把线程对象从线程列表中删除
-                                curThreadSize_--;
-                                freeThreadSize_--;
-                                threads_.erase(threadid);
-                                return;
-                            }
-                        }
+                        s.wait(s.receivers, s.recvWaiting, [self = this->shared_from_this()]() { self->schedule(); },
+                            [&s]() { return s.readable(); });
+                        return;
                     }
-                    else
+                    if (!s.tryReceive(item))
                     {
-                        // 等待notEmpty条件
-                        notEmpty_.wait(lock);
+                        if (s.error)
+                            done->setError(s.error);
+                        else
+                            done->setValue();
+                        return;
                     }
-            }
-            
-
-                freeThreadSize_--;
-                // 从任务队列中取出一个任务出来
-                task = taskQue_.front();
-                taskQue_.pop();
-                taskSize_--;
-
-                //  如果依然有剩余任务,继续通知其他线程执行任务
-                if (taskQue_.size() > 0)
+                }
+                try
                 {
-                    notEmpty_.notify_all();
+                    func(std::move(*item));
                 }
-                //  取出一个任务进行通知
-                notFull_.notify_all();
-            }
-            // 释放锁
-            // 当前线程负责执行任务
-            if (task != nullptr)
-               task();//执行function<void()>
-            freeThreadSize_++;
-            lastTime = std::chrono::high_resolution_clock().now();
-        }    
-        std::this_thread::sleep_for(std::chrono::seconds(2));
+                catch (...)
+                {
+                    // 以该异常关闭通道,生产者的send返回false而不是永远等待空位
+                    std::exception_ptr e = std::current_exception();
+                    s.close(e);
+                    done->setError(e);
+                    return;
+                }
+                item.reset();
+            }
+            // 还有数据,重新排队让其他任务有机会执行
+            schedule();
+        }
+        std::shared_ptr<State> state;
+        Func func;
+        FutureStatePtr<void> done;
     };
-    bool poolState()
+
+public:
+#ifdef THREADPOOL_COROUTINE
+    class ReceiveAwaiter
     {
-         return isRuning_;
+    public:
+        explicit ReceiveAwaiter(std::shared_ptr<State> state) : state_(std::move(state)) {}
+        bool await_ready() { return poll(); }
+        // 登记后可能立即被唤醒并在其他线程恢复协程,之后不能再访问本对象
+        void await_suspend(std::coroutine_handle<> h)
+        {
+            h_ = h;
+            park();
+        }
+        std::optional<T> await_resume()
+        {
+            if (!value_ && state_->error)
+                std::rethrow_exception(state_->error);
+            return std::move(value_);
+        }
+    private:
+        // 取到数据或通道已经关闭时返回true
+        bool poll()
+        {
+            if (state_->tryReceive(value_))
+                return true;
+            if (!state_->closed.load(std::memory_order_acquire))
+                return false;
+            state_->tryReceive(value_);
+            return true;
+        }
+        // 登记之后协程可能已经在其他线程恢复并销毁了通道,用局部的shared_ptr保证State在wait返回前有效
+        void park()
+        {
+            std::shared_ptr<State> state = state_;
+            State& s = *state;
+            s.wait(s.receivers, s.recvWaiting, [this]() { onWake(); }, [&s]() { return s.readable(); });
+        }
+        // 数据可能已经被其他接收方取走,没有取到时重新登记
+        void onWake()
+        {
+            if (poll())
+                state_->dispatch(ResumeTask(h_));
+            else
+                park();
+        }
+        std::shared_ptr<State> state_;
+        std::coroutine_handle<> h_;
+        std::optional<T> value_;
     };
-    //std::vector<std::unique_ptr<Thread>> threads_; 线程数组
-    std::unordered_map<int,std::unique_ptr<Thread>>threads_;
-    size_t initThreadSize_; //初始的线程数量
-    size_t maxThreadSisze_; //线程池线程数量上限
-    std::atomic_int curThreadSize_;//记录当前线程池中线程总数量
-    std::atomic_int freeThreadSize_;//记录空闲线程数量
+    class SendAwaiter
+    {
+    public:
+        SendAwaiter(std::shared_ptr<State> state, T value)
+            : state_(std::move(state))
+            , value_(std::move(value))
+            {}
+        bool await_ready() { return poll(); }
+        void await_suspend(std::coroutine_handle<> h)
+        {
+            h_ = h;
+            park();
+        }
+        bool await_resume() const { return sent_; }
+    private:
+        bool poll()
+        {
+            sent_ = state_->trySend(std::move(value_));
+            return sent_ || state_->closed.load(std::memory_order_acquire);
+        }
+        void park()
+        {
+            std::shared_ptr<State> state = state_;
+            State& s = *state;
+            s.wait(s.senders, s.sendWaiting, [this]() { onWake(); }, [&s]() { return s.writable(); });
+        }
+        void onWake()
+        {
+            if (poll())
+                state_->dispatch(ResumeTask(h_));
+            else
+                park();
+        }
+        std::shared_ptr<State> state_;
+        std::coroutine_handle<> h_;
+        T value_;
+        bool sent_ = false;
+    };
+#endif
 
-    using Task = std::function<void()>;
-    std::queue<Task> taskQue_; //任务队列
-    
-    std::atomic_int8_t taskSize_;   // 任务的数量
-    int taskQueMaxSize_; //任务队列最大上限
-    std::mutex taskQueMtx_;
-    std::condition_variable notFull_;   //表示任务队列不满
-    std::condition_variable notEmpty_;  //表示任务队列不空  
-    std::condition_variable recycle_;   //线程池析构回收子线程资源
+private:
+    std::shared_ptr<State> state_;
+};
 
-    PoolMode   PoolMode_;   //当前线程池的工作模式
-    std::atomic_bool isRuning_;
+// submitStream的生产者任务,没有执行就被销毁(例如被cancelAll移除)时以broken_promise关闭通道,接收方不会永远等待
+template<typename T, typename Func>
+class StreamTask
+{
+public:
+    StreamTask(Channel<T> channel, Func func)
+        : channel_(std::move(channel))
+        , func_(std::move(func))
+        {}
+    StreamTask(StreamTask&& other) noexcept(std::is_nothrow_move_constructible<Func>::value)
+        : channel_(std::move(other.channel_))
+        , func_(std::move(other.func_))
+        , armed_(std::exchange(other.armed_, false))
+        {}
+    ~StreamTask()
+    {
+        if (armed_)
+            channel_.close(std::make_exception_ptr(std::future_error(std::future_errc::broken_promise)));
+    }
+    void operator()()
+    {
+        armed_ = false;
+        try
+        {
+            func_(channel_);
+            channel_.close();
+        }
+        catch (...)
+        {
+            channel_.close(std::current_exception());
+        }
+    }
+private:
+    Channel<T> channel_;
+    Func func_;
+    bool armed_ = true;
 };
 
+template<typename T, typename Func>
+Channel<T> ThreadPool::submitStream(Func&& func, size_t capacity)
+{
+    Channel<T> channel(*this, capacity);
+    Task task = StreamTask<T, std::decay_t<Func>>(channel, std::forward<Func>(func));
+    if (PoolMode_ == PoolMode::MODE_WORK_STEALING && curPool_ == this)
+    {
+        workers_[curIndex_]->push(newTask(std::move(task)));
+        wakeSleepers(1);
+        return channel;
+    }
+    switch (pushTask(task, queFullPolicy_))
+    {
+    case PushResult::PUSHED:
+        break;
+    case PushResult::CALLER_RUN:
+        task();
+        break;
+    case PushResult::REJECTED:
+        channel.close(std::make_exception_ptr(TaskRejectedError()));
+        break;
+    }
+    return channel;
+}
 
 #endif //THREADPOOL_FINALL
\ No newline at end of file